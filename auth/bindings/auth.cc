@@ -58,6 +58,7 @@ Handle<Value> Add(const Arguments& args) {
   }
   open_authorizations("w");
   add_authorization(&auth);
+  publish_authorization_snapshot();
   close_authorizations();
 
   for(i=0;i<n;i++) {
@@ -79,7 +80,9 @@ Handle<Value> Remove(const Arguments& args) {
   auth.username = *username;
   auth.token = *token;
   open_authorizations("w");
-  remove_authorization(&auth);
+  if(remove_authorization(&auth) == 0) {
+    publish_authorization_snapshot();
+  }
   close_authorizations();
   return Undefined();
 }
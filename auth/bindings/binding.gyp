@@ -2,7 +2,7 @@
   "targets": [
     {
       "target_name": "rs_serve_auth",
-      "sources": [ "auth.cc", "../../src/common/auth.c" ],
+      "sources": [ "auth.cc", "../../src/common/auth.c", "../../src/common/auth_snapshot.c" ],
       "include_dirs": [ "../../src" ],
       "cflags": [ "-std=c99", "-ggdb" ],
       "link_settings": {
@@ -0,0 +1,39 @@
+#!/bin/bash
+
+## Starts rs-serve with a temporary storage root and runs the load generator
+## (test/bench/loadgen) against it. Extra arguments are passed to the load
+## generator, e.g.:
+##
+##   scripts/bench.sh --concurrency=64 --duration=30 --mix=get=90,put=10
+##
+## The storage root is created below the home directory of the current user,
+## who must be allowed to use rs-serve (uid >= RS_MIN_UID).
+## A temporary token is added for the duration of the run.
+
+PORT=${BENCH_PORT:-8182}
+BENCH_USER=$(id -un)
+BENCH_DIR=".rs-serve-bench.$$"
+TOKEN="bench-$$-$RANDOM"
+
+if [ $(id -u) -lt 1000 ] ; then
+  echo "Refusing to benchmark as $BENCH_USER (uid $(id -u)), rs-serve doesn't serve users with uid < 1000." >&2
+  exit 1
+fi
+
+mkdir -p tmp/ "$HOME/$BENCH_DIR"
+tools/add-token $BENCH_USER $TOKEN root:rw > /dev/null || exit 1
+
+cleanup() {
+  [ -n "$SERVER_PID" ] && kill $SERVER_PID
+  tools/remove-token $BENCH_USER $TOKEN > /dev/null
+  rm -rf "$HOME/$BENCH_DIR"
+}
+trap cleanup EXIT
+
+./rs-serve --port $PORT --dir $BENCH_DIR --log-file tmp/bench-server.log \
+  --access-log tmp/bench-access.log &
+SERVER_PID=$!
+sleep 1
+
+echo "rs-serve $(git describe --always --dirty 2>/dev/null) (pid $SERVER_PID, port $PORT)"
+test/bench/loadgen --port $PORT --user $BENCH_USER --token $TOKEN "$@"
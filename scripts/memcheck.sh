@@ -0,0 +1,79 @@
+#!/bin/bash
+
+## Runs rs-serve under sustained load (using test/bench/loadgen) and samples
+## it's resident memory once per second, to detect memory growth.
+##
+## Samples taken during the first $MEMCHECK_WARMUP seconds are ignored. If the
+## resident set grows by more than $MEMCHECK_MAX_GROWTH kB after that, the
+## check fails. Extra arguments are passed to the load generator, e.g.:
+##
+##   MEMCHECK_DURATION=300 scripts/memcheck.sh --mix=get=50,put=40,delete=10
+##
+## Samples are written to tmp/memcheck.log ("<seconds> <VmRSS in kB>").
+## Build with `make MEMPROFILE=1' to also get allocation counts in
+## tmp/memcheck-access.log and tmp/memcheck-server.log (at exit).
+##
+## Like scripts/bench.sh, this needs a user with uid >= RS_MIN_UID.
+
+PORT=${MEMCHECK_PORT:-8183}
+DURATION=${MEMCHECK_DURATION:-60}
+WARMUP=${MEMCHECK_WARMUP:-10}
+MAX_GROWTH=${MEMCHECK_MAX_GROWTH:-1024}
+CHECK_USER=$(id -un)
+CHECK_DIR=".rs-serve-memcheck.$$"
+TOKEN="memcheck-$$-$RANDOM"
+
+if [ $(id -u) -lt 1000 ] ; then
+  echo "Refusing to run as $CHECK_USER (uid $(id -u)), rs-serve doesn't serve users with uid < 1000." >&2
+  exit 1
+fi
+
+mkdir -p tmp/ "$HOME/$CHECK_DIR"
+tools/add-token $CHECK_USER $TOKEN root:rw > /dev/null || exit 1
+
+cleanup() {
+  [ -n "$LOADGEN_PID" ] && kill $LOADGEN_PID 2>/dev/null
+  [ -n "$SERVER_PID" ] && kill $SERVER_PID
+  tools/remove-token $CHECK_USER $TOKEN > /dev/null
+  rm -rf "$HOME/$CHECK_DIR"
+}
+trap cleanup EXIT
+
+./rs-serve --port $PORT --dir $CHECK_DIR --log-file tmp/memcheck-server.log \
+  --access-log tmp/memcheck-access.log &
+SERVER_PID=$!
+sleep 1
+
+test/bench/loadgen --port $PORT --user $CHECK_USER --token $TOKEN \
+  --duration $DURATION "$@" > tmp/memcheck-loadgen.log &
+LOADGEN_PID=$!
+
+rss() {
+  awk '/^VmRSS:/ { print $2 }' /proc/$SERVER_PID/status
+}
+
+> tmp/memcheck.log
+for (( t = 0; t <= DURATION; t++ )) ; do
+  if [ ! -d /proc/$SERVER_PID ] ; then
+    echo "rs-serve (pid $SERVER_PID) died after ${t}s, see tmp/memcheck-server.log" >&2
+    SERVER_PID=
+    exit 1
+  fi
+  echo "$t $(rss)" >> tmp/memcheck.log
+  sleep 1
+done
+wait $LOADGEN_PID
+LOADGEN_PID=
+
+cat tmp/memcheck-loadgen.log
+awk -v warmup=$WARMUP -v max_growth=$MAX_GROWTH '
+  $1 == warmup { base = $2 }
+  { last = $2; if($2 > peak) peak = $2 }
+  END {
+    growth = last - base
+    printf "VmRSS: %d kB after warmup, %d kB at the end (peak %d kB), growth %d kB\n", base, last, peak, growth
+    if(growth > max_growth) {
+      printf "FAILED: memory grew by more than %d kB\n", max_growth
+      exit 1
+    }
+  }' tmp/memcheck.log
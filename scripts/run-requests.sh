@@ -1,7 +1,7 @@
 #!/bin/bash
 
 ## run various requests against running test server.
-## this script is pretty useless on it's own, but used by leakcheck.sh/limitcheck.sh
+## this script is pretty useless on it's own, but used by leakcheck.sh
 
 get() {
   echo -n "GET $1"
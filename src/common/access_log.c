@@ -0,0 +1,99 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rs-serve.h"
+
+/*
+ * Access log
+ * ----------
+ *
+ * One JSON object per line, such as:
+ *
+ *   {"time":"2013-06-01T12:00:00+0200","method":"GET","user":"me",
+ *    "path":"/contacts/","status":200,"bytes_in":0,"bytes_out":1234,
+ *    "total_us":412,"phases_us":{"user":3,"auth":20,"path":11,"stat":1,
+ *    "etag":310,"content_type":0,"body":350}}
+ *
+ * (without the line breaks). Phase times are accumulated over all instances
+ * of a phase and may overlap (see enum rs_phase).
+ *
+ * Builds with RS_MEMPROFILE also log the number of allocations made while
+ * dispatching the request, as "allocs", "alloc_bytes", "frees" and
+ * "phases_allocs" (see memprofile.h).
+ *
+ * The log file is fully buffered. It's flushed once per second by the main
+ * loop and on exit.
+ */
+
+static time_t timestamp_time = 0;
+static char timestamp[32];
+
+static const char *time_now() {
+  time_t t = time(NULL);
+  if(t != timestamp_time) {
+    struct tm tm;
+    localtime_r(&t, &tm);
+    strftime(timestamp, sizeof(timestamp), "%FT%T%z", &tm);
+    timestamp_time = t;
+  }
+  return timestamp;
+}
+
+static void write_string(FILE *fp, const char *string) {
+  const unsigned char *p;
+  fputc('"', fp);
+  for(p = (const unsigned char *)string; *p; p++) {
+    if(*p == '"' || *p == '\\') {
+      fputc('\\', fp);
+      fputc(*p, fp);
+    } else if(*p < 0x20) {
+      fprintf(fp, "\\u%04x", *p);
+    } else {
+      fputc(*p, fp);
+    }
+  }
+  fputc('"', fp);
+}
+
+void write_access_log(evhtp_request_t *req, struct rs_request *ctx, const char *method) {
+  FILE *fp = RS_ACCESS_LOG;
+  if(fp == NULL) {
+    return;
+  }
+  fprintf(fp, "{\"time\":\"%s\",\"method\":", time_now());
+  write_string(fp, method);
+  fputs(",\"user\":", fp);
+  write_string(fp, ctx->user ? ctx->user->name : REQUEST_GET_USER(req));
+  fputs(",\"path\":", fp);
+  // (path is only normalized if the request got that far)
+  write_string(fp, ctx->path.path ? ctx->path.path : REQUEST_GET_PATH(req));
+  fprintf(fp, ",\"status\":%d,\"bytes_in\":%zu,\"bytes_out\":%zu,\"total_us\":%lld,\"phases_us\":{",
+          req->status, ctx->bytes_in, ctx->bytes_out, request_elapsed_ns(ctx) / 1000);
+  int i;
+  for(i = 0; i < RS_PHASE_COUNT; i++) {
+    fprintf(fp, "%s\"%s\":%lld", i == 0 ? "" : ",", rs_phase_names[i], ctx->phase_ns[i] / 1000);
+  }
+#ifdef RS_MEMPROFILE
+  fprintf(fp, "},\"allocs\":%lu,\"alloc_bytes\":%zu,\"frees\":%lu,\"phases_allocs\":{",
+          ctx->mem.allocs, ctx->mem.bytes_allocated, ctx->mem.frees);
+  for(i = 0; i < RS_PHASE_COUNT; i++) {
+    fprintf(fp, "%s\"%s\":%lu", i == 0 ? "" : ",", rs_phase_names[i], ctx->phase_mem[i].allocs);
+  }
+#endif
+  fputs("}}\n", fp);
+}
+
+void flush_access_log() {
+  if(RS_ACCESS_LOG) {
+    fflush(RS_ACCESS_LOG);
+  }
+}
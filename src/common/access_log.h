@@ -0,0 +1,29 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RS_COMMON_ACCESS_LOG_H
+#define RS_COMMON_ACCESS_LOG_H
+
+/**
+ * write_access_log()
+ *
+ * Appends a JSON object describing the given (finished) storage request as a
+ * single line to the access log (see --access-log option). Does nothing if
+ * no access log was configured.
+ *
+ * Lines are buffered, call flush_access_log() periodically.
+ */
+void write_access_log(evhtp_request_t *req, struct rs_request *ctx, const char *method);
+
+void flush_access_log();
+
+#endif /* !RS_COMMON_ACCESS_LOG_H */
@@ -0,0 +1,88 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/arena.h"
+
+#define ALIGNMENT 16
+#define ALIGN(n) (((n) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1))
+
+struct rs_arena_block {
+  struct rs_arena_block *next;
+  size_t size;
+  char data[] __attribute__((aligned(ALIGNMENT)));
+};
+
+static char *align_ptr(char *ptr) {
+  return (char*)ALIGN((size_t)ptr);
+}
+
+void arena_init(struct rs_arena *arena) {
+  arena->pos = align_ptr(arena->inline_block);
+  arena->end = arena->inline_block + RS_ARENA_INLINE_SIZE;
+  arena->blocks = NULL;
+}
+
+void *arena_alloc(struct rs_arena *arena, size_t size) {
+  size = ALIGN(size);
+  if(size > arena->end - arena->pos) {
+    size_t block_size = size > RS_ARENA_BLOCK_SIZE ? size : RS_ARENA_BLOCK_SIZE;
+    struct rs_arena_block *block = malloc(sizeof(struct rs_arena_block) + block_size);
+    if(block == NULL) {
+      return NULL;
+    }
+    block->size = block_size;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->pos = block->data;
+    arena->end = block->data + block_size;
+  }
+  void *ptr = arena->pos;
+  arena->pos += size;
+  return ptr;
+}
+
+char *arena_strdup(struct rs_arena *arena, const char *string) {
+  size_t len = strlen(string) + 1;
+  char *copy = arena_alloc(arena, len);
+  if(copy) {
+    memcpy(copy, string, len);
+  }
+  return copy;
+}
+
+struct rs_arena_mark arena_mark(struct rs_arena *arena) {
+  struct rs_arena_mark mark = { arena->pos, arena->end, arena->blocks };
+  return mark;
+}
+
+static void free_blocks_until(struct rs_arena *arena, struct rs_arena_block *last) {
+  struct rs_arena_block *block, *next;
+  for(block = arena->blocks; block != last; block = next) {
+    next = block->next;
+    free(block);
+  }
+  arena->blocks = last;
+}
+
+void arena_reset(struct rs_arena *arena, struct rs_arena_mark mark) {
+  free_blocks_until(arena, mark.blocks);
+  arena->pos = mark.pos;
+  arena->end = mark.end;
+}
+
+void arena_release(struct rs_arena *arena) {
+  free_blocks_until(arena, NULL);
+  arena_init(arena);
+}
@@ -0,0 +1,72 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RS_COMMON_ARENA_H
+#define RS_COMMON_ARENA_H
+
+/**
+ * File: arena.h
+ *
+ * A bump allocator for memory that lives as long as a request does.
+ *
+ * Allocations are carved out of an inline block first, then out of blocks
+ * of RS_ARENA_BLOCK_SIZE bytes (or larger, for large allocations). Nothing
+ * is freed individually: arena_release() frees everything at once, and
+ * arena_reset() drops everything allocated since a given arena_mark(), which
+ * keeps loops (such as directory listings) from growing the arena.
+ */
+
+#include <stddef.h>
+
+#define RS_ARENA_INLINE_SIZE 1024
+#define RS_ARENA_BLOCK_SIZE 8192
+
+struct rs_arena_block;
+
+struct rs_arena {
+  // free space in the current block
+  char *pos;
+  char *end;
+  // allocated blocks, most recent first
+  struct rs_arena_block *blocks;
+  char inline_block[RS_ARENA_INLINE_SIZE];
+};
+
+struct rs_arena_mark {
+  char *pos;
+  char *end;
+  struct rs_arena_block *blocks;
+};
+
+void arena_init(struct rs_arena *arena);
+
+/**
+ * arena_alloc()
+ *
+ * Returns `size' bytes of memory, suitably aligned for any type.
+ * Returns NULL if memory allocation fails.
+ */
+void *arena_alloc(struct rs_arena *arena, size_t size);
+char *arena_strdup(struct rs_arena *arena, const char *string);
+
+struct rs_arena_mark arena_mark(struct rs_arena *arena);
+void arena_reset(struct rs_arena *arena, struct rs_arena_mark mark);
+
+/**
+ * arena_release()
+ *
+ * Frees all memory allocated from the arena. The arena can be used again
+ * afterwards.
+ */
+void arena_release(struct rs_arena *arena);
+
+#endif /* !RS_COMMON_ARENA_H */
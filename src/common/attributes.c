@@ -12,86 +12,86 @@
 
 #include <rs-serve.h>
 
-int set_xattr(const char *path, const char *key, const char *value, size_t len) {
-  if(setxattr(path, key, value, len, 0) != 0) {
+int set_xattr(int fd, const char *key, const char *value, size_t len) {
+  if(fsetxattr(fd, key, value, len, 0) != 0) {
     log_error("setxattr() failed: %s", strerror(errno));
     return -1;
   }
   return 0;
 }
 
-int set_meta_attr(const char *path, const char *key, const char *value, size_t len) {
+int set_meta_attr(int fd, const char *key, const char *value, size_t len) {
   log_error("set_meta_attr() not implemented!");
   abort();
 }
 
-char *get_xattr(const char *path, const char *key, size_t maxlen) {
-  int len = 32;
-  char *value = NULL;
-  for(value = malloc(len);len<=maxlen;value = realloc(value, len+=16)) {
-    if(value == NULL) {
-      log_error("malloc() / realloc() failed: %s", strerror(errno));
-      return NULL;
-    }
-    int actual_len = getxattr(path, key, value, len);
-    if(actual_len > 0) {
-      value[actual_len] = 0;
-      return value;
-    } else {
-      if(errno == ERANGE) {
-        // buffer too small.
-        continue;
-      } else if(errno == ENOATTR) {
-        // attribute not set
-        free(value);
-        return NULL;
-      } else if(errno == ENOTSUP) {
-        // xattr not supported
-        log_error("File system doesn't support extended attributes! You may want to use another one.");
-        free(value);
-        return NULL;
-      } else {
-        log_error("Unexpected error while getting %s attribute: %s", key, strerror(errno));
-        free(value);
-        return NULL;
-      }
-    }
+int remove_xattr(int fd, const char *key) {
+  if(fremovexattr(fd, key) != 0 && errno != ENOATTR) {
+    log_error("removexattr() failed: %s", strerror(errno));
+    return -1;
   }
-  log_error("%s attribute seems to be longer than %d bytes. That is simply unreasonable.", key, maxlen);
-  free(value);
+  return 0;
+}
+
+int remove_meta_attr(int fd, const char *key) {
+  log_error("remove_meta_attr() not implemented!");
+  abort();
+}
+
+// `maxlen' includes the terminating NUL byte.
+char *get_xattr(int fd, const char *key, size_t maxlen, struct rs_arena *arena) {
+  struct rs_arena_mark mark = arena_mark(arena);
+  char *value = arena_alloc(arena, maxlen);
+  if(value == NULL) {
+    log_error("arena_alloc() failed: %s", strerror(errno));
+    return NULL;
+  }
+  ssize_t actual_len = fgetxattr(fd, key, value, maxlen - 1);
+  if(actual_len > 0) {
+    value[actual_len] = 0;
+    return value;
+  }
+  if(actual_len == 0 || errno == ENOATTR) {
+    // attribute not set
+  } else if(errno == ERANGE) {
+    log_error("%s attribute seems to be longer than %zu bytes. That is simply unreasonable.", key, maxlen - 1);
+  } else if(errno == ENOTSUP) {
+    // xattr not supported
+    log_error("File system doesn't support extended attributes! You may want to use another one.");
+  } else {
+    log_error("Unexpected error while getting %s attribute: %s", key, strerror(errno));
+  }
+  arena_reset(arena, mark);
   return NULL;
 }
 
-char *get_meta_attr(const char *path, const char *key, size_t maxlen) {
+char *get_meta_attr(int fd, const char *key, size_t maxlen, struct rs_arena *arena) {
   log_error("get_meta_attr() not implemented!");
   abort();
 }
 
-char *content_type_from_xattr(const char *path) {
-  char *mime_type = get_meta(path, "mime_type", 128);
+char *content_type_from_xattr(int fd, struct rs_arena *arena) {
+  char *mime_type = get_meta(fd, "mime_type", 128, arena);
   if(mime_type == NULL) {
     return NULL;
   }
-  char *charset = get_meta(path, "charset", 64);
+  char *charset = get_meta(fd, "charset", 64, arena);
   if(charset == NULL) {
     return mime_type;
   }
-  int mt_len = strlen(mime_type);
-  char *content_type = realloc(mime_type, mt_len + strlen(charset) + 10 + 1);
+  char *content_type = arena_alloc(arena, strlen(mime_type) + strlen(charset) + 10 + 1);
   if(content_type == NULL) {
-    log_error("realloc() failed: %s", strerror(errno));
-    free(charset);
+    log_error("arena_alloc() failed: %s", strerror(errno));
     return mime_type;
   }
-  sprintf(content_type + mt_len, "; charset=%s", charset);
-  free(charset);
+  sprintf(content_type, "%s; charset=%s", mime_type, charset);
   return content_type;
 }
 
-int content_type_to_xattr(const char *path, const char *content_type) {
-  char *content_type_copy = strdup(content_type), *saveptr = NULL;
+int content_type_to_xattr(int fd, const char *content_type, struct rs_arena *arena) {
+  char *content_type_copy = arena_strdup(arena, content_type), *saveptr = NULL;
   if(content_type_copy == NULL) {
-    log_error("strdup() failed: %s", strerror(errno));
+    log_error("arena_strdup() failed: %s", strerror(errno));
     return -1;
   }
   char *mime_type = strtok_r(content_type_copy, ";", &saveptr);
@@ -110,98 +110,110 @@ int content_type_to_xattr(const char *path, const char *content_type) {
     charset = "UTF-8";
     log_debug("guessed charset: %s", charset);
   }
-  set_meta(path, "mime_type", mime_type, strlen(mime_type) + 1);
-  set_meta(path, "charset", charset, strlen(charset) + 1);
-  free(content_type_copy);
+  set_meta(fd, "mime_type", mime_type, strlen(mime_type) + 1);
+  set_meta(fd, "charset", charset, strlen(charset) + 1);
   return 0;
 }
 
-char *get_etag(const char *disk_path) {
+static unsigned long stamp_counter = 0;
+
+// generates a new (opaque) version stamp for the directory given by `fd' and
+// stores it as the directory's etag. The stamp only has to differ from all
+// previous ones, so it's the hash of the directory's identity, the current
+// time and a counter.
+char *stamp_etag(int fd, struct rs_arena *arena) {
   size_t etag_len = SHA_DIGEST_LENGTH * 2;
-  char *etag = get_meta(disk_path, "etag", etag_len + 1);
+  struct {
+    dev_t dev;
+    ino_t ino;
+    struct timespec now;
+    pid_t pid;
+    unsigned long counter;
+  } seed;
+  unsigned char digest[SHA_DIGEST_LENGTH];
+  struct stat stat_buf;
+  memset(&seed, 0, sizeof(seed));
+  if(fstat(fd, &stat_buf) == 0) {
+    seed.dev = stat_buf.st_dev;
+    seed.ino = stat_buf.st_ino;
+  }
+  clock_gettime(CLOCK_REALTIME, &seed.now);
+  seed.pid = getpid();
+  seed.counter = __atomic_add_fetch(&stamp_counter, 1, __ATOMIC_RELAXED);
+  SHA1((unsigned char*)&seed, sizeof(seed), digest);
+  char *etag = arena_alloc(arena, etag_len + 1);
   if(etag == NULL) {
-    log_debug("%s: etag not set, calculating SHA1 sum", disk_path);
-    etag = malloc(etag_len + 1);
-    if(etag == NULL) {
-      log_error("malloc() failed: %s", strerror(errno));
+    log_error("arena_alloc() failed: %s", strerror(errno));
+    return NULL;
+  }
+  int i;
+  for(i=0;i<SHA_DIGEST_LENGTH;i++) {
+    sprintf(etag + i * 2, "%02x", digest[i]);
+  }
+  set_meta(fd, "etag", etag, etag_len);
+  return etag;
+}
+
+int clear_etag(int fd) {
+  return remove_meta(fd, "etag");
+}
+
+// returns the etag of the file or directory given by `fd' (which must be
+// opened for reading), calculating and caching it in it's meta information
+// if it isn't known yet.
+// Files are identified by the SHA1 sum of their contents. Directories get a
+// version stamp (see stamp_etag()), which is renewed whenever something below
+// them changes, so it never has to be derived from the children.
+// The etag is allocated from `arena'.
+char *get_etag(int fd, struct rs_arena *arena) {
+  size_t etag_len = SHA_DIGEST_LENGTH * 2;
+  char *etag = get_meta(fd, "etag", etag_len + 1, arena);
+  if(etag == NULL) {
+    struct stat stat_buf;
+    memset(&stat_buf, 0, sizeof(struct stat));
+    if(fstat(fd, &stat_buf) == -1) {
+      log_error("fstat() failed: %s", strerror(errno));
       return NULL;
     }
-    *etag = 0;
+    if(S_ISDIR(stat_buf.st_mode)) {
+      log_debug("fd %d: etag not set, stamping directory", fd);
+      return stamp_etag(fd, arena);
+    }
+    log_debug("fd %d: etag not set, calculating SHA1 sum", fd);
     SHA_CTX c;
     if(SHA1_Init(&c) != 1) {
       log_error("SHA1_Init() failed");
-      free(etag);
-      return NULL;
-    }
-    int fd = open(disk_path, O_RDONLY);
-    if(fd == -1) {
-      log_error("open() failed: %s", strerror(errno));
-      free(etag);
-      return NULL;
-    }
-    struct stat stat_buf;
-    memset(&stat_buf, 0, sizeof(struct stat));
-    if(stat(disk_path, &stat_buf) == -1) {
-      log_error("stat() failed: %s", strerror(errno));
-      free(etag);
       return NULL;
     }
     unsigned char buf[4096];
-    if(S_ISDIR(stat_buf.st_mode)) {
-      // DIRECTORY: calculate sum of child etags
-      size_t path_len = strlen(disk_path);
-      char name_buf[path_len + pathconf(disk_path, _PC_NAME_MAX) + 2];
-      char *path_concat_format = disk_path[path_len - 1] == '/' ? "%s%s" : "%s/%s";
-      DIR *dir = opendir(disk_path);
-      if(dir == NULL) {
-        log_error("opendir() failed: %s", strerror(errno));
-        free(etag);
-        return NULL;
-      }
-      size_t child_len = offsetof(struct dirent, d_name) + pathconf(disk_path, _PC_NAME_MAX) + 1;
-      struct dirent *child = malloc(child_len), *result = NULL;
-      if(child == NULL) {
-        log_error("malloc() failed: %s", strerror(errno));
-        free(etag);
-        return NULL;
-      }
-      for(readdir_r(dir, child, &result); result != NULL;
-          readdir_r(dir, child, &result)) {
-        if(strcmp(child->d_name, ".") == 0 ||
-           strcmp(child->d_name, "..") == 0)
-          continue;
-        sprintf(name_buf, path_concat_format, disk_path, child->d_name);
-        SHA1_Update(&c, get_etag(name_buf), etag_len);
-      }
-      closedir(dir);
-      free(child);
-    } else {
-      // FILE: calculate sum of contents
-      ssize_t buf_bytes;
-      for(buf_bytes = read(fd, buf, 4096); buf_bytes > 0;
-          buf_bytes = read(fd, buf, 4096)) {
-        if(SHA1_Update(&c, buf, buf_bytes) != 1) {
-          log_error("SHA1_Update() failed");
-          free(etag);
-          return NULL;
-        }
-      }
-      if(buf_bytes < 0) { // error during read()
-        log_error("read() failed: %s", strerror(errno));
-        free(etag);
+    ssize_t buf_bytes;
+    off_t offset = 0;
+    for(buf_bytes = pread(fd, buf, 4096, offset); buf_bytes > 0;
+        buf_bytes = pread(fd, buf, 4096, offset)) {
+      if(SHA1_Update(&c, buf, buf_bytes) != 1) {
+        log_error("SHA1_Update() failed");
         return NULL;
       }
+      offset += buf_bytes;
+    }
+    if(buf_bytes < 0) { // error during read()
+      log_error("read() failed: %s", strerror(errno));
+      return NULL;
     }
     if(SHA1_Final(buf, &c) != 1) {
       log_error("SHA1_Final() failed");
-      free(etag);
+      return NULL;
+    }
+    etag = arena_alloc(arena, etag_len + 1);
+    if(etag == NULL) {
+      log_error("arena_alloc() failed: %s", strerror(errno));
       return NULL;
     }
     int i;
     for(i=0;i<SHA_DIGEST_LENGTH;i++) {
-      sprintf(etag, "%s%02x", etag, buf[i]);
+      sprintf(etag + i * 2, "%02x", buf[i]);
     }
-    set_meta(disk_path, "etag", etag, etag_len);
+    set_meta(fd, "etag", etag, etag_len);
     // TODO: set last update time of etag also to detect oob edits.
   }
   return etag;
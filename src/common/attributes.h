@@ -13,28 +13,42 @@
 #ifndef RS_COMMON_ATTRIBUTES_H
 #define RS_COMMON_ATTRIBUTES_H
 
-char *get_xattr(const char *path, const char *key, size_t maxlen);
-char *get_meta_attr(const char *path, const char *key, size_t maxlen);
+// (returned strings are allocated from the given arena)
+char *get_xattr(int fd, const char *key, size_t maxlen, struct rs_arena *arena);
+char *get_meta_attr(int fd, const char *key, size_t maxlen, struct rs_arena *arena);
 
-int set_xattr(const char *path, const char *key, const char *value, size_t len);
-int set_meta_attr(const char *path, const char *key, const char *value, size_t len);
+int set_xattr(int fd, const char *key, const char *value, size_t len);
+int set_meta_attr(int fd, const char *key, const char *value, size_t len);
 
-int content_type_to_xattr(const char *path, const char *content_type);
-char *content_type_from_xattr(const char *path);
+// (removing an attribute that isn't set is not an error)
+int remove_xattr(int fd, const char *key);
+int remove_meta_attr(int fd, const char *key);
 
-char *get_etag(const char *disk_path);
+int content_type_to_xattr(int fd, const char *content_type, struct rs_arena *arena);
+char *content_type_from_xattr(int fd, struct rs_arena *arena);
 
-// Macro: get_meta(path, key, maxlen)
-// Get meta information with given key about file given by path.
+char *get_etag(int fd, struct rs_arena *arena);
+// renews the etag of a directory, after something below it changed
+char *stamp_etag(int fd, struct rs_arena *arena);
+// forgets the cached etag of a file, after it's contents changed
+int clear_etag(int fd);
+
+// Macro: get_meta(fd, key, maxlen, arena)
+// Get meta information with given key about file given by (open) fd.
 // `key' must be a static string.
-#define get_meta(path, key, maxlen)             \
+#define get_meta(fd, key, maxlen, arena)                \
+  (RS_USE_XATTR ?                                       \
+   get_xattr(fd, "user." key, maxlen, arena) :          \
+   get_meta_attr(fd, key, maxlen, arena))
+
+#define set_meta(fd, key, value, len)           \
   (RS_USE_XATTR ?                               \
-   get_xattr(path, "user." key, maxlen) :       \
-   get_meta_attr(path, key, maxlen))
+   set_xattr(fd, "user." key, value, len) :     \
+   set_meta_attr(fd, key, value, len))
 
-#define set_meta(path, key, value, len)         \
+#define remove_meta(fd, key)                    \
   (RS_USE_XATTR ?                               \
-   set_xattr(path, "user." key, value, len) :   \
-   set_meta_attr(path, key, value, len))
+   remove_xattr(fd, "user." key) :              \
+   remove_meta_attr(fd, key))
 
 #endif
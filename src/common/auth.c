@@ -105,6 +105,10 @@ int remove_authorization(struct rs_authorization *auth) {
 
 
 struct rs_authorization *lookup_authorization(const char *username, const char *token) {
+  struct rs_authorization *auth;
+  if(lookup_snapshot_authorization(username, token, &auth) == 0) {
+    return auth;
+  }
   uint32_t keylen = strlen(username) + strlen(token) + 1;
   char *key = malloc(keylen + 1);
   if(key == NULL) {
@@ -120,8 +124,8 @@ struct rs_authorization *lookup_authorization(const char *username, const char *
   db_key.ulen = keylen + 1;
   db_key.flags = DB_DBT_MALLOC;
   int get_result = auth_db->get(auth_db, NULL, &db_key, &db_value, 0);
+  free(key);
   char *msg;
-  struct rs_authorization *auth;
   if(get_result == 0) {
     auth = malloc(sizeof(struct rs_authorization));
     if(auth == NULL) {
@@ -150,6 +154,16 @@ struct rs_authorization *lookup_authorization(const char *username, const char *
   }
 }
 
+int scope_matches(const struct rs_scope *scope, const char *path, int write) {
+  size_t scope_len = strlen(scope->name);
+  if(scope_len == 0 || // root scope
+     (strncmp(path + 1, scope->name, scope_len) == 0 && // other scope
+      path[1 + scope_len] == '/')) {
+    return scope->write || ! write;
+  }
+  return 0;
+}
+
 void pack_authorization(DBT *dest, struct rs_authorization *src) {
   size_t username_len = strlen(src->username), token_len = strlen(src->token);
   uint32_t size = username_len + 1 + token_len + 1;
@@ -44,6 +44,19 @@ void list_authorizations(const char *username, void (*cb)(struct rs_authorizatio
 void print_authorizations(const char *username);
 void print_authorization(struct rs_authorization *auth);
 struct rs_authorization *lookup_authorization(const char *username, const char *token);
+// frees the members of `auth' (not `auth' itself)
+void free_authorization(struct rs_authorization *auth);
+// checks if `scope' grants access to the (normalized) `path'. `write' must be
+// non-zero for requests that modify the storage.
+int scope_matches(const struct rs_scope *scope, const char *path, int write);
+
+// read-only snapshot of all authorizations (see auth_snapshot.c)
+int publish_authorization_snapshot();
+int open_authorization_snapshot();
+int reload_authorization_snapshot();
+void close_authorization_snapshot();
+int lookup_snapshot_authorization(const char *username, const char *token,
+                                  struct rs_authorization **auth);
 
 #ifdef __cplusplus
 }
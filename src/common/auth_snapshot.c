@@ -0,0 +1,522 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <db.h>
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include "config.h"
+#include "common/auth.h"
+
+/*
+ * Authorization snapshot
+ * ----------------------
+ *
+ * The token tools (and the node.js bindings) publish an immutable copy of the
+ * authorization database to RS_AUTH_SNAPSHOT_PATH after each change. rs-serve
+ * maps that file read-only and answers lookups from it, without touching the
+ * Berkeley DB environment at all.
+ *
+ * The file contains a minimal perfect hash ("hash and displace") over the
+ * "{username}|{token}" keys, so a lookup is two hashes and one memcmp():
+ *
+ *   header                       - struct snapshot_header
+ *   bucket_count * uint32_t      - displacement (hash seed) per bucket
+ *   slot_count * uint32_t        - record offset per slot (or SLOT_EMPTY)
+ *   records                      - uint32_t key_len, uint32_t value_len,
+ *                                  key, value (as in pack_authorization()),
+ *                                  padded to 4 bytes.
+ *
+ * New snapshots are written to a temporary file and rename()d into place, so
+ * readers always see either the old or the new file, never a partial one.
+ * Publishers hold an exclusive lock on SNAPSHOT_LOCK_PATH from reading the
+ * database until the rename(), so a snapshot taken before a concurrent change
+ * can never replace one taken after it.
+ *
+ */
+
+#define SNAPSHOT_MAGIC "RSAUTH01"
+#define SLOT_EMPTY 0xFFFFFFFF
+#define BUCKET_SIZE 4 // average number of keys per bucket
+#define MAX_DISPLACEMENT (1 << 20)
+#define SNAPSHOT_LOCK_PATH RS_AUTH_SNAPSHOT_PATH ".lock"
+
+struct snapshot_header {
+  char magic[8];
+  uint32_t count;
+  uint32_t bucket_count;
+  uint32_t slot_count;
+  uint32_t size;
+};
+
+struct snapshot_record {
+  char *key;
+  uint32_t key_len;
+  DBT value;
+  uint32_t hash;
+  uint32_t offset;
+};
+
+struct snapshot_bucket {
+  uint32_t index;
+  uint32_t count;
+  struct snapshot_record **records;
+};
+
+// currently mapped snapshot (rs-serve only)
+static const char *snapshot_data = NULL;
+static size_t snapshot_size = 0;
+static struct stat snapshot_stat;
+
+void pack_authorization(DBT *dest, struct rs_authorization *src);
+int unpack_authorization(struct rs_authorization *dest, DBT *src);
+
+static uint32_t hash_update(uint32_t h, const char *data, size_t len) {
+  size_t i;
+  for(i=0;i<len;i++) {
+    h ^= (unsigned char)data[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+static uint32_t hash_finish(uint32_t h) {
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+// hashes "{username}|{token}" without building the key.
+static uint32_t hash_auth_key(const char *username, size_t username_len,
+                              const char *token, size_t token_len,
+                              uint32_t seed) {
+  uint32_t h = 2166136261u ^ (seed * 0x9e3779b9);
+  h = hash_update(h, username, username_len);
+  h = hash_update(h, "|", 1);
+  h = hash_update(h, token, token_len);
+  return hash_finish(h);
+}
+
+static uint32_t hash_record(struct snapshot_record *record, uint32_t seed) {
+  char *sep = memchr(record->key, '|', record->key_len);
+  size_t username_len = sep - record->key;
+  return hash_auth_key(record->key, username_len,
+                       sep + 1, record->key_len - username_len - 1, seed);
+}
+
+static uint32_t read_u32(const char *ptr) {
+  uint32_t value;
+  memcpy(&value, ptr, sizeof(uint32_t));
+  return value;
+}
+
+/** PUBLISHING **/
+
+struct snapshot_builder {
+  struct snapshot_record *records;
+  uint32_t count;
+  uint32_t capacity;
+  int failed;
+};
+
+static void collect_record(struct rs_authorization *auth, void *ctx) {
+  struct snapshot_builder *builder = ctx;
+  if(builder->failed) {
+    return;
+  }
+  if(builder->count == builder->capacity) {
+    uint32_t capacity = builder->capacity ? builder->capacity * 2 : 64;
+    struct snapshot_record *records = realloc(builder->records,
+                                              capacity * sizeof(struct snapshot_record));
+    if(records == NULL) {
+      perror("Failed to allocate memory");
+      builder->failed = 1;
+      return;
+    }
+    builder->records = records;
+    builder->capacity = capacity;
+  }
+  struct snapshot_record *record = &builder->records[builder->count];
+  memset(record, 0, sizeof(struct snapshot_record));
+  record->key_len = strlen(auth->username) + 1 + strlen(auth->token);
+  record->key = malloc(record->key_len + 1);
+  if(record->key == NULL) {
+    perror("Failed to allocate memory");
+    builder->failed = 1;
+    return;
+  }
+  sprintf(record->key, "%s|%s", auth->username, auth->token);
+  pack_authorization(&record->value, auth);
+  if(record->value.data == NULL) {
+    free(record->key);
+    builder->failed = 1;
+    return;
+  }
+  builder->count++;
+}
+
+static int compare_buckets(const void *a, const void *b) {
+  const struct snapshot_bucket *bucket_a = a, *bucket_b = b;
+  return (int)bucket_b->count - (int)bucket_a->count;
+}
+
+// assigns each record a slot, by finding a displacement for every bucket that
+// maps all of it's keys to distinct free slots.
+static int build_perfect_hash(struct snapshot_builder *builder,
+                              uint32_t bucket_count, uint32_t slot_count,
+                              uint32_t *displacements, uint32_t *slots) {
+  uint32_t i, j, d;
+  int result = -1;
+  struct snapshot_bucket *buckets = calloc(bucket_count, sizeof(struct snapshot_bucket));
+  struct snapshot_record **bucket_records = malloc(builder->count * sizeof(struct snapshot_record*) + 1);
+  uint32_t *candidate = malloc(builder->count * sizeof(uint32_t) + 1);
+  if(buckets == NULL || bucket_records == NULL || candidate == NULL) {
+    perror("Failed to allocate memory");
+    goto out;
+  }
+  for(i=0;i<builder->count;i++) {
+    builder->records[i].hash = hash_record(&builder->records[i], 0) % bucket_count;
+    buckets[builder->records[i].hash].count++;
+  }
+  uint32_t offset = 0;
+  for(i=0;i<bucket_count;i++) {
+    buckets[i].index = i;
+    buckets[i].records = bucket_records + offset;
+    offset += buckets[i].count;
+    buckets[i].count = 0;
+  }
+  for(i=0;i<builder->count;i++) {
+    struct snapshot_bucket *bucket = &buckets[builder->records[i].hash];
+    bucket->records[bucket->count++] = &builder->records[i];
+  }
+  qsort(buckets, bucket_count, sizeof(struct snapshot_bucket), compare_buckets);
+
+  for(i=0;i<slot_count;i++) {
+    slots[i] = SLOT_EMPTY;
+  }
+  memset(displacements, 0, bucket_count * sizeof(uint32_t));
+
+  for(i=0;i<bucket_count && buckets[i].count > 0;i++) {
+    struct snapshot_bucket *bucket = &buckets[i];
+    for(d = 1; d < MAX_DISPLACEMENT; d++) {
+      for(j=0;j<bucket->count;j++) {
+        uint32_t slot = hash_record(bucket->records[j], d) % slot_count, k;
+        if(slots[slot] != SLOT_EMPTY) {
+          break;
+        }
+        for(k=0;k<j;k++) {
+          if(candidate[k] == slot) {
+            break;
+          }
+        }
+        if(k != j) {
+          break;
+        }
+        candidate[j] = slot;
+      }
+      if(j == bucket->count) {
+        break; // all keys placed
+      }
+    }
+    if(d == MAX_DISPLACEMENT) {
+      goto out; // caller retries with more slots
+    }
+    displacements[bucket->index] = d;
+    for(j=0;j<bucket->count;j++) {
+      // remember slot, offset is filled in when records are laid out
+      slots[candidate[j]] = bucket->records[j] - builder->records;
+    }
+  }
+  result = 0;
+
+ out:
+  free(candidate);
+  free(bucket_records);
+  free(buckets);
+  return result;
+}
+
+static int write_all(int fd, const void *buf, size_t count) {
+  const char *ptr = buf;
+  while(count > 0) {
+    ssize_t written = write(fd, ptr, count);
+    if(written < 0) {
+      if(errno == EINTR) continue;
+      return -1;
+    }
+    ptr += written;
+    count -= written;
+  }
+  return 0;
+}
+
+// opens and exclusively locks SNAPSHOT_LOCK_PATH. the lock is released when
+// the returned descriptor is closed.
+static int lock_snapshot() {
+  int fd = open(SNAPSHOT_LOCK_PATH, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  if(fd == -1) {
+    fprintf(stderr, "Failed to open snapshot lock %s: %s\n", SNAPSHOT_LOCK_PATH, strerror(errno));
+    return -1;
+  }
+  while(flock(fd, LOCK_EX) != 0) {
+    if(errno != EINTR) {
+      fprintf(stderr, "Failed to lock snapshot: %s\n", strerror(errno));
+      close(fd);
+      return -1;
+    }
+  }
+  return fd;
+}
+
+int publish_authorization_snapshot() {
+  struct snapshot_builder builder;
+  memset(&builder, 0, sizeof(builder));
+
+  int lock_fd = lock_snapshot();
+  if(lock_fd == -1) {
+    return -1;
+  }
+  list_authorizations(NULL, collect_record, &builder);
+
+  int result = -1, fd = -1;
+  uint32_t i, bucket_count = builder.count / BUCKET_SIZE + 1;
+  uint32_t slot_count = builder.count ? builder.count : 1;
+  uint32_t *displacements = NULL, *slots = NULL;
+  char tmp_path[] = RS_AUTH_SNAPSHOT_PATH ".XXXXXX";
+
+  if(builder.failed) {
+    goto out;
+  }
+
+  displacements = malloc(bucket_count * sizeof(uint32_t));
+  for(;;) {
+    free(slots);
+    slots = malloc(slot_count * sizeof(uint32_t));
+    if(displacements == NULL || slots == NULL) {
+      perror("Failed to allocate memory");
+      goto out;
+    }
+    if(build_perfect_hash(&builder, bucket_count, slot_count, displacements, slots) == 0) {
+      break;
+    }
+    // very unlikely. give the hash some room and try again.
+    slot_count += slot_count / 8 + 1;
+  }
+
+  // lay out records
+  uint32_t offset = sizeof(struct snapshot_header) +
+    (bucket_count + slot_count) * sizeof(uint32_t);
+  for(i=0;i<builder.count;i++) {
+    builder.records[i].offset = offset;
+    offset += 2 * sizeof(uint32_t) + builder.records[i].key_len + builder.records[i].value.size;
+    offset = (offset + 3) & ~3;
+  }
+  for(i=0;i<slot_count;i++) {
+    if(slots[i] != SLOT_EMPTY) {
+      slots[i] = builder.records[slots[i]].offset;
+    }
+  }
+
+  struct snapshot_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, 8);
+  header.count = builder.count;
+  header.bucket_count = bucket_count;
+  header.slot_count = slot_count;
+  header.size = offset;
+
+  fd = mkstemp(tmp_path);
+  if(fd == -1) {
+    fprintf(stderr, "Failed to create snapshot file %s: %s\n", tmp_path, strerror(errno));
+    goto out;
+  }
+  if(write_all(fd, &header, sizeof(header)) != 0 ||
+     write_all(fd, displacements, bucket_count * sizeof(uint32_t)) != 0 ||
+     write_all(fd, slots, slot_count * sizeof(uint32_t)) != 0) {
+    goto write_failed;
+  }
+  static const char padding[4] = { 0, 0, 0, 0 };
+  for(i=0;i<builder.count;i++) {
+    struct snapshot_record *record = &builder.records[i];
+    uint32_t value_len = record->value.size;
+    uint32_t len = 2 * sizeof(uint32_t) + record->key_len + value_len;
+    if(write_all(fd, &record->key_len, sizeof(uint32_t)) != 0 ||
+       write_all(fd, &value_len, sizeof(uint32_t)) != 0 ||
+       write_all(fd, record->key, record->key_len) != 0 ||
+       write_all(fd, record->value.data, value_len) != 0 ||
+       write_all(fd, padding, ((len + 3) & ~3) - len) != 0) {
+      goto write_failed;
+    }
+  }
+  if(fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) != 0 ||
+     fsync(fd) != 0) {
+    goto write_failed;
+  }
+  close(fd);
+  fd = -1;
+  if(rename(tmp_path, RS_AUTH_SNAPSHOT_PATH) != 0) {
+    fprintf(stderr, "Failed to rename snapshot into place: %s\n", strerror(errno));
+    unlink(tmp_path);
+    goto out;
+  }
+  result = 0;
+  goto out;
+
+ write_failed:
+  fprintf(stderr, "Failed to write snapshot: %s\n", strerror(errno));
+  close(fd);
+  fd = -1;
+  unlink(tmp_path);
+
+ out:
+  for(i=0;i<builder.count;i++) {
+    free(builder.records[i].key);
+    free(builder.records[i].value.data);
+  }
+  free(builder.records);
+  free(displacements);
+  free(slots);
+  close(lock_fd);
+  return result;
+}
+
+/** READING **/
+
+static int map_snapshot(const char **data, size_t *size, struct stat *stat_buf) {
+  int fd = open(RS_AUTH_SNAPSHOT_PATH, O_RDONLY);
+  if(fd == -1) {
+    return -1;
+  }
+  if(fstat(fd, stat_buf) != 0) {
+    fprintf(stderr, "fstat() failed on snapshot: %s\n", strerror(errno));
+    close(fd);
+    return -1;
+  }
+  if(stat_buf->st_size < sizeof(struct snapshot_header)) {
+    fprintf(stderr, "Snapshot %s is truncated\n", RS_AUTH_SNAPSHOT_PATH);
+    close(fd);
+    return -1;
+  }
+  void *map = mmap(NULL, stat_buf->st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    fprintf(stderr, "mmap() failed on snapshot: %s\n", strerror(errno));
+    return -1;
+  }
+  struct snapshot_header *header = map;
+  if(memcmp(header->magic, SNAPSHOT_MAGIC, 8) != 0 ||
+     header->size != stat_buf->st_size ||
+     header->bucket_count == 0 || header->slot_count == 0 ||
+     sizeof(struct snapshot_header) +
+     ((uint64_t)header->bucket_count + header->slot_count) * sizeof(uint32_t) > header->size) {
+    fprintf(stderr, "Snapshot %s is invalid\n", RS_AUTH_SNAPSHOT_PATH);
+    munmap(map, stat_buf->st_size);
+    return -1;
+  }
+  *data = map;
+  *size = stat_buf->st_size;
+  return 0;
+}
+
+int open_authorization_snapshot() {
+  if(snapshot_data) return 0;
+  return map_snapshot(&snapshot_data, &snapshot_size, &snapshot_stat);
+}
+
+void close_authorization_snapshot() {
+  if(! snapshot_data) return;
+  munmap((void*)snapshot_data, snapshot_size);
+  snapshot_data = NULL;
+  snapshot_size = 0;
+}
+
+int reload_authorization_snapshot() {
+  struct stat stat_buf;
+  if(stat(RS_AUTH_SNAPSHOT_PATH, &stat_buf) != 0) {
+    // keep the current snapshot, if any.
+    return snapshot_data ? 0 : -1;
+  }
+  if(snapshot_data &&
+     stat_buf.st_ino == snapshot_stat.st_ino &&
+     stat_buf.st_dev == snapshot_stat.st_dev &&
+     stat_buf.st_mtime == snapshot_stat.st_mtime &&
+     stat_buf.st_size == snapshot_stat.st_size) {
+    return 0; // unchanged
+  }
+  const char *data;
+  size_t size;
+  if(map_snapshot(&data, &size, &stat_buf) != 0) {
+    return -1;
+  }
+  close_authorization_snapshot();
+  snapshot_data = data;
+  snapshot_size = size;
+  snapshot_stat = stat_buf;
+  return 1;
+}
+
+int lookup_snapshot_authorization(const char *username, const char *token,
+                                  struct rs_authorization **auth) {
+  if(! snapshot_data) {
+    return -1; // no snapshot mapped, use database.
+  }
+  *auth = NULL;
+  const struct snapshot_header *header = (const struct snapshot_header*)snapshot_data;
+  if(header->count == 0) {
+    return 0;
+  }
+  size_t username_len = strlen(username), token_len = strlen(token);
+  const char *displacements = snapshot_data + sizeof(struct snapshot_header);
+  const char *slots = displacements + header->bucket_count * sizeof(uint32_t);
+  uint32_t bucket = hash_auth_key(username, username_len, token, token_len, 0) % header->bucket_count;
+  uint32_t d = read_u32(displacements + bucket * sizeof(uint32_t));
+  uint32_t slot = hash_auth_key(username, username_len, token, token_len, d) % header->slot_count;
+  uint32_t offset = read_u32(slots + slot * sizeof(uint32_t));
+  if(offset == SLOT_EMPTY || (uint64_t)offset + 2 * sizeof(uint32_t) > snapshot_size) {
+    return 0;
+  }
+  uint32_t key_len = read_u32(snapshot_data + offset);
+  uint32_t value_len = read_u32(snapshot_data + offset + sizeof(uint32_t));
+  const char *key = snapshot_data + offset + 2 * sizeof(uint32_t);
+  if((uint64_t)offset + 2 * sizeof(uint32_t) + key_len + value_len > snapshot_size ||
+     key_len != username_len + 1 + token_len ||
+     memcmp(key, username, username_len) != 0 ||
+     key[username_len] != '|' ||
+     memcmp(key + username_len + 1, token, token_len) != 0) {
+    return 0;
+  }
+  DBT db_value;
+  memset(&db_value, 0, sizeof(DBT));
+  db_value.data = (void*)(key + key_len);
+  db_value.size = value_len;
+  *auth = malloc(sizeof(struct rs_authorization));
+  if(*auth == NULL) {
+    perror("Failed to allocate memory");
+    return 0;
+  }
+  unpack_authorization(*auth, &db_value);
+  return 0;
+}
@@ -0,0 +1,204 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "common/cache.h"
+
+struct cache_entry {
+  struct cache_entry *next;      // next entry in same bucket
+  struct cache_entry *lru_prev;  // more recently used
+  struct cache_entry *lru_next;  // less recently used
+  uint32_t hash;
+  void *value;
+  size_t size;
+  time_t expires;
+  char key[];
+};
+
+struct rs_cache {
+  struct cache_entry **buckets;
+  uint32_t bucket_mask;
+  struct cache_entry *lru_head;
+  struct cache_entry *lru_tail;
+  size_t max_entries;
+  size_t max_bytes;
+  cache_free_f free_value;
+  struct rs_cache_stats stats;
+};
+
+static uint32_t hash_key(const char *key) {
+  uint32_t h = 2166136261u;
+  for(; *key; key++) {
+    h ^= (unsigned char)*key;
+    h *= 16777619;
+  }
+  return h;
+}
+
+struct rs_cache *new_cache(size_t max_entries, size_t max_bytes, cache_free_f free_value) {
+  struct rs_cache *cache = malloc(sizeof(struct rs_cache));
+  if(cache == NULL) {
+    return NULL;
+  }
+  memset(cache, 0, sizeof(struct rs_cache));
+  uint32_t bucket_count = 16;
+  while(bucket_count < max_entries && bucket_count < (1 << 20)) {
+    bucket_count <<= 1;
+  }
+  cache->buckets = calloc(bucket_count, sizeof(struct cache_entry*));
+  if(cache->buckets == NULL) {
+    free(cache);
+    return NULL;
+  }
+  cache->bucket_mask = bucket_count - 1;
+  cache->max_entries = max_entries;
+  cache->max_bytes = max_bytes;
+  cache->free_value = free_value;
+  return cache;
+}
+
+static void lru_unlink(struct rs_cache *cache, struct cache_entry *entry) {
+  if(entry->lru_prev) {
+    entry->lru_prev->lru_next = entry->lru_next;
+  } else {
+    cache->lru_head = entry->lru_next;
+  }
+  if(entry->lru_next) {
+    entry->lru_next->lru_prev = entry->lru_prev;
+  } else {
+    cache->lru_tail = entry->lru_prev;
+  }
+  entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void lru_push(struct rs_cache *cache, struct cache_entry *entry) {
+  entry->lru_prev = NULL;
+  entry->lru_next = cache->lru_head;
+  if(cache->lru_head) {
+    cache->lru_head->lru_prev = entry;
+  } else {
+    cache->lru_tail = entry;
+  }
+  cache->lru_head = entry;
+}
+
+static struct cache_entry **find_entry(struct rs_cache *cache, const char *key, uint32_t hash) {
+  struct cache_entry **entryp;
+  for(entryp = &cache->buckets[hash & cache->bucket_mask];
+      *entryp != NULL;
+      entryp = &(*entryp)->next) {
+    if((*entryp)->hash == hash && strcmp((*entryp)->key, key) == 0) {
+      break;
+    }
+  }
+  return entryp;
+}
+
+// unlinks the entry pointed to by `entryp' and frees it.
+static void remove_entry(struct rs_cache *cache, struct cache_entry **entryp) {
+  struct cache_entry *entry = *entryp;
+  *entryp = entry->next;
+  lru_unlink(cache, entry);
+  cache->stats.entries--;
+  cache->stats.bytes -= entry->size;
+  if(cache->free_value) {
+    cache->free_value(entry->value);
+  }
+  free(entry);
+}
+
+void *cache_get(struct rs_cache *cache, const char *key) {
+  uint32_t hash = hash_key(key);
+  struct cache_entry **entryp = find_entry(cache, key, hash);
+  struct cache_entry *entry = *entryp;
+  if(entry == NULL) {
+    cache->stats.misses++;
+    return NULL;
+  }
+  if(entry->expires != 0 && entry->expires < time(NULL)) {
+    remove_entry(cache, entryp);
+    cache->stats.misses++;
+    return NULL;
+  }
+  if(cache->lru_head != entry) {
+    lru_unlink(cache, entry);
+    lru_push(cache, entry);
+  }
+  cache->stats.hits++;
+  return entry->value;
+}
+
+static void evict(struct rs_cache *cache) {
+  while(cache->lru_tail &&
+        ((cache->max_entries && cache->stats.entries > cache->max_entries) ||
+         (cache->max_bytes && cache->stats.bytes > cache->max_bytes))) {
+    struct cache_entry *victim = cache->lru_tail;
+    remove_entry(cache, find_entry(cache, victim->key, victim->hash));
+    cache->stats.evictions++;
+  }
+}
+
+int cache_set(struct rs_cache *cache, const char *key, void *value, size_t size, time_t expires) {
+  uint32_t hash = hash_key(key);
+  struct cache_entry **entryp = find_entry(cache, key, hash);
+  if(*entryp != NULL) {
+    remove_entry(cache, entryp);
+  }
+  size_t key_len = strlen(key);
+  struct cache_entry *entry = malloc(sizeof(struct cache_entry) + key_len + 1);
+  if(entry == NULL) {
+    if(cache->free_value) {
+      cache->free_value(value);
+    }
+    return -1;
+  }
+  memcpy(entry->key, key, key_len + 1);
+  entry->hash = hash;
+  entry->value = value;
+  entry->size = size + sizeof(struct cache_entry) + key_len + 1;
+  entry->expires = expires;
+  entry->next = cache->buckets[hash & cache->bucket_mask];
+  cache->buckets[hash & cache->bucket_mask] = entry;
+  lru_push(cache, entry);
+  cache->stats.entries++;
+  cache->stats.bytes += entry->size;
+  evict(cache);
+  return 0;
+}
+
+void cache_remove(struct rs_cache *cache, const char *key) {
+  struct cache_entry **entryp = find_entry(cache, key, hash_key(key));
+  if(*entryp != NULL) {
+    remove_entry(cache, entryp);
+  }
+}
+
+void cache_clear(struct rs_cache *cache) {
+  while(cache->lru_head) {
+    struct cache_entry *entry = cache->lru_head;
+    remove_entry(cache, find_entry(cache, entry->key, entry->hash));
+  }
+}
+
+void free_cache(struct rs_cache *cache) {
+  cache_clear(cache);
+  free(cache->buckets);
+  free(cache);
+}
+
+void cache_get_stats(struct rs_cache *cache, struct rs_cache_stats *stats) {
+  *stats = cache->stats;
+}
@@ -0,0 +1,92 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RS_COMMON_CACHE_H
+#define RS_COMMON_CACHE_H
+
+/**
+ * File: cache.h
+ *
+ * A string-keyed hash table with LRU eviction, optional expiry times and
+ * a limit on the number of entries and / or the accumulated size of the
+ * cached values.
+ *
+ * Caches are not threadsafe, each event loop is expected to own it's caches.
+ */
+
+struct rs_cache;
+
+typedef void (*cache_free_f)(void *value);
+
+struct rs_cache_stats {
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  size_t entries;
+  size_t bytes;
+};
+
+/**
+ * new_cache()
+ *
+ * Creates a new cache holding at most `max_entries' values, with a combined
+ * size of at most `max_bytes' (zero means unlimited). `free_value' is called
+ * for every value that is removed from the cache (may be NULL).
+ *
+ * Returns NULL if memory allocation fails.
+ */
+struct rs_cache *new_cache(size_t max_entries, size_t max_bytes, cache_free_f free_value);
+
+/**
+ * free_cache()
+ *
+ * Removes all entries and frees the cache itself.
+ */
+void free_cache(struct rs_cache *cache);
+
+/**
+ * cache_get()
+ *
+ * Returns the value stored under `key' and marks it as recently used.
+ * Returns NULL if there is no such value, or it has expired.
+ */
+void *cache_get(struct rs_cache *cache, const char *key);
+
+/**
+ * cache_set()
+ *
+ * Stores `value' under `key', replacing (and freeing) any previous value.
+ * `size' is the number of bytes accounted for the value, `expires' is the
+ * time after which the entry is no longer returned (zero means never).
+ *
+ * Returns zero on success. If memory allocation fails, frees the value and
+ * returns -1.
+ */
+int cache_set(struct rs_cache *cache, const char *key, void *value, size_t size, time_t expires);
+
+/**
+ * cache_remove()
+ *
+ * Removes (and frees) the value stored under `key', if any.
+ */
+void cache_remove(struct rs_cache *cache, const char *key);
+
+/**
+ * cache_clear()
+ *
+ * Removes (and frees) all values.
+ */
+void cache_clear(struct rs_cache *cache);
+
+void cache_get_stats(struct rs_cache *cache, struct rs_cache_stats *stats);
+
+#endif /* !RS_COMMON_CACHE_H */
@@ -0,0 +1,249 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <event2/buffer.h>
+
+#include "common/compress.h"
+
+// (output space reserved per round)
+#define COMPRESS_CHUNK_SIZE 16384
+
+#define SKIP_WS(p) while(*(p) == ' ' || *(p) == '\t') (p)++
+
+// parses the quality value of an Accept-Encoding element, i.e. ";q=0.5".
+// Returns it multiplied by 1000.
+static int parse_qvalue(const char *p, const char *end) {
+  int q = 1000;
+  while(p < end) {
+    SKIP_WS(p);
+    if(*p == ';') {
+      p++;
+      SKIP_WS(p);
+      if((*p == 'q' || *p == 'Q') && p[1] == '=') {
+        p += 2;
+        q = (*p == '1') ? 1000 : 0;
+        if(*p == '0' || *p == '1') {
+          p++;
+          if(*p == '.') {
+            int i, scale = 100;
+            for(i = 1; i <= 3 && p[i] >= '0' && p[i] <= '9'; i++, scale /= 10) {
+              if(q < 1000) q += (p[i] - '0') * scale;
+            }
+          }
+        }
+        return q;
+      }
+    }
+    while(p < end && *p != ';') p++;
+  }
+  return q;
+}
+
+enum rs_encoding negotiate_encoding(const char *accept_encoding) {
+  int gzip_q = -1, br_q = -1, any_q = -1;
+  const char *p = accept_encoding;
+  if(p == NULL) {
+    return RS_ENCODING_IDENTITY;
+  }
+  while(*p) {
+    SKIP_WS(p);
+    const char *end = p + strcspn(p, ",");
+    size_t len = strcspn(p, ",; \t");
+    int q = parse_qvalue(p + len, end);
+    if((len == 4 && strncasecmp(p, "gzip", 4) == 0) ||
+       (len == 6 && strncasecmp(p, "x-gzip", 6) == 0)) {
+      gzip_q = q;
+    } else if(len == 2 && strncasecmp(p, "br", 2) == 0) {
+      br_q = q;
+    } else if(len == 1 && *p == '*') {
+      any_q = q;
+    }
+    p = *end ? end + 1 : end;
+  }
+  if(gzip_q == -1) gzip_q = any_q;
+  if(br_q == -1) br_q = any_q;
+#ifdef RS_BROTLI
+  if(br_q > 0 && br_q >= gzip_q) {
+    return RS_ENCODING_BROTLI;
+  }
+#endif
+  if(gzip_q > 0) {
+    return RS_ENCODING_GZIP;
+  }
+  return RS_ENCODING_IDENTITY;
+}
+
+const char *encoding_name(enum rs_encoding encoding) {
+  switch(encoding) {
+  case RS_ENCODING_GZIP: return "gzip";
+  case RS_ENCODING_BROTLI: return "br";
+  default: return "identity";
+  }
+}
+
+static const char *compressible_types[] = {
+  "text/",
+  "application/json",
+  "application/ld+json",
+  "application/javascript",
+  "application/xml",
+  "image/svg+xml",
+  NULL
+};
+
+int compressible_type(const char *content_type) {
+  const char **type;
+  if(content_type == NULL) {
+    return 0;
+  }
+  for(type = compressible_types; *type; type++) {
+    if(strncasecmp(content_type, *type, strlen(*type)) == 0) {
+      return 1;
+    }
+  }
+  // structured syntax suffixes (application/activity+json, ...)
+  size_t len = strcspn(content_type, ";");
+  return ((len > 5 && strncasecmp(content_type + len - 5, "+json", 5) == 0) ||
+          (len > 4 && strncasecmp(content_type + len - 4, "+xml", 4) == 0));
+}
+
+// (on failure, the compressor is left as if freed already)
+int compressor_init(struct rs_compressor *compressor, enum rs_encoding encoding, int level) {
+  memset(compressor, 0, sizeof(struct rs_compressor));
+  switch(encoding) {
+  case RS_ENCODING_GZIP:
+    // (windowBits + 16 selects the gzip wrapper)
+    if(deflateInit2(&compressor->zs, level, Z_DEFLATED, 15 + 16, 8,
+                    Z_DEFAULT_STRATEGY) != Z_OK) {
+      return -1;
+    }
+    break;
+#ifdef RS_BROTLI
+  case RS_ENCODING_BROTLI:
+    compressor->br = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+    if(compressor->br == NULL) {
+      return -1;
+    }
+    BrotliEncoderSetParameter(compressor->br, BROTLI_PARAM_QUALITY, level);
+    break;
+#endif
+  default:
+    return -1;
+  }
+  compressor->encoding = encoding;
+  return 0;
+}
+
+static int deflate_write(struct rs_compressor *compressor, const void *data, size_t len,
+                         struct evbuffer *out, enum rs_compress_flush flush) {
+  z_stream *zs = &compressor->zs;
+  int mode = (flush == RS_COMPRESS_FINISH ? Z_FINISH :
+              flush == RS_COMPRESS_SYNC ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+  struct evbuffer_iovec vec;
+  int result;
+  zs->next_in = (Bytef*)data;
+  zs->avail_in = len;
+  do {
+    if(evbuffer_reserve_space(out, COMPRESS_CHUNK_SIZE, &vec, 1) < 1) {
+      return -1;
+    }
+    zs->next_out = vec.iov_base;
+    zs->avail_out = vec.iov_len;
+    result = deflate(zs, mode);
+    if(result == Z_STREAM_ERROR) {
+      return -1;
+    }
+    vec.iov_len -= zs->avail_out;
+    evbuffer_commit_space(out, &vec, 1);
+    // (deflate() is done once it leaves output space unused)
+  } while(zs->avail_out == 0 || zs->avail_in > 0);
+  return 0;
+}
+
+#ifdef RS_BROTLI
+static int brotli_write(struct rs_compressor *compressor, const void *data, size_t len,
+                        struct evbuffer *out, enum rs_compress_flush flush) {
+  BrotliEncoderOperation op = (flush == RS_COMPRESS_FINISH ? BROTLI_OPERATION_FINISH :
+                               flush == RS_COMPRESS_SYNC ? BROTLI_OPERATION_FLUSH :
+                               BROTLI_OPERATION_PROCESS);
+  const uint8_t *next_in = data;
+  size_t avail_in = len;
+  struct evbuffer_iovec vec;
+  do {
+    if(evbuffer_reserve_space(out, COMPRESS_CHUNK_SIZE, &vec, 1) < 1) {
+      return -1;
+    }
+    uint8_t *next_out = vec.iov_base;
+    size_t avail_out = vec.iov_len;
+    if(! BrotliEncoderCompressStream(compressor->br, op, &avail_in, &next_in,
+                                     &avail_out, &next_out, NULL)) {
+      return -1;
+    }
+    vec.iov_len -= avail_out;
+    evbuffer_commit_space(out, &vec, 1);
+  } while(avail_in > 0 || BrotliEncoderHasMoreOutput(compressor->br));
+  return 0;
+}
+#endif
+
+int compressor_write(struct rs_compressor *compressor, const void *data, size_t len,
+                     struct evbuffer *out, enum rs_compress_flush flush) {
+  switch(compressor->encoding) {
+  case RS_ENCODING_GZIP:
+    return deflate_write(compressor, data, len, out, flush);
+#ifdef RS_BROTLI
+  case RS_ENCODING_BROTLI:
+    return brotli_write(compressor, data, len, out, flush);
+#endif
+  default:
+    return -1;
+  }
+}
+
+int compressor_write_buffer(struct rs_compressor *compressor, struct evbuffer *in,
+                            struct evbuffer *out, enum rs_compress_flush flush) {
+  int n = evbuffer_peek(in, -1, NULL, NULL, 0), i;
+  if(n == 0) {
+    return compressor_write(compressor, NULL, 0, out, flush);
+  }
+  struct evbuffer_iovec vec[n];
+  evbuffer_peek(in, -1, NULL, vec, n);
+  for(i = 0; i < n; i++) {
+    if(compressor_write(compressor, vec[i].iov_base, vec[i].iov_len, out,
+                        i == n - 1 ? flush : RS_COMPRESS_NO_FLUSH) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void compressor_free(struct rs_compressor *compressor) {
+  switch(compressor->encoding) {
+  case RS_ENCODING_GZIP:
+    deflateEnd(&compressor->zs);
+    break;
+#ifdef RS_BROTLI
+  case RS_ENCODING_BROTLI:
+    BrotliEncoderDestroyInstance(compressor->br);
+    break;
+#endif
+  default:
+    break;
+  }
+  compressor->encoding = RS_ENCODING_IDENTITY;
+}
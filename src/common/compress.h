@@ -0,0 +1,104 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RS_COMMON_COMPRESS_H
+#define RS_COMMON_COMPRESS_H
+
+/**
+ * File: compress.h
+ *
+ * Content-coding of response bodies: negotiation (Accept-Encoding) and
+ * streaming compression into evbuffers. gzip is always available, brotli
+ * only if built with RS_BROTLI (`make BROTLI=1').
+ */
+
+struct evbuffer;
+
+#include <zlib.h>
+#ifdef RS_BROTLI
+#include <brotli/encode.h>
+#endif
+
+enum rs_encoding {
+  RS_ENCODING_IDENTITY,
+  RS_ENCODING_GZIP,
+  RS_ENCODING_BROTLI
+};
+
+/**
+ * negotiate_encoding()
+ *
+ * Picks the best content-coding acceptable according to the given
+ * "Accept-Encoding" header value (which may be NULL). Brotli is preferred
+ * over gzip if both are equally acceptable.
+ */
+enum rs_encoding negotiate_encoding(const char *accept_encoding);
+
+// name of the content-coding, as used in "Content-Encoding" headers
+const char *encoding_name(enum rs_encoding encoding);
+
+/**
+ * compressible_type()
+ *
+ * Returns non-zero if documents of the given content type are worth
+ * compressing (text, JSON, XML, JavaScript, ...).
+ */
+int compressible_type(const char *content_type);
+
+struct rs_compressor {
+  enum rs_encoding encoding;
+  z_stream zs;
+#ifdef RS_BROTLI
+  BrotliEncoderState *br;
+#endif
+};
+
+enum rs_compress_flush {
+  RS_COMPRESS_NO_FLUSH,
+  // write out everything compressed so far (i.e. at the end of a chunk)
+  RS_COMPRESS_SYNC,
+  // end the stream
+  RS_COMPRESS_FINISH
+};
+
+/**
+ * compressor_init()
+ *
+ * Prepares a compressor for the given encoding (not RS_ENCODING_IDENTITY).
+ * `level' ranges from 1 (fastest) to 9 (smallest).
+ *
+ * Returns zero on success, -1 on failure.
+ */
+int compressor_init(struct rs_compressor *compressor, enum rs_encoding encoding, int level);
+
+/**
+ * compressor_write()
+ *
+ * Compresses `len' bytes of `data' into `out'.
+ *
+ * Returns zero on success, -1 on failure.
+ */
+int compressor_write(struct rs_compressor *compressor, const void *data, size_t len,
+                     struct evbuffer *out, enum rs_compress_flush flush);
+
+/**
+ * compressor_write_buffer()
+ *
+ * Compresses the contents of `in' into `out'. `in' is left untouched, so it
+ * may be shared (e.g. cached).
+ */
+int compressor_write_buffer(struct rs_compressor *compressor, struct evbuffer *in,
+                            struct evbuffer *out, enum rs_compress_flush flush);
+
+void compressor_free(struct rs_compressor *compressor);
+
+#endif /* !RS_COMMON_COMPRESS_H */
@@ -12,16 +12,13 @@
 
 #include "rs-serve.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 // this is by no means a complete json implementation.
 // but it works for all our needs.
 
-struct json {
-  json_write_f write;
-  void *arg;
-  char ss[JSON_MAX_DEPTH]; // stack start
-  char *sp; // stack pointer
-};
-
 #define JSON_PUSH_NESTING(json) do {                                    \
     if((json->sp - json->ss) + 1 >= JSON_MAX_DEPTH) {                   \
       log_error("BUG: JSON_MAX_DEPTH exceeded!");                       \
@@ -34,82 +31,138 @@ struct json {
 #define JSON_NESTING_BEGINS(json) (*json->sp == 0)
 #define JSON_BEGIN_NESTING(json) do { *json->sp = 1; } while(0);
 
-static char *json_make_string(const char *string, int *len) {
-  int max_len = strlen(string) * 2, i = 0;
-  char *escaped = malloc(max_len + 3);
-  if(escaped == NULL) {
-    perror("malloc() failed");
-    return NULL;
+// quotation mark, reverse solidus and control characters must be escaped
+// (RFC 7159, section 7)
+#define NEEDS_ESCAPE(c) ((c) == '"' || (c) == '\\' || (unsigned char)(c) < 0x20)
+
+// returns the number of characters at the start of `string' that can be
+// copied as they are.
+static size_t plain_prefix_len(const char *string, size_t len) {
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control_max = _mm_set1_epi8(0x1f);
+  for(; i + 16 <= len; i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i*)(string + i));
+    __m128i special = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+      // (unsigned) chunk <= 0x1f
+      _mm_cmpeq_epi8(_mm_min_epu8(chunk, control_max), chunk));
+    int mask = _mm_movemask_epi8(special);
+    if(mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
   }
-  const char *str_p;
-  escaped[i++] = '"';
-  for(str_p = string; *str_p != 0; str_p++) {
-    if(*str_p == '"' || *str_p == '\\') {
-      escaped[i++] = '\\';
+#endif
+  for(; i < len && ! NEEDS_ESCAPE(string[i]); i++);
+  return i;
+}
+
+// escapes `string' into `out', which must have room for 6 bytes per input
+// character. Returns the number of bytes written.
+static size_t escape_string(char *out, const char *string, size_t len) {
+  static const char hex[] = "0123456789abcdef";
+  char *p = out;
+  size_t i = 0;
+  while(i < len) {
+    size_t plain = plain_prefix_len(string + i, len - i);
+    memcpy(p, string + i, plain);
+    p += plain;
+    i += plain;
+    if(i == len) {
+      break;
+    }
+    unsigned char c = string[i++];
+    *p++ = '\\';
+    switch(c) {
+    case '"': *p++ = '"'; break;
+    case '\\': *p++ = '\\'; break;
+    case '\b': *p++ = 'b'; break;
+    case '\f': *p++ = 'f'; break;
+    case '\n': *p++ = 'n'; break;
+    case '\r': *p++ = 'r'; break;
+    case '\t': *p++ = 't'; break;
+    default:
+      *p++ = 'u';
+      *p++ = '0';
+      *p++ = '0';
+      *p++ = hex[c >> 4];
+      *p++ = hex[c & 0xf];
     }
-    escaped[i++] = *str_p;
   }
-  escaped[i++] = '"';
-  escaped[i++] = 0;
-  escaped = realloc(escaped, i);
-  *len = i - 1;
-  return escaped;
+  return p - out;
 }
 
-struct json *new_json(json_write_f writer, void *arg) {
-  struct json *json = malloc(sizeof(struct json));
-  if(json == NULL) {
-    return NULL;
+// writes `string' as a quoted JSON string, optionally preceded by `prefix'
+// and followed by `suffix' (zero for none), using a single reservation.
+static void write_string(struct json *json, char prefix, const char *string, char suffix) {
+  size_t len = strlen(string);
+  struct evbuffer_iovec iov;
+  if(evbuffer_reserve_space(json->buf, len * 6 + 4, &iov, 1) < 1) {
+    log_error("evbuffer_reserve_space() failed");
+    return;
   }
-  json->write = writer;
-  json->arg = arg;
-  json->sp = json->ss;
-  return json;
+  char *p = iov.iov_base;
+  if(prefix) {
+    *p++ = prefix;
+  }
+  *p++ = '"';
+  p += escape_string(p, string, len);
+  *p++ = '"';
+  if(suffix) {
+    *p++ = suffix;
+  }
+  iov.iov_len = p - (char*)iov.iov_base;
+  evbuffer_commit_space(json->buf, &iov, 1);
 }
 
-void free_json(struct json *json) {
-  free(json);
+void json_init(struct json *json, struct evbuffer *buf) {
+  json->buf = buf;
+  json->sp = json->ss;
+  *json->sp = 0;
 }
 
 void json_start_array(struct json *json) {
-  json->write("[", 1, json->arg);
+  evbuffer_add(json->buf, "[", 1);
   JSON_PUSH_NESTING(json);
-  *json->sp=0;
 }
 
 void json_end_array(struct json *json) {
-  json->write("]", 1, json->arg);
+  evbuffer_add(json->buf, "]", 1);
   JSON_POP_NESTING(json);
 }
 
 void json_start_object(struct json *json) {
-  json->write("{", 1, json->arg);
+  evbuffer_add(json->buf, "{", 1);
   JSON_PUSH_NESTING(json);
 }
 
 void json_end_object(struct json *json) {
-  json->write("}", 1, json->arg);
+  evbuffer_add(json->buf, "}", 1);
   JSON_POP_NESTING(json);
 }
 
 void json_write_string(struct json *json, const char *string) {
-  int len;
-  char *token = json_make_string(string, &len);
-  json->write(token, len, json->arg);
-  free(token);
+  write_string(json, 0, string, 0);
 }
 
 void json_write_key(struct json *json, const char *key) {
+  char prefix = 0;
   if(JSON_NESTING_BEGUN(json)) {
-    json->write(",", 1, json->arg);
+    prefix = ',';
   } else if(JSON_NESTING_BEGINS(json)) {
     JSON_BEGIN_NESTING(json);
   }
-  json_write_string(json, key);
-  json->write(":", 1, json->arg);
+  write_string(json, prefix, key, ':');
 }
 
 void json_write_key_val(struct json *json, const char *key, const char *val) {
   json_write_key(json, key);
   json_write_string(json, val);
 }
+
+void json_write_key_int(struct json *json, const char *key, long long val) {
+  json_write_key(json, key);
+  evbuffer_add_printf(json->buf, "%lld", val);
+}
@@ -16,11 +16,22 @@
 // this should suffice for webfinger.
 #define JSON_MAX_DEPTH 5
 
-struct json;
-typedef size_t (*json_write_f)(char *buf, size_t count, void *arg);
+struct evbuffer;
 
-struct json *new_json(json_write_f writer, void *arg);
-void free_json(struct json *json);
+/**
+ * struct json
+ *
+ * Writes JSON directly into an evbuffer: strings are escaped straight into
+ * space reserved in the buffer, without intermediate copies. Usually lives
+ * on the stack (see json_init()).
+ */
+struct json {
+  struct evbuffer *buf;
+  char ss[JSON_MAX_DEPTH]; // stack start
+  char *sp; // stack pointer
+};
+
+void json_init(struct json *json, struct evbuffer *buf);
 void json_start_object(struct json *json);
 void json_end_object(struct json *json);
 void json_start_array(struct json *json);
@@ -28,6 +39,6 @@ void json_end_array(struct json *json);
 void json_write_string(struct json *json, const char *string);
 void json_write_key(struct json *json, const char *key);
 void json_write_key_val(struct json *json, const char *key, const char *val);
+void json_write_key_int(struct json *json, const char *key, long long val);
 
 #endif
-
@@ -12,54 +12,276 @@
 
 #include "rs-serve.h"
 
-static char *time_now() {
-  static char timestamp[100]; // FIXME: not threadsafe!
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+/*
+ * Logging
+ * -------
+ *
+ * Log lines are formatted by the calling thread into it's own ring buffer
+ * (single producer, single consumer, no locks). A background writer thread
+ * drains all rings in batches using writev(), so logging doesn't cost a
+ * write() on the request path.
+ *
+ * When a ring is full, the message is dropped and counted. The writer reports
+ * the number of dropped messages once it catches up.
+ *
+ * Until start_log_writer() is called (and after stop_log_writer()), lines are
+ * written synchronously instead. The writer must be started after fork()ing,
+ * since threads don't survive it.
+ */
+
+struct log_ring {
+  // total number of bytes written / consumed. Only the producer writes
+  // `head', only the writer thread writes `tail'.
+  uint64_t head;
+  uint64_t tail;
+  struct log_ring *next;
+  char buf[RS_LOG_RING_SIZE];
+};
+
+static struct log_ring *rings = NULL;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct log_ring *thread_ring = NULL;
+
+static pthread_t writer_thread;
+static int writer_running = 0;
+static int writer_stop = 0;
+static unsigned long dropped = 0;
+
+static pid_t log_pid = 0;
+
+// timestamp, formatted at most once per second (per thread)
+static __thread time_t timestamp_time = 0;
+static __thread char timestamp[64];
+
+static const char *time_now() {
   time_t t = time(NULL);
-  struct tm *tmp = localtime(&t);
-  strftime(timestamp, 99, "%F %T %z", tmp);
+  if(t != timestamp_time) {
+    struct tm tm;
+    localtime_r(&t, &tm);
+    strftime(timestamp, sizeof(timestamp), "%F %T %z", &tm);
+    timestamp_time = t;
+  }
   return timestamp;
 }
 
+static struct log_ring *get_thread_ring() {
+  if(thread_ring == NULL) {
+    struct log_ring *ring = malloc(sizeof(struct log_ring));
+    if(ring == NULL) {
+      return NULL;
+    }
+    ring->head = ring->tail = 0;
+    pthread_mutex_lock(&rings_mutex);
+    ring->next = rings;
+    __atomic_store_n(&rings, ring, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&rings_mutex);
+    thread_ring = ring;
+  }
+  return thread_ring;
+}
+
+static void enqueue(const char *line, size_t len) {
+  struct log_ring *ring = get_thread_ring();
+  if(ring == NULL) {
+    __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  uint64_t head = ring->head;
+  uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  if(RS_LOG_RING_SIZE - (head - tail) < len) {
+    __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  size_t offset = head % RS_LOG_RING_SIZE;
+  size_t first = RS_LOG_RING_SIZE - offset;
+  if(first >= len) {
+    memcpy(ring->buf + offset, line, len);
+  } else {
+    memcpy(ring->buf + offset, line, first);
+    memcpy(ring->buf, line + first, len - first);
+  }
+  __atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+}
+
+static void write_line(const char *line, size_t len) {
+  if(__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
+    enqueue(line, len);
+  } else {
+    fwrite(line, 1, len, RS_LOG_FILE);
+    fflush(RS_LOG_FILE);
+  }
+}
+
+static void vlog(const char *level, const char *file, int line, const char *format, va_list ap) {
+  char buf[RS_LOG_LINE_MAX];
+  int len;
+  pid_t pid = log_pid ? log_pid : getpid();
+  if(file) {
+    len = snprintf(buf, sizeof(buf), "[%d] [%s] [%s] %s:%d: ", pid, time_now(), level, file, line);
+  } else {
+    len = snprintf(buf, sizeof(buf), "[%d] [%s] [%s] ", pid, time_now(), level);
+  }
+  if(len < sizeof(buf) - 1) {
+    int message_len = vsnprintf(buf + len, sizeof(buf) - len, format, ap);
+    if(message_len > 0) {
+      len += message_len;
+    }
+  }
+  if(len > sizeof(buf) - 2) {
+    // truncated
+    len = sizeof(buf) - 2;
+  }
+  buf[len++] = '\n';
+  write_line(buf, len);
+}
+
+// writes out everything that is currently in the rings.
+// Returns the number of bytes written.
+static size_t drain_rings(int fd) {
+  struct iovec iov[RS_LOG_MAX_IOV];
+  struct log_ring *batch[RS_LOG_MAX_IOV];
+  uint64_t batch_head[RS_LOG_MAX_IOV];
+  int iovcnt = 0, ringcnt = 0, i;
+  size_t total = 0;
+  struct log_ring *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+  for(; ring != NULL; ring = ring->next) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->tail;
+    if(head == tail) {
+      continue;
+    }
+    if(iovcnt + 2 > RS_LOG_MAX_IOV) {
+      break; // rest is picked up next round
+    }
+    size_t offset = tail % RS_LOG_RING_SIZE;
+    size_t len = head - tail;
+    size_t first = RS_LOG_RING_SIZE - offset;
+    iov[iovcnt].iov_base = ring->buf + offset;
+    iov[iovcnt].iov_len = len < first ? len : first;
+    iovcnt++;
+    if(len > first) {
+      iov[iovcnt].iov_base = ring->buf;
+      iov[iovcnt].iov_len = len - first;
+      iovcnt++;
+    }
+    batch[ringcnt] = ring;
+    batch_head[ringcnt] = head;
+    ringcnt++;
+    total += len;
+  }
+  if(total == 0) {
+    return 0;
+  }
+  // writev() may write less than requested. Retry with what's left, rather
+  // than interleaving partial lines with the next batch.
+  struct iovec *iovp = iov;
+  size_t remaining = total;
+  while(remaining > 0) {
+    ssize_t written = writev(fd, iovp, iovcnt);
+    if(written < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      break; // nowhere to report to, discard.
+    }
+    remaining -= written;
+    while(iovcnt > 0 && written >= iovp->iov_len) {
+      written -= iovp->iov_len;
+      iovp++;
+      iovcnt--;
+    }
+    if(iovcnt > 0) {
+      iovp->iov_base = (char*)iovp->iov_base + written;
+      iovp->iov_len -= written;
+    }
+  }
+  for(i = 0; i < ringcnt; i++) {
+    __atomic_store_n(&batch[i]->tail, batch_head[i], __ATOMIC_RELEASE);
+  }
+  return total;
+}
+
+static void *log_writer(void *arg) {
+  int fd = fileno(RS_LOG_FILE);
+  unsigned long reported = 0;
+  struct timespec interval = { 0, RS_LOG_FLUSH_INTERVAL * 1000000L };
+  for(;;) {
+    int stop = __atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE);
+    size_t written = drain_rings(fd);
+    unsigned long now_dropped = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    if(now_dropped != reported) {
+      char buf[128];
+      int len = snprintf(buf, sizeof(buf), "[%d] [%s] [WARN] %lu log messages dropped (ring buffer full)\n",
+                         log_pid, time_now(), now_dropped - reported);
+      if(write(fd, buf, len) < 0) {
+        // ignore
+      }
+      reported = now_dropped;
+    }
+    if(written == 0) {
+      if(stop) {
+        break;
+      }
+      nanosleep(&interval, NULL);
+    }
+  }
+  return NULL;
+}
+
+void start_log_writer() {
+  log_pid = getpid();
+  fflush(RS_LOG_FILE);
+  // writer_running must be set before the thread starts, otherwise messages
+  // logged in between would bypass the ring and race with the writer.
+  __atomic_store_n(&writer_stop, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&writer_running, 1, __ATOMIC_RELEASE);
+  int result = pthread_create(&writer_thread, NULL, log_writer, NULL);
+  if(result != 0) {
+    __atomic_store_n(&writer_running, 0, __ATOMIC_RELEASE);
+    log_error("Failed to start log writer thread: %s", strerror(result));
+    return;
+  }
+  atexit(stop_log_writer);
+}
+
+void stop_log_writer() {
+  if(! __atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
+    return;
+  }
+  __atomic_store_n(&writer_stop, 1, __ATOMIC_RELEASE);
+  pthread_join(writer_thread, NULL);
+  __atomic_store_n(&writer_running, 0, __ATOMIC_RELEASE);
+  // pick up anything logged while the writer was shutting down
+  drain_rings(fileno(RS_LOG_FILE));
+}
+
+unsigned long log_dropped_count() {
+  return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
 void log_warn(char *format, ...) {
   va_list ap;
   va_start(ap, format);
-  char *timestamp = time_now();
-  char new_format[strlen(timestamp) +
-                  strlen(format) +
-                  6 + // some space for PID
-                  + 14];
-  sprintf(new_format, "[%d] [%s] [WARN] %s\n", getpid(), timestamp, format);
-  vfprintf(RS_LOG_FILE, new_format, ap);
+  vlog("WARN", NULL, 0, format, ap);
   va_end(ap);
-  fflush(RS_LOG_FILE);
 }
 
 void log_info(char *format, ...) {
   va_list ap;
   va_start(ap, format);
-  char *timestamp = time_now();
-  char new_format[strlen(timestamp) +
-                  strlen(format) +
-                  6 + // some space for PID
-                  + 14];
-  sprintf(new_format, "[%d] [%s] [INFO] %s\n", getpid(), timestamp, format);
-  vfprintf(RS_LOG_FILE, new_format, ap);
+  vlog("INFO", NULL, 0, format, ap);
   va_end(ap);
-  fflush(RS_LOG_FILE);
 }
 
 void log_error(char *format, ...) {
   va_list ap;
   va_start(ap, format);
-  char *timestamp = time_now();
-  char new_format[strlen(timestamp) +
-                  strlen(format) +
-                  6 + // some space for PID
-                  + 15];
-  sprintf(new_format, "[%d] [%s] [ERROR] %s\n", getpid(), timestamp, format);
-  vfprintf(RS_LOG_FILE, new_format, ap);
+  vlog("ERROR", NULL, 0, format, ap);
   va_end(ap);
-  fflush(RS_LOG_FILE);
 }
 
 void dont_log_debug(const char *file, int line, char *format, ...) {};
@@ -67,15 +289,6 @@ void dont_log_debug(const char *file, int line, char *format, ...) {};
 void do_log_debug(const char *file, int line, char *format, ...) {
   va_list ap;
   va_start(ap, format);
-  char *timestamp = time_now();
-  char new_format[strlen(timestamp) +
-                  strlen(format) +
-                  strlen(file) +
-                  5 + // (reasonable length for 'line')
-                  6 + // space for PID
-                  + 23];
-  sprintf(new_format, "[%d] [%s] [DEBUG] %s:%d: %s\n", getpid(), timestamp, file, line, format);
-  vfprintf(RS_LOG_FILE, new_format, ap);
+  vlog("DEBUG", file, line, format, ap);
   va_end(ap);
-  fflush(RS_LOG_FILE);
 }
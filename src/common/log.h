@@ -21,4 +21,10 @@ void dont_log_debug(const char *file, int line, char *format, ...);
 extern void (*current_log_debug)(const char *file, int line, char *format, ...);
 #define log_debug(...) current_log_debug(__FILE__, __LINE__, __VA_ARGS__)
 
+// start / stop the background thread writing log lines (see log.c)
+void start_log_writer();
+void stop_log_writer();
+// number of log lines dropped, because the ring buffer was full
+unsigned long log_dropped_count();
+
 #endif /* !RS_COMMON_LOG_H */
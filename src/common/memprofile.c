@@ -0,0 +1,181 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rs-serve.h"
+
+#ifdef RS_MEMPROFILE
+
+#include <malloc.h>
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+// totals, over all threads
+static struct rs_alloc_stats total;
+static size_t peak_bytes = 0;
+// totals of all requests
+static struct rs_alloc_stats request_total;
+static struct rs_alloc_stats phase_total[RS_PHASE_COUNT];
+static unsigned long profiled_requests = 0;
+
+static __thread struct rs_request *current_request = NULL;
+
+#define STAT_ADD(field, n) __atomic_add_fetch(&(field), (n), __ATOMIC_RELAXED)
+
+static void count_alloc(size_t size) {
+  STAT_ADD(total.allocs, 1);
+  size_t allocated = STAT_ADD(total.bytes_allocated, size);
+  size_t live = allocated - __atomic_load_n(&total.bytes_freed, __ATOMIC_RELAXED);
+  // (racy, but good enough for a peak)
+  if(live > __atomic_load_n(&peak_bytes, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&peak_bytes, live, __ATOMIC_RELAXED);
+  }
+  struct rs_request *ctx = current_request;
+  if(ctx) {
+    ctx->mem.allocs++;
+    ctx->mem.bytes_allocated += size;
+    unsigned int phases = ctx->running_phases;
+    int i;
+    for(i = 0; phases; i++, phases >>= 1) {
+      if(phases & 1) {
+        ctx->phase_mem[i].allocs++;
+        ctx->phase_mem[i].bytes_allocated += size;
+      }
+    }
+  }
+}
+
+static void count_free(size_t size) {
+  STAT_ADD(total.frees, 1);
+  STAT_ADD(total.bytes_freed, size);
+  struct rs_request *ctx = current_request;
+  if(ctx) {
+    ctx->mem.frees++;
+    ctx->mem.bytes_freed += size;
+    unsigned int phases = ctx->running_phases;
+    int i;
+    for(i = 0; phases; i++, phases >>= 1) {
+      if(phases & 1) {
+        ctx->phase_mem[i].frees++;
+        ctx->phase_mem[i].bytes_freed += size;
+      }
+    }
+  }
+}
+
+void *__wrap_malloc(size_t size) {
+  void *ptr = __real_malloc(size);
+  if(ptr) {
+    count_alloc(malloc_usable_size(ptr));
+  }
+  return ptr;
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+  void *ptr = __real_calloc(nmemb, size);
+  if(ptr) {
+    count_alloc(malloc_usable_size(ptr));
+  }
+  return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  size_t old_size = ptr ? malloc_usable_size(ptr) : 0;
+  void *new_ptr = __real_realloc(ptr, size);
+  if(new_ptr) {
+    if(ptr) {
+      count_free(old_size);
+    }
+    count_alloc(malloc_usable_size(new_ptr));
+  } else if(ptr && size == 0) {
+    count_free(old_size);
+  }
+  return new_ptr;
+}
+
+void __wrap_free(void *ptr) {
+  if(ptr) {
+    count_free(malloc_usable_size(ptr));
+  }
+  __real_free(ptr);
+}
+
+// strdup() and strndup() allocate inside libc, so they are replaced entirely.
+char *__wrap_strdup(const char *s) {
+  size_t len = strlen(s) + 1;
+  char *copy = __wrap_malloc(len);
+  if(copy) {
+    memcpy(copy, s, len);
+  }
+  return copy;
+}
+
+char *__wrap_strndup(const char *s, size_t n) {
+  size_t len = strnlen(s, n);
+  char *copy = __wrap_malloc(len + 1);
+  if(copy) {
+    memcpy(copy, s, len);
+    copy[len] = 0;
+  }
+  return copy;
+}
+
+static void add_stats(struct rs_alloc_stats *dest, struct rs_alloc_stats *src) {
+  dest->allocs += src->allocs;
+  dest->frees += src->frees;
+  dest->bytes_allocated += src->bytes_allocated;
+  dest->bytes_freed += src->bytes_freed;
+}
+
+void memprofile_begin(struct rs_request *ctx) {
+  current_request = ctx;
+}
+
+void memprofile_end(struct rs_request *ctx) {
+  current_request = NULL;
+  add_stats(&request_total, &ctx->mem);
+  int i;
+  for(i = 0; i < RS_PHASE_COUNT; i++) {
+    add_stats(&phase_total[i], &ctx->phase_mem[i]);
+  }
+  profiled_requests++;
+}
+
+void memprofile_phase_begin(struct rs_request *ctx, int phase) {
+  ctx->running_phases |= 1 << phase;
+}
+
+void memprofile_phase_end(struct rs_request *ctx, int phase) {
+  ctx->running_phases &= ~(1 << phase);
+}
+
+void memprofile_report() {
+  unsigned long n = profiled_requests ? profiled_requests : 1;
+  log_info("memprofile: %lu allocations (%zu bytes), %lu frees (%zu bytes), %lu live allocations (%zu bytes), peak %zu bytes",
+           total.allocs, total.bytes_allocated, total.frees, total.bytes_freed,
+           total.allocs - total.frees, total.bytes_allocated - total.bytes_freed,
+           peak_bytes);
+  log_info("memprofile: %lu requests, %.1f allocations (%.0f bytes) and %.1f frees per request, %ld allocations not freed during dispatch",
+           profiled_requests, (double)request_total.allocs / n,
+           (double)request_total.bytes_allocated / n, (double)request_total.frees / n,
+           (long)(request_total.allocs - request_total.frees));
+  int i;
+  for(i = 0; i < RS_PHASE_COUNT; i++) {
+    log_info("memprofile: phase %s: %.1f allocations (%.0f bytes) per request",
+             rs_phase_names[i], (double)phase_total[i].allocs / n,
+             (double)phase_total[i].bytes_allocated / n);
+  }
+}
+
+#endif /* RS_MEMPROFILE */
@@ -0,0 +1,62 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RS_COMMON_MEMPROFILE_H
+#define RS_COMMON_MEMPROFILE_H
+
+/**
+ * File: memprofile.h
+ *
+ * Allocation accounting, for builds with RS_MEMPROFILE defined
+ * (`make MEMPROFILE=1`). malloc() & co are wrapped at link time
+ * (-Wl,--wrap=malloc ...), so only allocations made by rs-serve and libevhtp
+ * are seen, not those made inside shared libraries (libevent, libc).
+ *
+ * While a request is dispatched, allocations and frees of the dispatching
+ * thread are attributed to it, and to all phases that are running at that
+ * time (so like phase times, they may overlap). The numbers end up in the
+ * access log, and totals are logged at exit.
+ *
+ * Without RS_MEMPROFILE, all of these are no-ops.
+ */
+
+struct rs_alloc_stats {
+  unsigned long allocs;
+  unsigned long frees;
+  size_t bytes_allocated;
+  size_t bytes_freed;
+};
+
+struct rs_request;
+
+#ifdef RS_MEMPROFILE
+
+// attribute allocations of the calling thread to `ctx', until
+// memprofile_end() is called.
+void memprofile_begin(struct rs_request *ctx);
+void memprofile_end(struct rs_request *ctx);
+// (called by request_phase_begin() / request_phase_end())
+void memprofile_phase_begin(struct rs_request *ctx, int phase);
+void memprofile_phase_end(struct rs_request *ctx, int phase);
+// logs totals. Registered with atexit().
+void memprofile_report();
+
+#else
+
+#define memprofile_begin(ctx)
+#define memprofile_end(ctx)
+#define memprofile_phase_begin(ctx, phase)
+#define memprofile_phase_end(ctx, phase)
+
+#endif /* RS_MEMPROFILE */
+
+#endif /* !RS_COMMON_MEMPROFILE_H */
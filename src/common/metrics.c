@@ -0,0 +1,240 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rs-serve.h"
+
+#include <pthread.h>
+
+static const char *method_names[RS_METRICS_METHOD_COUNT] = {
+  "GET", "HEAD", "PUT", "DELETE", "OPTIONS", "other"
+};
+static const int statuses[RS_METRICS_STATUS_COUNT - 1] = RS_METRICS_STATUSES;
+static const long bucket_bounds[RS_METRICS_BUCKET_COUNT - 1] = RS_METRICS_BUCKETS;
+
+static struct rs_metrics *all_metrics = NULL;
+static pthread_mutex_t all_metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct rs_metrics *metrics = NULL;
+
+struct rs_metrics *thread_metrics() {
+  if(metrics == NULL) {
+    struct rs_metrics *new_metrics = malloc(sizeof(struct rs_metrics));
+    if(new_metrics == NULL) {
+      return NULL;
+    }
+    memset(new_metrics, 0, sizeof(struct rs_metrics));
+    pthread_mutex_lock(&all_metrics_mutex);
+    new_metrics->next = all_metrics;
+    __atomic_store_n(&all_metrics, new_metrics, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&all_metrics_mutex);
+    metrics = new_metrics;
+  }
+  return metrics;
+}
+
+#define INC(var, n) __atomic_store_n(&(var), __atomic_load_n(&(var), __ATOMIC_RELAXED) + (n), __ATOMIC_RELAXED)
+#define LOAD(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+void histogram_observe(struct rs_histogram *histogram, long long ns) {
+  long us = ns / 1000;
+  int i;
+  for(i = 0; i < RS_METRICS_BUCKET_COUNT - 1 && us > bucket_bounds[i]; i++);
+  INC(histogram->buckets[i], 1);
+  INC(histogram->count, 1);
+  INC(histogram->sum_ns, ns);
+}
+
+static int method_index(htp_method method) {
+  switch(method) {
+  case htp_method_GET: return RS_METRICS_GET;
+  case htp_method_HEAD: return RS_METRICS_HEAD;
+  case htp_method_PUT: return RS_METRICS_PUT;
+  case htp_method_DELETE: return RS_METRICS_DELETE;
+  case htp_method_OPTIONS: return RS_METRICS_OPTIONS;
+  default: return RS_METRICS_OTHER_METHOD;
+  }
+}
+
+static int status_index(int status) {
+  int i;
+  for(i = 0; i < RS_METRICS_STATUS_COUNT - 1; i++) {
+    if(statuses[i] == status) {
+      return i;
+    }
+  }
+  return RS_METRICS_STATUS_COUNT - 1;
+}
+
+void metrics_record_request(htp_method method, int status, long long ns,
+                            size_t bytes_in, size_t bytes_out) {
+  struct rs_metrics *m = thread_metrics();
+  if(m == NULL) {
+    return;
+  }
+  int mi = method_index(method);
+  INC(m->requests[mi][status_index(status)], 1);
+  histogram_observe(&m->latency[mi], ns);
+  INC(m->bytes_in, bytes_in);
+  INC(m->bytes_out, bytes_out);
+}
+
+void metrics_record_auth_lookup(long long ns) {
+  struct rs_metrics *m = thread_metrics();
+  if(m) {
+    histogram_observe(&m->auth_lookup, ns);
+  }
+}
+
+void metrics_record_loop_lag(long long ns) {
+  struct rs_metrics *m = thread_metrics();
+  if(m) {
+    histogram_observe(&m->loop_lag, ns);
+  }
+}
+
+/*
+ * Exposition
+ */
+
+static void sum_histogram(struct rs_histogram *total, struct rs_histogram *h) {
+  int i;
+  for(i = 0; i < RS_METRICS_BUCKET_COUNT; i++) {
+    total->buckets[i] += LOAD(h->buckets[i]);
+  }
+  total->count += LOAD(h->count);
+  total->sum_ns += LOAD(h->sum_ns);
+}
+
+static void write_histogram(struct evbuffer *buf, const char *name, const char *labels,
+                            struct rs_histogram *h) {
+  unsigned long cumulative = 0;
+  int i;
+  for(i = 0; i < RS_METRICS_BUCKET_COUNT; i++) {
+    cumulative += h->buckets[i];
+    if(i < RS_METRICS_BUCKET_COUNT - 1) {
+      evbuffer_add_printf(buf, "%s_bucket{%s%sle=\"%g\"} %lu\n", name, labels,
+                          *labels ? "," : "", bucket_bounds[i] / 1e6, cumulative);
+    } else {
+      evbuffer_add_printf(buf, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels,
+                          *labels ? "," : "", cumulative);
+    }
+  }
+  if(*labels) {
+    evbuffer_add_printf(buf, "%s_sum{%s} %.6f\n", name, labels, h->sum_ns / 1e9);
+    evbuffer_add_printf(buf, "%s_count{%s} %lu\n", name, labels, h->count);
+  } else {
+    evbuffer_add_printf(buf, "%s_sum %.6f\n", name, h->sum_ns / 1e9);
+    evbuffer_add_printf(buf, "%s_count %lu\n", name, h->count);
+  }
+}
+
+void write_metrics(struct evbuffer *buf) {
+  struct rs_metrics total;
+  memset(&total, 0, sizeof(struct rs_metrics));
+  struct rs_metrics *m;
+  int i, j;
+  for(m = __atomic_load_n(&all_metrics, __ATOMIC_ACQUIRE); m != NULL; m = m->next) {
+    for(i = 0; i < RS_METRICS_METHOD_COUNT; i++) {
+      for(j = 0; j < RS_METRICS_STATUS_COUNT; j++) {
+        total.requests[i][j] += LOAD(m->requests[i][j]);
+      }
+      sum_histogram(&total.latency[i], &m->latency[i]);
+    }
+    total.bytes_in += LOAD(m->bytes_in);
+    total.bytes_out += LOAD(m->bytes_out);
+    sum_histogram(&total.auth_lookup, &m->auth_lookup);
+    sum_histogram(&total.loop_lag, &m->loop_lag);
+    total.dir_cache_hits += LOAD(m->dir_cache_hits);
+    total.dir_cache_misses += LOAD(m->dir_cache_misses);
+    total.missing_cache_hits += LOAD(m->missing_cache_hits);
+    total.missing_cache_misses += LOAD(m->missing_cache_misses);
+    for(i = 0; i <= RS_PHASE_COUNT; i++) {
+      total.stalls[i] += LOAD(m->stalls[i]);
+    }
+  }
+
+  evbuffer_add_printf(buf, "# TYPE rs_requests_total counter\n");
+  for(i = 0; i < RS_METRICS_METHOD_COUNT; i++) {
+    for(j = 0; j < RS_METRICS_STATUS_COUNT; j++) {
+      if(total.requests[i][j] == 0) {
+        continue;
+      }
+      if(j < RS_METRICS_STATUS_COUNT - 1) {
+        evbuffer_add_printf(buf, "rs_requests_total{method=\"%s\",status=\"%d\"} %lu\n",
+                            method_names[i], statuses[j], total.requests[i][j]);
+      } else {
+        evbuffer_add_printf(buf, "rs_requests_total{method=\"%s\",status=\"other\"} %lu\n",
+                            method_names[i], total.requests[i][j]);
+      }
+    }
+  }
+
+  evbuffer_add_printf(buf, "# TYPE rs_request_duration_seconds histogram\n");
+  char labels[32];
+  for(i = 0; i < RS_METRICS_METHOD_COUNT; i++) {
+    if(total.latency[i].count == 0) {
+      continue;
+    }
+    snprintf(labels, sizeof(labels), "method=\"%s\"", method_names[i]);
+    write_histogram(buf, "rs_request_duration_seconds", labels, &total.latency[i]);
+  }
+
+  evbuffer_add_printf(buf, "# TYPE rs_request_bytes_total counter\n");
+  evbuffer_add_printf(buf, "rs_request_bytes_total %llu\n", total.bytes_in);
+  evbuffer_add_printf(buf, "# TYPE rs_response_bytes_total counter\n");
+  evbuffer_add_printf(buf, "rs_response_bytes_total %llu\n", total.bytes_out);
+
+  evbuffer_add_printf(buf, "# TYPE rs_requests_in_flight gauge\n");
+  evbuffer_add_printf(buf, "rs_requests_in_flight %u\n", request_count);
+
+  evbuffer_add_printf(buf, "# TYPE rs_auth_lookup_duration_seconds histogram\n");
+  write_histogram(buf, "rs_auth_lookup_duration_seconds", "", &total.auth_lookup);
+
+  evbuffer_add_printf(buf, "# TYPE rs_event_loop_lag_seconds histogram\n");
+  write_histogram(buf, "rs_event_loop_lag_seconds", "", &total.loop_lag);
+
+  evbuffer_add_printf(buf, "# TYPE rs_event_loop_stalls_total counter\n");
+  for(i = 0; i <= RS_PHASE_COUNT; i++) {
+    evbuffer_add_printf(buf, "rs_event_loop_stalls_total{phase=\"%s\"} %lu\n",
+                        i < RS_PHASE_COUNT ? rs_phase_names[i] : "unknown", total.stalls[i]);
+  }
+
+  struct rs_cache_stats user_stats, missing_user_stats, listing_stats, document_stats;
+  user_cache_get_stats(&user_stats);
+  missing_user_cache_get_stats(&missing_user_stats);
+  listing_cache_get_stats(&listing_stats);
+  document_cache_get_stats(&document_stats);
+  evbuffer_add_printf(buf, "# TYPE rs_cache_hits_total counter\n");
+  evbuffer_add_printf(buf, "rs_cache_hits_total{cache=\"user\"} %lu\n", user_stats.hits);
+  evbuffer_add_printf(buf, "rs_cache_hits_total{cache=\"missing_user\"} %lu\n", missing_user_stats.hits);
+  evbuffer_add_printf(buf, "rs_cache_hits_total{cache=\"dir\"} %lu\n", total.dir_cache_hits);
+  evbuffer_add_printf(buf, "rs_cache_hits_total{cache=\"missing_path\"} %lu\n", total.missing_cache_hits);
+  evbuffer_add_printf(buf, "rs_cache_hits_total{cache=\"listing\"} %lu\n", listing_stats.hits);
+  evbuffer_add_printf(buf, "rs_cache_hits_total{cache=\"document\"} %lu\n", document_stats.hits);
+  evbuffer_add_printf(buf, "# TYPE rs_cache_misses_total counter\n");
+  evbuffer_add_printf(buf, "rs_cache_misses_total{cache=\"user\"} %lu\n", user_stats.misses);
+  evbuffer_add_printf(buf, "rs_cache_misses_total{cache=\"missing_user\"} %lu\n", missing_user_stats.misses);
+  evbuffer_add_printf(buf, "rs_cache_misses_total{cache=\"dir\"} %lu\n", total.dir_cache_misses);
+  evbuffer_add_printf(buf, "rs_cache_misses_total{cache=\"missing_path\"} %lu\n", total.missing_cache_misses);
+  evbuffer_add_printf(buf, "rs_cache_misses_total{cache=\"listing\"} %lu\n", listing_stats.misses);
+  evbuffer_add_printf(buf, "rs_cache_misses_total{cache=\"document\"} %lu\n", document_stats.misses);
+  evbuffer_add_printf(buf, "# TYPE rs_cache_entries gauge\n");
+  evbuffer_add_printf(buf, "rs_cache_entries{cache=\"user\"} %zu\n", user_stats.entries);
+  evbuffer_add_printf(buf, "rs_cache_entries{cache=\"missing_user\"} %zu\n", missing_user_stats.entries);
+  evbuffer_add_printf(buf, "rs_cache_entries{cache=\"listing\"} %zu\n", listing_stats.entries);
+  evbuffer_add_printf(buf, "rs_cache_entries{cache=\"document\"} %zu\n", document_stats.entries);
+  evbuffer_add_printf(buf, "# TYPE rs_cache_bytes gauge\n");
+  evbuffer_add_printf(buf, "rs_cache_bytes{cache=\"listing\"} %zu\n", listing_stats.bytes);
+  evbuffer_add_printf(buf, "rs_cache_bytes{cache=\"document\"} %zu\n", document_stats.bytes);
+
+  evbuffer_add_printf(buf, "# TYPE rs_log_dropped_total counter\n");
+  evbuffer_add_printf(buf, "rs_log_dropped_total %lu\n", log_dropped_count());
+}
@@ -0,0 +1,97 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RS_COMMON_METRICS_H
+#define RS_COMMON_METRICS_H
+
+/**
+ * File: metrics.h
+ *
+ * Counters and latency histograms, exposed by handler/metrics.c.
+ *
+ * Every thread updates it's own struct rs_metrics (see thread_metrics()),
+ * using relaxed atomic loads and stores but no read-modify-write
+ * operations, since each struct only has a single writer. Scraping sums up
+ * the structs of all threads.
+ */
+
+enum rs_metrics_method {
+  RS_METRICS_GET,
+  RS_METRICS_HEAD,
+  RS_METRICS_PUT,
+  RS_METRICS_DELETE,
+  RS_METRICS_OPTIONS,
+  RS_METRICS_OTHER_METHOD,
+  RS_METRICS_METHOD_COUNT
+};
+
+// status codes that are counted individually, all others end up in "other"
+#define RS_METRICS_STATUSES { 200, 201, 204, 206, 304, 400, 401, 404, 405, 412, 414, 416, 500 }
+#define RS_METRICS_STATUS_COUNT 14
+
+// upper bounds of the latency histogram buckets, in microseconds
+#define RS_METRICS_BUCKETS { 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, \
+      50000, 100000, 250000, 500000, 1000000, 2500000 }
+#define RS_METRICS_BUCKET_COUNT 16 // (including +Inf)
+
+struct rs_histogram {
+  unsigned long buckets[RS_METRICS_BUCKET_COUNT];
+  unsigned long count;
+  unsigned long long sum_ns;
+};
+
+struct rs_metrics {
+  unsigned long requests[RS_METRICS_METHOD_COUNT][RS_METRICS_STATUS_COUNT];
+  struct rs_histogram latency[RS_METRICS_METHOD_COUNT];
+  unsigned long long bytes_in;
+  unsigned long long bytes_out;
+  struct rs_histogram auth_lookup;
+  struct rs_histogram loop_lag;
+  unsigned long dir_cache_hits;
+  unsigned long dir_cache_misses;
+  unsigned long missing_cache_hits;
+  unsigned long missing_cache_misses;
+  // event loop stalls, by the longest phase that ran during the stall
+  // (the last element counts stalls outside of any phase)
+  unsigned long stalls[RS_PHASE_COUNT + 1];
+  struct rs_metrics *next;
+};
+
+// returns the calling thread's metrics (or NULL if allocation failed).
+struct rs_metrics *thread_metrics();
+
+// increments a counter of the calling thread
+#define METRIC_ADD(field, n) do {                                       \
+    struct rs_metrics *metrics_ = thread_metrics();                     \
+    if(metrics_) {                                                      \
+      __atomic_store_n(&metrics_->field,                                \
+                       __atomic_load_n(&metrics_->field, __ATOMIC_RELAXED) + (n), \
+                       __ATOMIC_RELAXED);                               \
+    }                                                                   \
+  } while(0)
+
+void histogram_observe(struct rs_histogram *histogram, long long ns);
+
+void metrics_record_request(htp_method method, int status, long long ns,
+                            size_t bytes_in, size_t bytes_out);
+void metrics_record_auth_lookup(long long ns);
+void metrics_record_loop_lag(long long ns);
+
+/**
+ * write_metrics()
+ *
+ * Writes all metrics (summed up over all threads) in the Prometheus text
+ * exposition format to the given buffer.
+ */
+void write_metrics(struct evbuffer *buf);
+
+#endif /* !RS_COMMON_METRICS_H */
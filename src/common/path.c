@@ -0,0 +1,171 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include <sys/types.h>
+#include <sys/syscall.h>
+
+#include <linux/openat2.h>
+
+#include "common/path.h"
+
+int path_has_dot_segments(const char *path) {
+  const char *segment = path;
+  for(;;) {
+    const char *end = strchrnul(segment, '/');
+    size_t len = end - segment;
+    if((len == 1 && segment[0] == '.') ||
+       (len == 2 && segment[0] == '.' && segment[1] == '.')) {
+      return 1;
+    }
+    if(*end == 0) {
+      return 0;
+    }
+    segment = end + 1;
+  }
+}
+
+int path_normalize(char *path, struct rs_path *result) {
+  static char root_path[] = "/";
+  result->segment_count = 0;
+  if(*path == 0) {
+    result->path = root_path;
+    result->len = 1;
+    result->is_dir = 1;
+    return 0;
+  }
+  if(*path != '/') {
+    errno = EINVAL;
+    return -1;
+  }
+  char *in = path, *out = path;
+  // every segment consumes at least one slash and is written back with
+  // exactly one, so `out' never overtakes `in'.
+  for(;;) {
+    while(*in == '/') in++;
+    if(*in == 0) break;
+    char *segment = in;
+    in = strchrnul(segment, '/');
+    size_t len = in - segment;
+    if(segment[0] == '.' && (len == 1 || (len == 2 && segment[1] == '.'))) {
+      errno = EINVAL;
+      return -1;
+    }
+    if(result->segment_count == RS_PATH_MAX_SEGMENTS) {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+    *out++ = '/';
+    if(out != segment) {
+      memmove(out, segment, len);
+    }
+    result->segments[result->segment_count].offset = out - path;
+    result->segments[result->segment_count].len = len;
+    result->segment_count++;
+    out += len;
+  }
+  result->is_dir = in[-1] == '/';
+  if(result->is_dir) {
+    *out++ = '/';
+  }
+  *out = 0;
+  result->path = path;
+  result->len = out - path;
+  return 0;
+}
+
+char path_cut(struct rs_path *path, int index) {
+  char *end = path->path + path->segments[index].offset + path->segments[index].len;
+  char c = *end;
+  *end = 0;
+  return c;
+}
+
+void path_uncut(struct rs_path *path, int index, char c) {
+  path->path[path->segments[index].offset + path->segments[index].len] = c;
+}
+
+const char *path_basename(struct rs_path *path) {
+  if(path->segment_count == 0) {
+    return path->path;
+  }
+  return path->path + path->segments[path->segment_count - 1].offset;
+}
+
+static int openat2_supported = 1;
+
+int open_beneath(int root_fd, const char *path, int flags, mode_t mode) {
+  while(*path == '/') path++;
+  if(*path == 0) {
+    path = ".";
+  }
+  flags |= O_CLOEXEC;
+#ifdef SYS_openat2
+  if(openat2_supported) {
+    struct open_how how;
+    memset(&how, 0, sizeof(how));
+    how.flags = flags;
+    how.mode = (flags & O_CREAT) ? mode : 0;
+    how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+    int fd = syscall(SYS_openat2, root_fd, path, &how, sizeof(how));
+    if(fd != -1 || errno != ENOSYS) {
+      return fd;
+    }
+    openat2_supported = 0;
+  }
+#endif
+  if(path_has_dot_segments(path)) {
+    errno = EXDEV;
+    return -1;
+  }
+  return openat(root_fd, path, flags, mode);
+}
+
+int unlink_beneath(int root_fd, const char *path, int flags) {
+  while(*path == '/') path++;
+  const char *name = strrchr(path, '/');
+  int parent_fd, result;
+  if(name == NULL) {
+    name = path;
+    parent_fd = root_fd;
+  } else {
+    size_t parent_len = name - path;
+    char parent[parent_len + 1];
+    memcpy(parent, path, parent_len);
+    parent[parent_len] = 0;
+    name++;
+    parent_fd = open_beneath(root_fd, parent, O_PATH | O_DIRECTORY, 0);
+    if(parent_fd == -1) {
+      return -1;
+    }
+  }
+  if(*name == 0 || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+    errno = EINVAL;
+    result = -1;
+  } else {
+    result = unlinkat(parent_fd, name, flags);
+  }
+  if(parent_fd != root_fd) {
+    int saved_errno = errno;
+    close(parent_fd);
+    errno = saved_errno;
+  }
+  return result;
+}
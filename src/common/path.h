@@ -0,0 +1,95 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RS_COMMON_PATH_H
+#define RS_COMMON_PATH_H
+
+#define RS_PATH_MAX_SEGMENTS 128
+
+/**
+ * struct rs_path
+ *
+ * A normalized request path, split into segments (see path_normalize()).
+ * Segments are described by their offset into `path' and their length,
+ * they are not separately NUL-terminated. Use path_cut() / path_uncut() to
+ * temporarily terminate the path after a given segment.
+ */
+struct rs_path {
+  // normalized path, always starts with a slash
+  char *path;
+  size_t len;
+  // non-zero if the path refers to a directory (i.e. ends with a slash)
+  int is_dir;
+  int segment_count;
+  struct {
+    unsigned int offset;
+    unsigned int len;
+  } segments[RS_PATH_MAX_SEGMENTS];
+};
+
+/**
+ * path_normalize()
+ *
+ * Normalizes `path' in place, in a single pass: runs of slashes are collapsed
+ * into one and the segments are recorded in `result'. An empty path is
+ * treated as "/".
+ *
+ * Returns zero on success. Returns -1 and sets errno to EINVAL if the path
+ * doesn't start with a slash or contains "." or ".." segments, or to
+ * ENAMETOOLONG if it has more than RS_PATH_MAX_SEGMENTS segments.
+ */
+int path_normalize(char *path, struct rs_path *result);
+
+/**
+ * path_cut()
+ *
+ * Terminates the path after the segment with the given index and returns
+ * the character that was replaced. Must be undone using path_uncut().
+ */
+char path_cut(struct rs_path *path, int index);
+void path_uncut(struct rs_path *path, int index, char c);
+
+/**
+ * path_basename()
+ *
+ * Returns the last segment of a (non-directory) path.
+ */
+const char *path_basename(struct rs_path *path);
+
+/**
+ * path_has_dot_segments()
+ *
+ * Returns non-zero if any segment of the given path is "." or "..".
+ */
+int path_has_dot_segments(const char *path);
+
+/**
+ * open_beneath()
+ *
+ * Opens `path' relative to the directory `root_fd', like openat(). Leading
+ * slashes are ignored, an empty path refers to `root_fd' itself.
+ *
+ * Path resolution is confined to `root_fd' by the kernel (using openat2()
+ * with RESOLVE_BENEATH). Attempts to escape fail with EXDEV.
+ * On kernels without openat2(), paths with dot segments are rejected instead.
+ */
+int open_beneath(int root_fd, const char *path, int flags, mode_t mode);
+
+/**
+ * unlink_beneath()
+ *
+ * Like unlinkat(), but opens the parent directory of `path' using
+ * open_beneath() first.
+ */
+int unlink_beneath(int root_fd, const char *path, int flags);
+
+#endif /* !RS_COMMON_PATH_H */
@@ -0,0 +1,137 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <time.h>
+
+#include "common/precondition.h"
+
+// suffixes of the entity tags of content-coded representations
+static const char *coding_suffixes[] = { "-gzip", "-br", NULL };
+
+// returns non-zero if `tag' (of `len' bytes) is `etag' with one of the
+// coding_suffixes appended.
+static int coded_tag_matches(const char *tag, size_t len, const char *etag, size_t etag_len) {
+  const char **suffix;
+  if(len <= etag_len || strncmp(tag, etag, etag_len) != 0) {
+    return 0;
+  }
+  for(suffix = coding_suffixes; *suffix; suffix++) {
+    if(len - etag_len == strlen(*suffix) &&
+       strncmp(tag + etag_len, *suffix, len - etag_len) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int list_matches(const char *list, const char *etag, int weak, int any_coding) {
+  size_t etag_len = strlen(etag);
+  const char *p = list;
+  while(*p) {
+    while(*p == ' ' || *p == '\t' || *p == ',') p++;
+    if(*p == 0) {
+      break;
+    }
+    if(*p == '*') {
+      return 1;
+    }
+    int is_weak = 0;
+    if(p[0] == 'W' && p[1] == '/') {
+      is_weak = 1;
+      p += 2;
+    }
+    const char *tag, *end;
+    if(*p == '"') {
+      tag = ++p;
+      end = strchr(tag, '"');
+      if(end == NULL) {
+        return 0; // malformed
+      }
+      p = end + 1;
+    } else {
+      // (unquoted, as sent by older clients)
+      tag = p;
+      end = p + strcspn(p, ", \t");
+      p = end;
+    }
+    if((weak || ! is_weak) &&
+       ((end - tag == etag_len && strncmp(tag, etag, etag_len) == 0) ||
+        (any_coding && coded_tag_matches(tag, end - tag, etag, etag_len)))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int etag_list_matches(const char *list, const char *etag, int weak) {
+  return list_matches(list, etag, weak, 0);
+}
+
+static const char *http_date_formats[] = {
+  "%a, %d %b %Y %H:%M:%S GMT", // IMF-fixdate
+  "%A, %d-%b-%y %H:%M:%S GMT", // RFC 850
+  "%a %b %e %H:%M:%S %Y",      // asctime()
+  NULL
+};
+
+time_t parse_http_date(const char *date) {
+  struct tm tm;
+  const char **format;
+  for(format = http_date_formats; *format; format++) {
+    memset(&tm, 0, sizeof(struct tm));
+    const char *end = strptime(date, *format, &tm);
+    if(end != NULL && *end == 0) {
+      return timegm(&tm);
+    }
+  }
+  return -1;
+}
+
+void format_http_date(time_t t, char *buf) {
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  strftime(buf, RS_HTTP_DATE_LEN, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+int evaluate_preconditions(const struct rs_preconditions *preconditions,
+                           int is_read, const char *etag, time_t last_modified) {
+  time_t date;
+
+  // 1. If-Match, otherwise 2. If-Unmodified-Since
+  if(preconditions->if_match) {
+    if(etag == NULL || ! list_matches(preconditions->if_match, etag, 0, 1)) {
+      return 412;
+    }
+  } else if(preconditions->if_unmodified_since && etag != NULL && last_modified != -1) {
+    date = parse_http_date(preconditions->if_unmodified_since);
+    if(date != -1 && last_modified > date) {
+      return 412;
+    }
+  }
+
+  // 3. If-None-Match, otherwise 4. If-Modified-Since (only GET and HEAD)
+  if(preconditions->if_none_match) {
+    if(etag != NULL && list_matches(preconditions->if_none_match, etag, 1, 1)) {
+      return is_read ? 304 : 412;
+    }
+  } else if(is_read && preconditions->if_modified_since && etag != NULL && last_modified != -1) {
+    date = parse_http_date(preconditions->if_modified_since);
+    if(date != -1 && last_modified <= date) {
+      return 304;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RS_COMMON_PRECONDITION_H
+#define RS_COMMON_PRECONDITION_H
+
+/**
+ * File: precondition.h
+ *
+ * Evaluation of conditional request headers (RFC 7232), shared by all
+ * storage methods.
+ */
+
+/**
+ * struct rs_preconditions
+ *
+ * Values of the conditional request headers (NULL if not given).
+ */
+struct rs_preconditions {
+  const char *if_match;
+  const char *if_none_match;
+  const char *if_modified_since;
+  const char *if_unmodified_since;
+};
+
+/**
+ * evaluate_preconditions()
+ *
+ * Evaluates the given preconditions in the order described in RFC 7232,
+ * section 6, against the current state of the target resource:
+ * `etag' is it's (unquoted) entity tag or NULL if the resource doesn't exist,
+ * `last_modified' it's modification time or -1 if it is not known.
+ * `is_read' must be non-zero for GET and HEAD requests.
+ *
+ * Entity tags in the headers may be quoted or not. If-Match uses the strong
+ * comparison function, If-None-Match the weak one. Both also accept the
+ * entity tags of content-coded representations of the resource (`etag'
+ * followed by "-gzip" or "-br"), which have the same contents. Dates that
+ * can't be parsed are ignored, as are If-(Un)Modified-Since if the
+ * corresponding If-(None-)Match header is present.
+ *
+ * Returns zero if the request should be performed, 304 (Not Modified) or
+ * 412 (Precondition Failed) otherwise.
+ */
+int evaluate_preconditions(const struct rs_preconditions *preconditions,
+                           int is_read, const char *etag, time_t last_modified);
+
+/**
+ * etag_list_matches()
+ *
+ * Returns non-zero if the comma-separated list of entity tags `list' (or "*")
+ * contains `etag'. If `weak' is zero, weak entity tags ("W/...") never match.
+ * Entity tags of content-coded representations don't match either.
+ */
+int etag_list_matches(const char *list, const char *etag, int weak);
+
+/**
+ * parse_http_date()
+ *
+ * Parses an HTTP-date (IMF-fixdate, or one of the obsolete RFC 850 and
+ * asctime() formats). Returns -1 if the date is invalid.
+ */
+time_t parse_http_date(const char *date);
+
+/**
+ * format_http_date()
+ *
+ * Writes `t' as an IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT") to `buf',
+ * which must hold at least RS_HTTP_DATE_LEN bytes.
+ */
+#define RS_HTTP_DATE_LEN 30
+void format_http_date(time_t t, char *buf);
+
+#endif /* !RS_COMMON_PRECONDITION_H */
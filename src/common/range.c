@@ -0,0 +1,142 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+
+#include "common/range.h"
+
+#define IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+#define SKIP_WS(p) while(*(p) == ' ' || *(p) == '\t') (p)++
+
+// parses a (non-negative) decimal number. Returns -1 if there are no digits
+// or the number doesn't fit.
+static off_t parse_position(const char **p) {
+  const off_t max = (off_t)((1ULL << (sizeof(off_t) * 8 - 1)) - 1);
+  off_t value = 0;
+  if(! IS_DIGIT(**p)) {
+    return -1;
+  }
+  for(; IS_DIGIT(**p); (*p)++) {
+    int digit = **p - '0';
+    if(value > (max - digit) / 10) {
+      return -1;
+    }
+    value = value * 10 + digit;
+  }
+  return value;
+}
+
+int parse_range(const char *header, off_t size, struct rs_range *ranges, int max_ranges) {
+  const char *p = header;
+  int count = 0, seen = 0;
+  SKIP_WS(p);
+  if(strncasecmp(p, "bytes", 5) != 0) {
+    return -1;
+  }
+  p += 5;
+  SKIP_WS(p);
+  if(*p++ != '=') {
+    return -1;
+  }
+  for(;;) {
+    SKIP_WS(p);
+    if(*p == ',') {
+      // (empty list element)
+      p++;
+      continue;
+    }
+    if(*p == 0) {
+      break;
+    }
+    off_t first, last;
+    if(*p == '-') {
+      // suffix range: last N bytes
+      p++;
+      off_t suffix_length = parse_position(&p);
+      if(suffix_length == -1) {
+        return -1;
+      }
+      first = suffix_length >= size ? 0 : size - suffix_length;
+      last = suffix_length == 0 ? -1 : size - 1;
+    } else {
+      first = parse_position(&p);
+      if(first == -1 || *p++ != '-') {
+        return -1;
+      }
+      if(IS_DIGIT(*p)) {
+        last = parse_position(&p);
+        if(last == -1 || last < first) {
+          return -1;
+        }
+        if(last >= size) {
+          last = size - 1;
+        }
+      } else {
+        last = size - 1;
+      }
+    }
+    SKIP_WS(p);
+    if(*p != ',' && *p != 0) {
+      return -1;
+    }
+    if(++seen > max_ranges) {
+      return -1;
+    }
+    if(first < size && first <= last) {
+      ranges[count].first = first;
+      ranges[count].last = last;
+      count++;
+    }
+  }
+  return seen == 0 ? -1 : count;
+}
+
+int parse_content_range(const char *header, off_t *first, off_t *last, off_t *total) {
+  const char *p = header;
+  SKIP_WS(p);
+  if(strncasecmp(p, "bytes", 5) != 0 || (p[5] != ' ' && p[5] != '\t')) {
+    return -1;
+  }
+  p += 5;
+  SKIP_WS(p);
+  if(*p == '*') {
+    p++;
+    *first = *last = -1;
+  } else {
+    *first = parse_position(&p);
+    if(*first == -1 || *p++ != '-') {
+      return -1;
+    }
+    *last = parse_position(&p);
+    if(*last == -1 || *last < *first) {
+      return -1;
+    }
+  }
+  if(*p++ != '/') {
+    return -1;
+  }
+  if(*p == '*') {
+    p++;
+    *total = -1;
+  } else {
+    *total = parse_position(&p);
+    if(*total == -1 || (*last != -1 && *last >= *total)) {
+      return -1;
+    }
+  }
+  SKIP_WS(p);
+  return *p == 0 ? 0 : -1;
+}
@@ -0,0 +1,52 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RS_COMMON_RANGE_H
+#define RS_COMMON_RANGE_H
+
+/**
+ * struct rs_range
+ *
+ * A byte range, positions are inclusive.
+ */
+struct rs_range {
+  off_t first;
+  off_t last;
+};
+
+/**
+ * parse_range()
+ *
+ * Parses the value of a "Range" request header (RFC 7233) for a document of
+ * `size' bytes, storing at most `max_ranges' ranges in `ranges'. Ranges are
+ * clamped to the document, unsatisfiable ones are left out.
+ *
+ * Returns the number of ranges stored, or zero if none of the given ranges
+ * is satisfiable (to be answered with 416). Returns -1 if the header is
+ * invalid, uses a unit other than "bytes" or asks for more than
+ * `max_ranges' ranges, in which case it should be ignored.
+ */
+int parse_range(const char *header, off_t size, struct rs_range *ranges, int max_ranges);
+
+/**
+ * parse_content_range()
+ *
+ * Parses the value of a "Content-Range" header, as sent with partial PUT
+ * requests: "bytes <first>-<last>/<total>". Both <first>-<last> and <total>
+ * may be "*" (unknown), in which case the corresponding values are set
+ * to -1.
+ *
+ * Returns zero on success, -1 if the header is invalid.
+ */
+int parse_content_range(const char *header, off_t *first, off_t *last, off_t *total);
+
+#endif /* !RS_COMMON_RANGE_H */
@@ -0,0 +1,62 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rs-serve.h"
+
+const char *rs_phase_names[RS_PHASE_COUNT] = {
+  "user", "auth", "path", "stat", "etag", "content_type", "body"
+};
+
+static long long elapsed_ns(struct timespec *since) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since->tv_sec) * 1000000000LL + (now.tv_nsec - since->tv_nsec);
+}
+
+struct rs_request *new_request_context() {
+  struct rs_request *ctx = malloc(sizeof(struct rs_request));
+  if(ctx == NULL) {
+    log_error("malloc() failed: %s", strerror(errno));
+    return NULL;
+  }
+  memset(ctx, 0, sizeof(struct rs_request));
+  arena_init(&ctx->arena);
+  clock_gettime(CLOCK_MONOTONIC, &ctx->start);
+  return ctx;
+}
+
+void free_request_context(struct rs_request *ctx) {
+  if(ctx->cleanup) {
+    ctx->cleanup(ctx->cleanup_arg);
+  }
+  if(ctx->user) {
+    user_release(ctx->user);
+  }
+  arena_release(&ctx->arena);
+  free(ctx);
+}
+
+void request_phase_begin(struct rs_request *ctx, enum rs_phase phase) {
+  clock_gettime(CLOCK_MONOTONIC, &ctx->phase_start[phase]);
+  memprofile_phase_begin(ctx, phase);
+}
+
+void request_phase_end(struct rs_request *ctx, enum rs_phase phase) {
+  long long ns = elapsed_ns(&ctx->phase_start[phase]);
+  memprofile_phase_end(ctx, phase);
+  ctx->phase_ns[phase] += ns;
+  stall_note_phase(ctx, phase, ns);
+}
+
+long long request_elapsed_ns(struct rs_request *ctx) {
+  return elapsed_ns(&ctx->start);
+}
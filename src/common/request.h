@@ -0,0 +1,85 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RS_COMMON_REQUEST_H
+#define RS_COMMON_REQUEST_H
+
+/**
+ * enum rs_phase
+ *
+ * Phases of handling a storage request, timed individually for the access
+ * log (see request_phase_begin() / request_phase_end()). Phases may nest:
+ * directory listings compute ETags as part of RS_PHASE_BODY.
+ */
+enum rs_phase {
+  RS_PHASE_USER,         // user lookup
+  RS_PHASE_AUTH,         // authorization
+  RS_PHASE_PATH,         // path normalization and resolution
+  RS_PHASE_STAT,
+  RS_PHASE_ETAG,
+  RS_PHASE_CONTENT_TYPE, // xattr / libmagic
+  RS_PHASE_BODY,         // reading / writing / listing / removing
+  RS_PHASE_COUNT
+};
+
+extern const char *rs_phase_names[RS_PHASE_COUNT];
+
+/**
+ * struct rs_request
+ *
+ * Per-request state of a storage request, shared by all handlers.
+ * Created when the request is dispatched and freed when evhtp finishes
+ * the request (see finish_request() in process/main.c).
+ */
+struct rs_request {
+  // user the request is directed at (resolved by dispatch_storage())
+  struct rs_user *user;
+  // memory that is needed until the request is finished (etags, content
+  // types, ...). Released by free_request_context().
+  struct rs_arena arena;
+  // normalized request path (set by dispatch_storage())
+  struct rs_path path;
+  // size of request / response bodies
+  size_t bytes_in;
+  size_t bytes_out;
+  // (CLOCK_MONOTONIC) time the request was dispatched
+  struct timespec start;
+  // start of the currently running instance of each phase, and accumulated
+  // time spent in each phase (in nanoseconds)
+  struct timespec phase_start[RS_PHASE_COUNT];
+  long long phase_ns[RS_PHASE_COUNT];
+  // set by handlers that send (or stream) the reply themselves, so
+  // dispatch_storage() doesn't send one.
+  int reply_started;
+  // if set, called by free_request_context() with `cleanup_arg', to release
+  // state of a reply that is still in progress (such as a streamed listing).
+  void (*cleanup)(void *arg);
+  void *cleanup_arg;
+#ifdef RS_MEMPROFILE
+  // allocations made while dispatching the request, in total and per phase
+  // (see memprofile.h)
+  struct rs_alloc_stats mem;
+  struct rs_alloc_stats phase_mem[RS_PHASE_COUNT];
+  // bitmask of currently running phases
+  unsigned int running_phases;
+#endif
+};
+
+struct rs_request *new_request_context();
+void free_request_context(struct rs_request *ctx);
+
+void request_phase_begin(struct rs_request *ctx, enum rs_phase phase);
+void request_phase_end(struct rs_request *ctx, enum rs_phase phase);
+// nanoseconds since the request was dispatched
+long long request_elapsed_ns(struct rs_request *ctx);
+
+#endif /* !RS_COMMON_REQUEST_H */
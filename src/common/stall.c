@@ -0,0 +1,125 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rs-serve.h"
+
+/*
+ * Stall detector
+ * --------------
+ *
+ * All filesystem work happens on the event loop, so a slow request blocks
+ * all others. A periodic timer measures how late it fires. Since the timer
+ * can only fire once the loop is free again, the culprits are remembered
+ * as they finish: the longest request and the longest phase seen since
+ * the last tick. When the lag exceeds the threshold, they are logged and
+ * the stall is counted in the metrics (by phase).
+ */
+
+struct stall_culprit {
+  long long ns;
+  int phase; // RS_PHASE_COUNT if not a phase
+  char method[8];
+  char user[64];
+  char path[256];
+};
+
+static struct stall_culprit longest_phase;
+static struct stall_culprit longest_request;
+static struct timespec expected;
+
+static void remember(struct stall_culprit *culprit, evhtp_request_t *req,
+                     struct rs_request *ctx, int phase, long long ns) {
+  culprit->ns = ns;
+  culprit->phase = phase;
+  snprintf(culprit->user, sizeof(culprit->user), "%s",
+           ctx->user ? ctx->user->name : "-");
+  snprintf(culprit->path, sizeof(culprit->path), "%s",
+           ctx->path.path ? ctx->path.path : "-");
+  if(req) {
+    snprintf(culprit->method, sizeof(culprit->method), "%s",
+             htparser_get_methodstr_m(req->method));
+  } else {
+    culprit->method[0] = 0;
+  }
+}
+
+void stall_note_phase(struct rs_request *ctx, enum rs_phase phase, long long ns) {
+  if(ns > longest_phase.ns) {
+    remember(&longest_phase, NULL, ctx, phase, ns);
+  }
+}
+
+void stall_note_request(evhtp_request_t *req, struct rs_request *ctx, long long ns) {
+  if(ns > longest_request.ns) {
+    remember(&longest_request, req, ctx, RS_PHASE_COUNT, ns);
+  }
+}
+
+static void add_interval(struct timespec *ts) {
+  ts->tv_nsec += RS_STALL_CHECK_INTERVAL * 1000000L;
+  while(ts->tv_nsec >= 1000000000L) {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000L;
+  }
+}
+
+// advances `expected' to the timer's next deadline. Like libevent does for
+// persistent timers, that's one interval after the previous deadline, or one
+// interval from now if that has passed already (after a lag longer than the
+// interval). Starting from `now' instead would hide every smaller lag from
+// the next sample.
+static void schedule(struct timespec *now) {
+  add_interval(&expected);
+  if(expected.tv_sec < now->tv_sec ||
+     (expected.tv_sec == now->tv_sec && expected.tv_nsec < now->tv_nsec)) {
+    expected = *now;
+    add_interval(&expected);
+  }
+}
+
+static void check_stall(evutil_socket_t fd, short events, void *arg) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long long lag = (now.tv_sec - expected.tv_sec) * 1000000000LL +
+    (now.tv_nsec - expected.tv_nsec);
+  if(lag < 0) {
+    lag = 0;
+  }
+  metrics_record_loop_lag(lag);
+  if(RS_STALL_THRESHOLD > 0 && lag > RS_STALL_THRESHOLD * 1000000LL) {
+    if(longest_phase.ns > 0) {
+      log_warn("Event loop stalled for %lld ms. Longest request: %s %s (user: %s, %lld ms), "
+               "longest phase: %s (%s, %lld ms)", lag / 1000000,
+               longest_request.method, longest_request.path, longest_request.user,
+               longest_request.ns / 1000000, rs_phase_names[longest_phase.phase],
+               longest_phase.path, longest_phase.ns / 1000000);
+    } else if(longest_request.ns > 0) {
+      log_warn("Event loop stalled for %lld ms. Longest request: %s %s (user: %s, %lld ms)",
+               lag / 1000000, longest_request.method, longest_request.path,
+               longest_request.user, longest_request.ns / 1000000);
+    } else {
+      log_warn("Event loop stalled for %lld ms (not during a storage request)", lag / 1000000);
+    }
+    METRIC_ADD(stalls[longest_phase.ns > 0 ? longest_phase.phase : RS_PHASE_COUNT], 1);
+  }
+  longest_phase.ns = 0;
+  longest_request.ns = 0;
+  schedule(&now);
+}
+
+void start_stall_detector(struct event_base *base) {
+  struct timeval interval = { 0, RS_STALL_CHECK_INTERVAL * 1000 };
+  struct event *stall_event = event_new(base, -1, EV_PERSIST, check_stall, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &expected);
+  add_interval(&expected);
+  event_add(stall_event, &interval);
+}
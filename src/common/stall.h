@@ -0,0 +1,42 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RS_COMMON_STALL_H
+#define RS_COMMON_STALL_H
+
+/**
+ * start_stall_detector()
+ *
+ * Adds a timer to the given event base, that measures how late it fires
+ * (i.e. for how long the event loop was blocked). Lag is recorded in the
+ * metrics. If it exceeds RS_STALL_THRESHOLD, a warning naming the longest
+ * request and phase that ran in the meantime is logged.
+ */
+void start_stall_detector(struct event_base *base);
+
+/**
+ * stall_note_phase()
+ *
+ * Called whenever a request phase ends (see request_phase_end()), with
+ * the duration of that instance of the phase.
+ */
+void stall_note_phase(struct rs_request *ctx, enum rs_phase phase, long long ns);
+
+/**
+ * stall_note_request()
+ *
+ * Called when a storage request has been dispatched, with the time the
+ * (synchronous) dispatch took.
+ */
+void stall_note_request(evhtp_request_t *req, struct rs_request *ctx, long long ns);
+
+#endif /* !RS_COMMON_STALL_H */
@@ -12,53 +12,238 @@
 
 #include "rs-serve.h"
 
-#define USER_NOT_FOUND (struct passwd*)-1
+/*
+ * User cache
+ * ----------
+ *
+ * getpwnam_r() can be slow (think LDAP or sssd), so results are cached for
+ * RS_USER_CACHE_TTL seconds. Users that don't exist (or aren't allowed, see
+ * UID_ALLOWED()) are cached as well, for RS_USER_CACHE_NEGATIVE_TTL seconds.
+ * They are kept in a separate cache, so requests for lots of random names
+ * (crawlers, ...) can't push actual users out of the cache.
+ *
+ * Entries are reference counted, so a request can hold on to it's user, even
+ * if the cache replaces the entry in the meantime.
+ */
+
+static struct rs_cache *user_cache = NULL;
+static struct rs_cache *missing_user_cache = NULL;
 
-uid_t user_get_uid(const char *username) {
-  char *bufptr;
-  struct passwd *user_entry = user_get_entry(username, &bufptr);
-  if(user_entry == USER_NOT_FOUND) {
-    return -1; // not found
-  } else if(user_entry == NULL) {
-    return -2; // error occured
-  } else {
-    uid_t uid = user_entry->pw_uid;
-    free(user_entry);
-    free(bufptr);
-    return uid;
+static void free_user(struct rs_user *user) {
+  if(user->root_fd != -1) {
+    close(user->root_fd);
   }
+  if(user->dirs) {
+    free_cache(user->dirs);
+  }
+  if(user->missing) {
+    free_cache(user->missing);
+  }
+  free(user->name);
+  free(user->home_dir);
+  free(user->storage_root);
+  free(user);
 }
 
-struct passwd *user_get_entry(const char *username, char **bufptr) {
-  if(username == NULL) {
-    return USER_NOT_FOUND;
+void user_release(struct rs_user *user) {
+  if(--user->refcount == 0) {
+    free_user(user);
   }
-  int buflen = sysconf(_SC_GETPW_R_SIZE_MAX);
-  char *buf = malloc(buflen);
-  if(buf == NULL) {
+}
+
+static void release_cached_user(void *user) {
+  user_release(user);
+}
+
+void init_user_cache() {
+  user_cache = new_cache(RS_USER_CACHE_SIZE, 0, release_cached_user);
+  missing_user_cache = new_cache(RS_USER_CACHE_NEGATIVE_SIZE, 0, release_cached_user);
+  if(user_cache == NULL || missing_user_cache == NULL) {
+    log_error("Failed to allocate user cache");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void user_cache_get_stats(struct rs_cache_stats *stats) {
+  cache_get_stats(user_cache, stats);
+}
+
+void missing_user_cache_get_stats(struct rs_cache_stats *stats) {
+  cache_get_stats(missing_user_cache, stats);
+}
+
+void cleanup_user_cache() {
+  free_cache(user_cache);
+  free_cache(missing_user_cache);
+  user_cache = NULL;
+  missing_user_cache = NULL;
+}
+
+// calls getpwnam_r() and builds a new user from the result.
+static struct rs_user *fetch_user(const char *username) {
+  struct rs_user *user = malloc(sizeof(struct rs_user));
+  if(user == NULL) {
     log_error("malloc() failed: %s", strerror(errno));
     return NULL;
   }
-  struct passwd *user_entry, *result_ptr;
-  user_entry = malloc(sizeof(struct passwd));
-  if(user_entry == NULL) {
+  memset(user, 0, sizeof(struct rs_user));
+  user->root_fd = -1;
+  user->name = strdup(username);
+  if(user->name == NULL) {
+    log_error("strdup() failed: %s", strerror(errno));
+    free(user);
+    return NULL;
+  }
+  long buflen = sysconf(_SC_GETPW_R_SIZE_MAX);
+  if(buflen < 0) {
+    buflen = 16384;
+  }
+  char *buf = malloc(buflen);
+  if(buf == NULL) {
     log_error("malloc() failed: %s", strerror(errno));
-    free(buf);
+    free_user(user);
     return NULL;
   }
-  int getpwnam_result = getpwnam_r(username, user_entry, buf, buflen, &result_ptr);
+  struct passwd user_entry, *result_ptr;
+  int getpwnam_result = getpwnam_r(username, &user_entry, buf, buflen, &result_ptr);
   if(getpwnam_result != 0) {
     log_error("getpwnam_r() failed: %s", strerror(getpwnam_result));
-    free(user_entry);
     free(buf);
+    free_user(user);
     return NULL;
   }
   if(result_ptr == NULL) {
-    log_error("User not found: %s", username);
-    free(user_entry);
+    log_info("User not found: %s", username);
+    free(buf);
+    return user; // exists = 0
+  }
+  if(! UID_ALLOWED(user_entry.pw_uid)) {
+    log_info("User not allowed: %s (uid: %ld)", username, (long)user_entry.pw_uid);
+    free(buf);
+    return user; // exists = 0
+  }
+  user->exists = 1;
+  user->uid = user_entry.pw_uid;
+  user->gid = user_entry.pw_gid;
+  user->home_dir = strdup(user_entry.pw_dir);
+  size_t home_dir_len = strlen(user_entry.pw_dir);
+  // (don't duplicate the slash for users with "/" as their home directory)
+  if(home_dir_len > 0 && user_entry.pw_dir[home_dir_len - 1] == '/') {
+    home_dir_len--;
+  }
+  user->storage_root_len = home_dir_len + 1 + RS_HOME_SERVE_ROOT_LEN;
+  user->storage_root = malloc(user->storage_root_len + 1);
+  if(user->home_dir == NULL || user->storage_root == NULL) {
+    log_error("malloc() failed: %s", strerror(errno));
     free(buf);
-    return USER_NOT_FOUND;
+    free_user(user);
+    return NULL;
+  }
+  sprintf(user->storage_root, "%.*s/%s", (int)home_dir_len, user_entry.pw_dir,
+          RS_HOME_SERVE_ROOT);
+  free(buf);
+  return user;
+}
+
+struct rs_user *user_lookup(const char *username) {
+  struct rs_user *user = cache_get(missing_user_cache, username);
+  if(user == NULL) {
+    user = cache_get(user_cache, username);
+  }
+  if(user == NULL) {
+    user = fetch_user(username);
+    if(user == NULL) {
+      return NULL;
+    }
+    user->refcount = 1; // owned by cache
+    if(cache_set(user->exists ? user_cache : missing_user_cache, username, user, 0,
+                 time(NULL) + (user->exists ? RS_USER_CACHE_TTL :
+                               RS_USER_CACHE_NEGATIVE_TTL)) != 0) {
+      log_error("Failed to cache user %s", username);
+      return NULL;
+    }
+  }
+  user->refcount++;
+  return user;
+}
+
+int user_storage_root_fd(struct rs_user *user) {
+  if(user->root_fd == -1) {
+    user->root_fd = open(user->storage_root, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if(user->root_fd == -1) {
+      log_error("failed to open() storage root (\"%s\"): %s",
+                user->storage_root, strerror(errno));
+    }
+  }
+  return user->root_fd;
+}
+
+/*
+ * Directory cache
+ * ---------------
+ *
+ * Values carry no information, presence of the key is all that matters.
+ */
+
+static char dir_present = 1;
+
+int user_dir_known(struct rs_user *user, const char *dir_path) {
+  if(user->dirs != NULL && cache_get(user->dirs, dir_path) != NULL) {
+    METRIC_ADD(dir_cache_hits, 1);
+    return 1;
+  }
+  METRIC_ADD(dir_cache_misses, 1);
+  return 0;
+}
+
+void user_dir_remember(struct rs_user *user, const char *dir_path) {
+  if(user->dirs == NULL) {
+    user->dirs = new_cache(RS_DIR_CACHE_SIZE, 0, NULL);
+    if(user->dirs == NULL) {
+      log_error("Failed to allocate directory cache for %s", user->name);
+      return;
+    }
+  }
+  cache_set(user->dirs, dir_path, &dir_present, 0, time(NULL) + RS_DIR_CACHE_TTL);
+}
+
+void user_dir_forget(struct rs_user *user, const char *dir_path) {
+  if(user->dirs) {
+    cache_remove(user->dirs, dir_path);
+  }
+}
+
+/*
+ * Missing path cache
+ * ------------------
+ *
+ * Like the directory cache, but for paths that (recently) didn't exist.
+ */
+
+static char path_absent = 1;
+
+int user_path_missing(struct rs_user *user, const char *path) {
+  if(user->missing != NULL && cache_get(user->missing, path) != NULL) {
+    METRIC_ADD(missing_cache_hits, 1);
+    return 1;
+  }
+  METRIC_ADD(missing_cache_misses, 1);
+  return 0;
+}
+
+void user_path_remember_missing(struct rs_user *user, const char *path) {
+  if(user->missing == NULL) {
+    user->missing = new_cache(RS_MISSING_CACHE_SIZE, 0, NULL);
+    if(user->missing == NULL) {
+      log_error("Failed to allocate missing path cache for %s", user->name);
+      return;
+    }
+  }
+  cache_set(user->missing, path, &path_absent, 0, time(NULL) + RS_MISSING_CACHE_TTL);
+}
+
+void user_paths_changed(struct rs_user *user) {
+  if(user->missing) {
+    cache_clear(user->missing);
   }
-  *bufptr = buf;
-  return user_entry;
 }
@@ -13,7 +13,51 @@
 #ifndef RS_COMMON_USER_H
 #define RS_COMMON_USER_H
 
-uid_t user_get_uid(const char *username);
-struct passwd *user_get_entry(const char *username, char **bufptr);
+// a (cached) system user, as far as rs-serve is concerned.
+struct rs_user {
+  char *name;
+  char exists; // 0 for cached "not found" results
+  uid_t uid;
+  gid_t gid;
+  char *home_dir;
+  char *storage_root;
+  size_t storage_root_len;
+  int root_fd; // O_PATH descriptor of storage_root, see user_storage_root_fd()
+  struct rs_cache *dirs; // directories known to exist, see user_dir_known()
+  struct rs_cache *missing; // paths known not to exist, see user_path_missing()
+  int refcount;
+};
+
+void init_user_cache();
+void cleanup_user_cache();
+void user_cache_get_stats(struct rs_cache_stats *stats);
+void missing_user_cache_get_stats(struct rs_cache_stats *stats);
+
+// returns the user with the given name (with a reference added, release it
+// with user_release()), or NULL if looking up the user failed.
+// Users that don't exist are returned as well, with `exists' set to 0. So are
+// users whose uid isn't allowed (see UID_ALLOWED()).
+struct rs_user *user_lookup(const char *username);
+void user_release(struct rs_user *user);
+
+// returns a (cached) O_PATH descriptor for the user's storage root, or -1 if
+// it can't be opened (errno is set accordingly).
+int user_storage_root_fd(struct rs_user *user);
+
+// Cache of directories (paths relative to the storage root, without trailing
+// slash) that are known to exist, so PUT doesn't have to walk all parents.
+// Entries are only a hint: if opening below a known directory fails with
+// ENOENT, it must be forgotten again.
+int user_dir_known(struct rs_user *user, const char *dir_path);
+void user_dir_remember(struct rs_user *user, const char *dir_path);
+void user_dir_forget(struct rs_user *user, const char *dir_path);
+
+// Cache of (normalized request) paths that were found not to exist, so
+// repeated requests for them are answered without touching the file system.
+// Entries expire after RS_MISSING_CACHE_TTL seconds, user_paths_changed()
+// (called on every write) forgets all of them.
+int user_path_missing(struct rs_user *user, const char *path);
+void user_path_remember_missing(struct rs_user *user, const char *path);
+void user_paths_changed(struct rs_user *user);
 
 #endif /* !RS_COMMON_USER_H */
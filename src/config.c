@@ -22,6 +22,20 @@ static void print_help(const char *progname) {
           "  -p <port> | --port=<port>     - Bind to given port (default: 80).\n"
           "  -n <name> | --hostname=<name> - Set hostname (defaults to local.dev).\n"
           "  -f <file> | --log-file=<file> - Log to given file (defaults to stdout)\n"
+          "  --access-log=<file>           - Write a JSON line describing each storage\n"
+          "                                  request (including timings) to given file.\n"
+          "  --metrics                     - Expose metrics (in Prometheus format) under\n"
+          "                                  /.well-known/rs-serve/metrics\n"
+          "  --stall-threshold=<ms>        - Log a warning when the event loop is blocked\n"
+          "                                  for longer than this (default: 1000, 0 disables).\n"
+          "  --compress-level=<level>      - gzip level (1-9) for compressing text and JSON\n"
+          "                                  responses (default: 6, 0 disables compression).\n"
+          "  --precompress                 - Store compressed variants of text and JSON\n"
+          "                                  documents when they are written, instead of\n"
+          "                                  compressing them for every request.\n"
+          "  --storage-api=<version>       - remoteStorage version to announce via webfinger\n"
+          "                                  (default: " RS_DEFAULT_STORAGE_API ").\n"
+          "                                  Versions before -02 get legacy folder listings.\n"
           "  -d        | --detach          - After starting the server, detach server\n"
           "                                  process and exit. If you don't use this in\n"
           "                                  combination with the --log-file option, all\n"
@@ -65,6 +79,13 @@ char *rs_scheme = "http";
 char *rs_hostname = "local.dev";
 int rs_detach = 0;
 FILE *rs_log_file = NULL;
+FILE *rs_access_log = NULL;
+int rs_metrics_enabled = 0;
+int rs_stall_threshold = 1000;
+int rs_compress_level = 6;
+int rs_precompress = 0;
+char *rs_storage_api = RS_DEFAULT_STORAGE_API;
+int rs_folder_descriptions = 1;
 FILE *rs_pid_file = NULL;
 char *rs_pid_file_path = NULL;
 char *rs_home_serve_root = NULL;
@@ -89,6 +110,12 @@ static struct option long_options[] = {
   { "pid-file", required_argument, 0, 0 },
   { "stop", no_argument, 0, 0 },
   { "log-file", required_argument, 0, 'f' },
+  { "access-log", required_argument, 0, 0 },
+  { "metrics", no_argument, 0, 0 },
+  { "stall-threshold", required_argument, 0, 0 },
+  { "compress-level", required_argument, 0, 0 },
+  { "precompress", no_argument, 0, 0 },
+  { "storage-api", required_argument, 0, 0 },
   { "debug", no_argument, 0, 0 },
   { "detach", no_argument, 0, 'd' },
   { "help", no_argument, 0, 'h' },
@@ -198,6 +225,33 @@ void init_config(int argc, char **argv) {
         rs_ssl_ca_path = optarg;
       } else if(strcmp(arg_name, "no-xattr") == 0) { // --no-xattr
         rs_use_xattr = 0;
+      } else if(strcmp(arg_name, "access-log") == 0) { // --access-log=<file>
+        rs_access_log = fopen(optarg, "a");
+        if(rs_access_log == NULL) {
+          perror("Failed to open access log");
+          exit(EXIT_FAILURE);
+        }
+        setvbuf(rs_access_log, NULL, _IOFBF, RS_ACCESS_LOG_BUFFER_SIZE);
+      } else if(strcmp(arg_name, "metrics") == 0) { // --metrics
+        rs_metrics_enabled = 1;
+      } else if(strcmp(arg_name, "stall-threshold") == 0) { // --stall-threshold=<ms>
+        rs_stall_threshold = atoi(optarg);
+      } else if(strcmp(arg_name, "compress-level") == 0) { // --compress-level=<level>
+        rs_compress_level = atoi(optarg);
+        if(rs_compress_level < 0 || rs_compress_level > 9) {
+          fprintf(stderr, "Invalid compression level: %s (expected 0-9)\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+      } else if(strcmp(arg_name, "precompress") == 0) { // --precompress
+        rs_precompress = 1;
+      } else if(strcmp(arg_name, "storage-api") == 0) { // --storage-api=<version>
+        int version;
+        if(sscanf(optarg, "draft-dejong-remotestorage-%d", &version) != 1) {
+          fprintf(stderr, "Unknown storage API version: %s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        rs_storage_api = optarg;
+        rs_folder_descriptions = version >= 2;
       }
     }
   }
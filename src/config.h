@@ -44,7 +44,16 @@ extern char *rs_scheme;
 #define RS_SCHEME rs_scheme
 extern char *rs_hostname;
 #define RS_HOSTNAME rs_hostname
-#define RS_STORAGE_API "draft-dejong-remotestorage-01"
+// remoteStorage protocol version announced via webfinger. Also decides the
+// format of folder listings (see serve_directory() in handler/storage.c).
+extern char *rs_storage_api;
+#define RS_STORAGE_API rs_storage_api
+#define RS_DEFAULT_STORAGE_API "draft-dejong-remotestorage-02"
+// non-zero if RS_STORAGE_API is draft-dejong-remotestorage-02 or later, which
+// use JSON-LD folder descriptions.
+extern int rs_folder_descriptions;
+#define RS_FOLDER_DESCRIPTIONS rs_folder_descriptions
+#define RS_FOLDER_DESCRIPTION_CONTEXT "http://remotestorage.io/spec/folder-description"
 #define RS_AUTH_METHOD "http://tools.ietf.org/html/rfc6749#section-4.2"
 extern char *rs_auth_uri;
 #define RS_AUTH_URI rs_auth_uri
@@ -58,9 +67,9 @@ extern int rs_webfinger_enabled;
 
 // CORS header values
 #define RS_ALLOW_ORIGIN "*"
-#define RS_ALLOW_HEADERS "Authorization, Content-Type, If-Match, If-None-Match, Origin"
+#define RS_ALLOW_HEADERS "Authorization, Content-Type, If-Match, If-None-Match, If-Modified-Since, If-Unmodified-Since, Range, If-Range, Content-Range, Origin"
 #define RS_ALLOW_METHODS "HEAD, GET, PUT, DELETE"
-#define RS_EXPOSE_HEADERS "Content-Type, Content-Length, ETag"
+#define RS_EXPOSE_HEADERS "Content-Type, Content-Length, Content-Encoding, ETag, Content-Range, Accept-Ranges, Range"
 
 // permissions for newly created files
 #define RS_FILE_CREATE_MODE S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP
@@ -69,6 +78,30 @@ extern int rs_webfinger_enabled;
 extern FILE *rs_log_file;
 #define RS_LOG_FILE rs_log_file
 
+// access log (NULL if disabled) and it's buffer size
+extern FILE *rs_access_log;
+#define RS_ACCESS_LOG rs_access_log
+#define RS_ACCESS_LOG_BUFFER_SIZE (64 * 1024)
+
+// metrics endpoint (see --metrics option)
+extern int rs_metrics_enabled;
+#define RS_METRICS_ENABLED rs_metrics_enabled
+#define RS_METRICS_PATH "/.well-known/rs-serve/metrics"
+
+// event loop lag (in milliseconds) above which a stall is reported (see
+// --stall-threshold option, 0 disables reporting), and how often lag is measured
+extern int rs_stall_threshold;
+#define RS_STALL_THRESHOLD rs_stall_threshold
+#define RS_STALL_CHECK_INTERVAL 100
+
+// log ring buffer (one per thread): size in bytes, maximum length of a single
+// line, maximum number of iovecs per writev() and how often (in milliseconds)
+// the writer thread polls for new lines.
+#define RS_LOG_RING_SIZE (256 * 1024)
+#define RS_LOG_LINE_MAX 2048
+#define RS_LOG_MAX_IOV 64
+#define RS_LOG_FLUSH_INTERVAL 10
+
 // pid file
 extern FILE *rs_pid_file;
 #define RS_PID_FILE rs_pid_file
@@ -89,11 +122,86 @@ extern struct rs_header rs_default_headers;
 
 #define RS_MIN_UID 1000
 
+// user cache: maximum number of entries and how long (in seconds) to
+// remember existing / non-existing users. Non-existing users (including those
+// with a uid below RS_MIN_UID) are kept in a cache of their own, of at most
+// RS_USER_CACHE_NEGATIVE_SIZE entries.
+#define RS_USER_CACHE_SIZE 1024
+#define RS_USER_CACHE_TTL 300
+#define RS_USER_CACHE_NEGATIVE_SIZE 4096
+#define RS_USER_CACHE_NEGATIVE_TTL 30
+
+// directory cache (per user): maximum number of directories remembered to
+// exist, and for how long (in seconds). Directories removed out-of-band are
+// noticed anyway, the TTL only bounds how long stale entries are kept around.
+#define RS_DIR_CACHE_SIZE 256
+#define RS_DIR_CACHE_TTL 60
+
+// missing path cache (per user): maximum number of paths remembered not to
+// exist, and for how long (in seconds). Any PUT by the user forgets them, the
+// TTL bounds how long files created out-of-band are reported missing.
+#define RS_MISSING_CACHE_SIZE 256
+#define RS_MISSING_CACHE_TTL 5
+
+// listing cache: maximum number of serialized folder listings kept, their
+// combined size (in bytes), and the size up to which a single listing is
+// cached at all.
+#define RS_LISTING_CACHE_SIZE 4096
+#define RS_LISTING_CACHE_BYTES (32 * 1024 * 1024)
+#define RS_LISTING_CACHE_MAX_LISTING (1024 * 1024)
+
+// document cache: maximum number of small documents (and compressed variants
+// of them) kept in memory, their combined size (in bytes), and the size up
+// to which a single document is cached.
+#define RS_DOCUMENT_CACHE_SIZE 16384
+#define RS_DOCUMENT_CACHE_BYTES (64 * 1024 * 1024)
+#define RS_DOCUMENT_CACHE_MAX_DOCUMENT (64 * 1024)
+
+// directory listings are generated this many entries at a time. Listings
+// that grow beyond RS_LISTING_CACHE_MAX_LISTING are streamed instead of
+// being buffered, one batch whenever the connection has drained.
+#define RS_LISTING_BATCH_SIZE 256
+
+// maximum number of ranges in a "Range" header. Requests for more are
+// answered with the whole document.
+#define RS_MAX_RANGES 16
+
+// compression of textual responses (see common/compress.h): level from 1
+// (fastest) to 9 (smallest), 0 disables it (see --compress-level option).
+// Documents smaller than RS_COMPRESS_MIN_SIZE aren't worth it. Larger ones
+// are read and compressed RS_COMPRESS_CHUNK_SIZE bytes at a time, whenever
+// the connection has drained.
+extern int rs_compress_level;
+#define RS_COMPRESS_LEVEL rs_compress_level
+#define RS_COMPRESS_MIN_SIZE 256
+#define RS_COMPRESS_CHUNK_SIZE (64 * 1024)
+
+// precompression (see --precompress option): compressible documents of up to
+// RS_PRECOMPRESS_MAX_SIZE bytes get compressed variants when they are
+// written, at RS_PRECOMPRESS_LEVEL. They are kept in this directory below the
+// storage root, which is hidden from clients (like RS_UPLOAD_DIR).
+extern int rs_precompress;
+#define RS_PRECOMPRESS rs_precompress
+#define RS_PRECOMPRESS_DIR ".rs-serve-compressed"
+#define RS_PRECOMPRESS_MAX_SIZE (16 * 1024 * 1024)
+#define RS_PRECOMPRESS_LEVEL 9
+
+// resumable uploads (PUT with "Content-Range") are staged in this directory
+// below the storage root, which is hidden from clients. Uploads that aren't
+// completed are discarded after RS_UPLOAD_TTL seconds.
+#define RS_UPLOAD_DIR ".rs-serve-uploads"
+#define RS_UPLOAD_TTL (24 * 60 * 60)
+
 //#define RS_AUTH_DB_PATH "/var/lib/rs-serve/authorizations"
 //#define RS_META_DB_PATH "/var/lib/rs-serve/meta"
 #define RS_AUTH_DB_PATH "var/authorizations"
 #define RS_META_DB_PATH "var/meta"
 
+// read-only authorization snapshot, published by the token tools.
+#define RS_AUTH_SNAPSHOT_PATH RS_AUTH_DB_PATH "/snapshot"
+// interval (in seconds) in which rs-serve checks for a new snapshot
+#define RS_AUTH_SNAPSHOT_CHECK_INTERVAL 1
+
 extern int rs_use_xattr;
 #define RS_USE_XATTR rs_use_xattr
 
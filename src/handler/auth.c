@@ -14,25 +14,16 @@
 
 #define IS_READ(r) (r->method == htp_method_GET || r->method == htp_method_HEAD)
 
-static int match_scope(struct rs_scope *scope, evhtp_request_t *req) {
-  const char *file_path = REQUEST_GET_PATH(req);
+static int match_scope(struct rs_scope *scope, evhtp_request_t *req, struct rs_request *ctx) {
   log_debug("checking scope, name: %s, write: %d", scope->name, scope->write);
-  int scope_len = strlen(scope->name);
-  // check path
-  if( (strcmp(scope->name, "") == 0) || // root scope
-      ((strncmp(file_path + 1, scope->name, scope_len) == 0) && // other scope
-       file_path[1 + scope_len] == '/') ) {
-    log_debug("path authorized");
-    // check mode
-    if(scope->write || IS_READ(req)) {
-      log_debug("mode authorized");
-      return 0;
-    }
+  if(scope_matches(scope, ctx->path.path, ! IS_READ(req))) {
+    log_debug("scope authorized");
+    return 0;
   }
   return -1;
 }
 
-int authorize_request(evhtp_request_t *req) {
+int authorize_request(evhtp_request_t *req, struct rs_request *ctx) {
   char *username = REQUEST_GET_USER(req);
   const char *auth_header = evhtp_header_find(req->headers_in, "Authorization");
   log_debug("Got auth header: %s", auth_header);
@@ -41,27 +32,38 @@ int authorize_request(evhtp_request_t *req) {
     if(strncmp(auth_header, "Bearer ", 7) == 0) {
       token = auth_header + 7;
       log_debug("Got token: %s", token);
+      struct timespec lookup_start, lookup_end;
+      clock_gettime(CLOCK_MONOTONIC, &lookup_start);
       struct rs_authorization *auth = lookup_authorization(username, token);
+      clock_gettime(CLOCK_MONOTONIC, &lookup_end);
+      metrics_record_auth_lookup((lookup_end.tv_sec - lookup_start.tv_sec) * 1000000000LL +
+                                 (lookup_end.tv_nsec - lookup_start.tv_nsec));
       if(auth == NULL) {
         log_debug("Authorization not found");
       } else {
         log_debug("Got authorization (%p, scopes: %d)", auth, auth->scopes.count);
         struct rs_scope *scope;
-        int i;
+        int i, matched = 0;
         for(i=0;i<auth->scopes.count;i++) {
           scope = auth->scopes.ptr[i];
           log_debug("Compare scope %s", scope->name);
-          if(match_scope(scope, req) == 0) {
-            return 0;
+          if(match_scope(scope, req, ctx) == 0) {
+            matched = 1;
+            break;
           }
         }
+        free_authorization(auth);
+        free(auth);
+        if(matched) {
+          return 0;
+        }
       }
     }
   }
   // special case: public reads on files (not directories) are allowed.
   // nothing else though.
-  if(strncmp(REQUEST_GET_PATH(req), "/public/", 8) == 0 && IS_READ(req) &&
-     req->uri->path->file != NULL) {
+  if(strncmp(ctx->path.path, "/public/", 8) == 0 && IS_READ(req) &&
+     ! ctx->path.is_dir) {
     return 0;
   }
   return -1;
@@ -13,7 +13,7 @@
 #ifndef RS_AUTH_H
 #define RS_AUTH_H
 
-int authorize_request(evhtp_request_t *req);
+int authorize_request(evhtp_request_t *req, struct rs_request *ctx);
 
 #endif /* !RS_AUTH_H */
 
@@ -19,36 +19,62 @@ static void add_cors_headers(evhtp_request_t *req) {
   ADD_RESP_HEADER(req, "Access-Control-Expose-Headers", RS_EXPOSE_HEADERS);
 }
 
-static void verify_user(evhtp_request_t *req) {
+static void verify_user(evhtp_request_t *req, struct rs_request *ctx) {
   char *username = REQUEST_GET_USER(req);
-  uid_t uid = user_get_uid(username);
-  if(uid == -1) {
-    req->status = EVHTP_RES_NOTFOUND;
-  } else if(uid == -2) {
+  struct rs_user *user = user_lookup(username);
+  if(user == NULL) {
     req->status = EVHTP_RES_SERVERR;
-  } else if(! UID_ALLOWED(uid)) {
-    log_info("User not allowed: %s (uid: %ld)", username, uid);
+    return;
+  }
+  ctx->user = user;
+  if(! user->exists) {
+    // (doesn't exist, or isn't allowed. See user_lookup())
     req->status = EVHTP_RES_NOTFOUND;
   } else {
-    log_debug("User found: %s (uid: %ld)", username, uid);
+    log_debug("User found: %s (uid: %ld)", username, user->uid);
   }
 }
 
-void dispatch_storage(evhtp_request_t *req, void *arg) {
+void dispatch_storage(evhtp_request_t *req, struct rs_request *ctx) {
   req->status = 0;
+  ctx->bytes_in = evbuffer_get_length(req->buffer_in);
 
   do {
 
     add_cors_headers(req);
 
+    // normalize path. This rejects "." and ".." segments, so they can't be
+    // used to step out of an authorized scope (such as /contacts/../private/)
+    request_phase_begin(ctx, RS_PHASE_PATH);
+    int normalize_result = path_normalize(REQUEST_GET_PATH(req), &ctx->path);
+    request_phase_end(ctx, RS_PHASE_PATH);
+    if(normalize_result != 0) {
+      log_info("Invalid path: %s (%s)", req->uri->path->full, strerror(errno));
+      req->status = errno == ENAMETOOLONG ? EVHTP_RES_URITOOLONG : 400;
+      break;
+    }
+
+    // staged uploads (and such) live below the storage root, but aren't
+    // part of it.
+    if(ctx->path.segment_count > 0 &&
+       storage_private_name(ctx->path.path + ctx->path.segments[0].offset,
+                            ctx->path.segments[0].len)) {
+      req->status = EVHTP_RES_NOTFOUND;
+      break;
+    }
+
     // validate user
-    verify_user(req);
+    request_phase_begin(ctx, RS_PHASE_USER);
+    verify_user(req, ctx);
+    request_phase_end(ctx, RS_PHASE_USER);
 
     if(req->status) break; // bail
 
     // authorize request
     if(req->method != htp_method_OPTIONS) {
-      int auth_result = authorize_request(req);
+      request_phase_begin(ctx, RS_PHASE_AUTH);
+      int auth_result = authorize_request(req, ctx);
+      request_phase_end(ctx, RS_PHASE_AUTH);
       if(auth_result == 0) {
         log_debug("Request authorized.");
       } else if(auth_result == -1) {
@@ -69,16 +95,16 @@ void dispatch_storage(evhtp_request_t *req, void *arg) {
         req->status = EVHTP_RES_NOCONTENT;
         break;
       case htp_method_GET:
-        req->status = storage_handle_get(req);
+        req->status = storage_handle_get(req, ctx);
         break;
       case htp_method_HEAD:
-        req->status = storage_handle_head(req);
+        req->status = storage_handle_head(req, ctx);
         break;
       case htp_method_PUT:
-        req->status = storage_handle_put(req);
+        req->status = storage_handle_put(req, ctx);
         break;
       case htp_method_DELETE:
-        req->status = storage_handle_delete(req);
+        req->status = storage_handle_delete(req, ctx);
         break;
       default:
         req->status = EVHTP_RES_METHNALLOWED;
@@ -87,8 +113,11 @@ void dispatch_storage(evhtp_request_t *req, void *arg) {
 
   } while(0);
 
-  // send reply, if status was set
-  if(req->status) {
+  stall_note_request(req, ctx, request_elapsed_ns(ctx));
+
+  // send reply, if status was set (and the handler didn't already start it)
+  if(req->status && ! ctx->reply_started) {
+    ctx->bytes_out = evbuffer_get_length(req->buffer_out);
     evhtp_send_reply(req, req->status);
   }
 }
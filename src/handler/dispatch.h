@@ -13,6 +13,6 @@
 #ifndef RS_HANDLER_DISPATCH_H
 #define RS_HANDLER_DISPATCH_H
 
-void dispatch_storage(evhtp_request_t *req, void *arg);
+void dispatch_storage(evhtp_request_t *req, struct rs_request *ctx);
 
 #endif
@@ -0,0 +1,23 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rs-serve.h"
+
+void handle_metrics(evhtp_request_t *req, void *arg) {
+  if(evhtp_request_get_method(req) != htp_method_GET) {
+    evhtp_send_reply(req, EVHTP_RES_METHNALLOWED);
+    return;
+  }
+  write_metrics(req->buffer_out);
+  ADD_RESP_HEADER(req, "Content-Type", "text/plain; version=0.0.4");
+  evhtp_send_reply(req, EVHTP_RES_OK);
+}
@@ -19,173 +19,1116 @@
  * Gets parsed requests and performs the requested actions / sends the requested
  * response.
  *
+ * All files are accessed relative to the user's storage root (see
+ * user_storage_root_fd()), using open_beneath(), so requests can't escape it.
+ *
  */
 
-static char *make_disk_path(char *user, char *path, char **storage_root);
-static evhtp_res serve_directory(evhtp_request_t *request, char *disk_path,
-                                 struct stat *stat_buf);
-static evhtp_res serve_file_head(evhtp_request_t *request_t, char *disk_path,
-                           struct stat *stat_buf,const char *mime_type);
-static evhtp_res serve_file(evhtp_request_t *request, const char *disk_path,
-                      struct stat *stat_buf);
-static evhtp_res handle_get_or_head(evhtp_request_t *request, int include_body);
+static evhtp_res serve_directory(evhtp_request_t *request, struct rs_request *ctx,
+                                 int fd, struct stat *stat_buf);
+static evhtp_res serve_file_head(evhtp_request_t *request_t, struct rs_request *ctx, int fd,
+                                 struct stat *stat_buf,const char *mime_type);
+static evhtp_res serve_file(evhtp_request_t *request, struct rs_request *ctx,
+                            int fd, struct stat *stat_buf);
+static evhtp_res handle_get_or_head(evhtp_request_t *request, struct rs_request *ctx,
+                                    int include_body);
+
+// maps errno of a failed open_beneath() to a response status
+static evhtp_res open_error_status(const char *path) {
+  switch(errno) {
+  case ENOENT:
+  case ENOTDIR:
+    return EVHTP_RES_NOTFOUND;
+  case EXDEV:
+  case ELOOP:
+    log_info("Refusing to follow path outside of storage root: %s", path);
+    return 400;
+  default:
+    log_error("open_beneath() failed for path \"%s\": %s", path, strerror(errno));
+    return EVHTP_RES_SERVERR;
+  }
+}
+
+// returns non-zero if any conditional request header is present
+static int has_preconditions(evhtp_request_t *request) {
+  return (evhtp_header_find(request->headers_in, "If-Match") ||
+          evhtp_header_find(request->headers_in, "If-None-Match") ||
+          evhtp_header_find(request->headers_in, "If-Modified-Since") ||
+          evhtp_header_find(request->headers_in, "If-Unmodified-Since"));
+}
+
+// replaces the response's ETag by the one of the representation with the
+// given content-coding: the etag with "-<coding>" appended (strong validators
+// must differ between codings, see evaluate_preconditions()).
+static void set_coded_etag(evhtp_request_t *request, enum rs_encoding encoding) {
+  evhtp_header_t *header = evhtp_headers_find_header(request->headers_out, "ETag");
+  if(header == NULL || encoding == RS_ENCODING_IDENTITY) {
+    return;
+  }
+  const char *name = encoding_name(encoding);
+  char etag[strlen(header->val) + 1 + strlen(name) + 1];
+  sprintf(etag, "%s-%s", header->val, name);
+  evhtp_header_rm_and_free(request->headers_out, header);
+  ADD_RESP_HEADER_CP(request, "ETag", etag);
+}
+
+// marks the response body as encoded with the given content-coding
+static void set_content_encoding(evhtp_request_t *request, enum rs_encoding encoding) {
+  ADD_RESP_HEADER(request, "Content-Encoding", encoding_name(encoding));
+  set_coded_etag(request, encoding);
+}
+
+// evaluates the conditional request headers (see precondition.h) against the
+// given etag (NULL if the item doesn't exist) and modification time (-1 if
+// unknown). Returns zero, or the status to respond with.
+static evhtp_res check_preconditions(evhtp_request_t *request, const char *etag,
+                                     time_t last_modified) {
+  struct rs_preconditions preconditions = {
+    .if_match = evhtp_header_find(request->headers_in, "If-Match"),
+    .if_none_match = evhtp_header_find(request->headers_in, "If-None-Match"),
+    .if_modified_since = evhtp_header_find(request->headers_in, "If-Modified-Since"),
+    .if_unmodified_since = evhtp_header_find(request->headers_in, "If-Unmodified-Since")
+  };
+  int is_read = (request->method == htp_method_GET ||
+                 request->method == htp_method_HEAD);
+  evhtp_res status = evaluate_preconditions(&preconditions, is_read, etag, last_modified);
+  if(status == 304 && preconditions.if_none_match != NULL) {
+    // (a 304 carries the ETag the client has, which is the coded one if it
+    //  was sent a compressed representation before)
+    enum rs_encoding encoding =
+      negotiate_encoding(evhtp_header_find(request->headers_in, "Accept-Encoding"));
+    if(encoding != RS_ENCODING_IDENTITY) {
+      const char *name = encoding_name(encoding);
+      char coded_etag[strlen(etag) + 1 + strlen(name) + 1];
+      sprintf(coded_etag, "%s-%s", etag, name);
+      if(etag_list_matches(preconditions.if_none_match, coded_etag, 1)) {
+        set_coded_etag(request, encoding);
+      }
+    }
+  }
+  return status;
+}
 
-evhtp_res storage_handle_head(evhtp_request_t *request) {
+evhtp_res storage_handle_head(evhtp_request_t *request, struct rs_request *ctx) {
   if(RS_EXPERIMENTAL) {
-    return handle_get_or_head(request, 0);
+    return handle_get_or_head(request, ctx, 0);
   } else {
     return EVHTP_RES_METHNALLOWED;
   }
 }
 
-evhtp_res storage_handle_get(evhtp_request_t *request) {
+evhtp_res storage_handle_get(evhtp_request_t *request, struct rs_request *ctx) {
   log_debug("storage_handle_get()");
-  return handle_get_or_head(request, 1);
+  return handle_get_or_head(request, ctx, 1);
 }
 
-evhtp_res storage_handle_put(evhtp_request_t *request) {
-  log_debug("HANDLE PUT");
+// walks the parent directories of the requested path, creating missing ones.
+// Returns a descriptor for the immediate parent (which may be root_fd itself),
+// or -1 (setting `status') on failure.
+static int create_parents(evhtp_request_t *request, struct rs_request *ctx,
+                          int root_fd, evhtp_res *status) {
+  char *path = ctx->path.path;
+  uid_t uid = ctx->user->uid;
+  gid_t gid = ctx->user->gid;
+  int dirfd = root_fd;
+  int i, prevfd;
+  char c;
+  struct stat dir_stat;
+  for(i = 0; i < ctx->path.segment_count - 1; i++) {
+    c = path_cut(&ctx->path, i);
+    char *dir_name = path + ctx->path.segments[i].offset;
+    if(fstatat(dirfd, dir_name, &dir_stat, AT_SYMLINK_NOFOLLOW) == 0) {
+      if(! S_ISDIR(dir_stat.st_mode)) {
+        // exists, but not a directory
+        log_error("Can't PUT to %s, found a non-directory parent.", request->uri->path->full);
+        path_uncut(&ctx->path, i, c);
+        if(dirfd != root_fd) close(dirfd);
+        *status = 400;
+        return -1;
+      } else {
+        // directory exists
+      }
+    } else {
+      if(mkdirat(dirfd, dir_name, S_IRWXU | S_IRWXG) != 0) {
+        log_error("mkdirat() failed: %s", strerror(errno));
+        path_uncut(&ctx->path, i, c);
+        if(dirfd != root_fd) close(dirfd);
+        *status = EVHTP_RES_SERVERR;
+        return -1;
+      }
 
-  if(request->uri->path->file == NULL) {
-    // PUT to directories aren't allowed
-    return 400;
+      if(fchownat(dirfd, dir_name, uid, gid, AT_SYMLINK_NOFOLLOW) != 0) {
+        log_warn("failed to chown() newly created directory: %s", strerror(errno));
+      }
+    }
+    prevfd = dirfd;
+    dirfd = open_beneath(prevfd, dir_name, O_PATH | O_DIRECTORY, 0);
+    if(prevfd != root_fd) close(prevfd);
+    if(dirfd == -1) {
+      log_error("failed to open next directory (\"%s\"): %s",
+                dir_name, strerror(errno));
+      path_uncut(&ctx->path, i, c);
+      *status = EVHTP_RES_SERVERR;
+      return -1;
+    }
+    path_uncut(&ctx->path, i, c);
+  }
+
+  return dirfd;
+}
+
+/*
+ * Listing cache
+ * -------------
+ *
+ * Serialized folder listings, keyed by format, user and directory path. Each
+ * entry remembers the etag of the directory it was generated for and is only
+ * served while the directory still has that etag. Writes renew the etags of
+ * all parent directories and drop their listings (see stamp_parents()).
+ */
+
+struct rs_listing {
+  char etag[SHA_DIGEST_LENGTH * 2 + 1];
+  struct evbuffer *body;
+};
+
+static struct rs_cache *listing_cache = NULL;
+
+static void free_listing(void *value) {
+  struct rs_listing *listing = value;
+  evbuffer_free(listing->body);
+  free(listing);
+}
+
+void listing_cache_get_stats(struct rs_cache_stats *stats) {
+  if(listing_cache == NULL) {
+    memset(stats, 0, sizeof(struct rs_cache_stats));
+  } else {
+    cache_get_stats(listing_cache, stats);
+  }
+}
+
+// 'J' for folder descriptions, 'L' for legacy listings, followed by the
+// content-coding of the body. `dir_path' may or may not end with a slash.
+static char *listing_key(struct rs_request *ctx, char format, enum rs_encoding encoding,
+                         const char *dir_path) {
+  size_t len = strlen(dir_path);
+  const char *slash = (len > 0 && dir_path[len - 1] == '/') ? "" : "/";
+  char *key = arena_alloc(&ctx->arena, 2 + strlen(ctx->user->name) + len + 2);
+  if(key != NULL) {
+    sprintf(key, "%c%c%s%s%s", format, '0' + encoding, ctx->user->name, dir_path, slash);
+  }
+  return key;
+}
+
+static void forget_listings(struct rs_request *ctx, const char *dir_path) {
+  if(listing_cache == NULL) {
+    return;
+  }
+  char *key = listing_key(ctx, 'J', RS_ENCODING_IDENTITY, dir_path);
+  if(key) {
+    const char *format;
+    enum rs_encoding encoding;
+    for(format = "JL"; *format; format++) {
+      for(encoding = RS_ENCODING_IDENTITY; encoding <= RS_ENCODING_BROTLI; encoding++) {
+        key[0] = *format;
+        key[1] = '0' + encoding;
+        cache_remove(listing_cache, key);
+      }
+    }
+  }
+}
+
+// returns the cached listing for `key', if it is still current
+static struct rs_listing *find_listing(const char *key, const char *etag) {
+  struct rs_listing *listing = (listing_cache && key) ? cache_get(listing_cache, key) : NULL;
+  if(listing != NULL && strcmp(listing->etag, etag) != 0) {
+    // (stale, the directory's etag was renewed since)
+    cache_remove(listing_cache, key);
+    listing = NULL;
+  }
+  return listing;
+}
+
+// takes ownership of `body'. Listings without a key, or larger than
+// RS_LISTING_CACHE_MAX_LISTING, are freed right away.
+static void remember_listing(const char *key, const char *etag, struct evbuffer *body) {
+  size_t size = evbuffer_get_length(body);
+  if(key == NULL || size > RS_LISTING_CACHE_MAX_LISTING) {
+    evbuffer_free(body);
+    return;
+  }
+  if(listing_cache == NULL) {
+    listing_cache = new_cache(RS_LISTING_CACHE_SIZE, RS_LISTING_CACHE_BYTES, free_listing);
+    if(listing_cache == NULL) {
+      log_error("Failed to allocate listing cache");
+      evbuffer_free(body);
+      return;
+    }
+  }
+  struct rs_listing *listing = malloc(sizeof(struct rs_listing));
+  if(listing == NULL) {
+    log_error("malloc() failed: %s", strerror(errno));
+    evbuffer_free(body);
+    return;
+  }
+  snprintf(listing->etag, sizeof(listing->etag), "%s", etag);
+  listing->body = body;
+  cache_set(listing_cache, key, listing, size, 0);
+}
+
+// renews the etags of all (existing) parent directories of the requested
+// path, up to and including the storage root, after the item itself changed.
+static void stamp_parents(struct rs_request *ctx, int root_fd) {
+  char *path = ctx->path.path;
+  struct rs_arena_mark mark = arena_mark(&ctx->arena);
+  int i, dirfd;
+  char c;
+  request_phase_begin(ctx, RS_PHASE_ETAG);
+  for(i = ctx->path.segment_count - 2; i >= -1; i--) {
+    if(i >= 0) {
+      c = path_cut(&ctx->path, i);
+      forget_listings(ctx, path);
+      dirfd = open_beneath(root_fd, path, O_RDONLY | O_DIRECTORY | O_NONBLOCK, 0);
+      path_uncut(&ctx->path, i, c);
+    } else {
+      forget_listings(ctx, "/");
+      dirfd = open_beneath(root_fd, "/", O_RDONLY | O_DIRECTORY | O_NONBLOCK, 0);
+    }
+    if(dirfd == -1) {
+      if(errno != ENOENT) {
+        log_error("failed to open parent directory of %s: %s", path, strerror(errno));
+      }
+      // (removed along with the item)
+    } else {
+      stamp_etag(dirfd, &ctx->arena);
+      close(dirfd);
+    }
+    arena_reset(&ctx->arena, mark);
+  }
+  request_phase_end(ctx, RS_PHASE_ETAG);
+}
+
+// replaces a response header that was added before (the value isn't copied)
+static void replace_resp_header(evhtp_request_t *request, const char *key, const char *val) {
+  evhtp_header_t *header = evhtp_headers_find_header(request->headers_out, key);
+  if(header != NULL) {
+    evhtp_header_rm_and_free(request->headers_out, header);
+  }
+  ADD_RESP_HEADER(request, key, val);
+}
+
+// adds a field to the "Vary" response header
+static void add_vary(evhtp_request_t *request, struct rs_request *ctx, const char *field) {
+  const char *vary = evhtp_header_find(request->headers_out, "Vary");
+  if(vary == NULL) {
+    ADD_RESP_HEADER(request, "Vary", field);
+    return;
+  }
+  char *merged = arena_alloc(&ctx->arena, strlen(vary) + strlen(field) + 3);
+  if(merged != NULL) {
+    sprintf(merged, "%s, %s", vary, field);
+    replace_resp_header(request, "Vary", merged);
   }
+}
+
+/*
+ * Compression
+ * -----------
+ *
+ * Documents of textual types (see compressible_type()) of at least
+ * RS_COMPRESS_MIN_SIZE bytes, as well as listings, are compressed for
+ * clients that accept it. Such responses carry "Vary: Accept-Encoding"
+ * either way.
+ *
+ * Compressed representations have an ETag of their own, the document's
+ * etag with "-gzip" (or "-br") appended, as strong validators must differ
+ * between content-codings (RFC 7232, section 2.3.3). Preconditions accept
+ * them in place of the document's etag, since they describe the same
+ * contents (clients send them back in "If-Match" when writing). Range
+ * requests are always answered from the uncompressed document.
+ */
+
+// returns non-zero if a response body of the given type and size (-1 if not
+// known yet) is compressed for clients that accept it.
+static int may_compress(const char *content_type, off_t size) {
+  return (RS_COMPRESS_LEVEL > 0 && compressible_type(content_type) &&
+          (size == -1 || size >= RS_COMPRESS_MIN_SIZE));
+}
+
+static enum rs_encoding accepted_encoding(evhtp_request_t *request) {
+  return negotiate_encoding(evhtp_header_find(request->headers_in, "Accept-Encoding"));
+}
 
-  char *storage_root = NULL;
-  char *disk_path = make_disk_path(REQUEST_GET_USER(request),
-                                   REQUEST_GET_PATH(request),
-                                   &storage_root);
-  if(disk_path == NULL) {
+// returns a compressed copy of `body' (which is left untouched), or NULL if
+// compression failed.
+static struct evbuffer *compress_body(struct evbuffer *body, enum rs_encoding encoding) {
+  struct rs_compressor compressor;
+  struct evbuffer *encoded = evbuffer_new();
+  if(encoded == NULL || compressor_init(&compressor, encoding, RS_COMPRESS_LEVEL) != 0) {
+    log_error("failed to set up %s compression", encoding_name(encoding));
+    if(encoded) {
+      evbuffer_free(encoded);
+    }
+    return NULL;
+  }
+  int result = compressor_write_buffer(&compressor, body, encoded, RS_COMPRESS_FINISH);
+  compressor_free(&compressor);
+  if(result != 0) {
+    log_error("%s compression failed", encoding_name(encoding));
+    evbuffer_free(encoded);
+    return NULL;
+  }
+  return encoded;
+}
+
+// compresses the file given by `fd' (of `size' bytes) into `out'.
+// Returns zero on success, -1 on failure.
+static int compress_file(int fd, off_t size, struct evbuffer *out,
+                         enum rs_encoding encoding, int level) {
+  struct rs_compressor compressor;
+  char block[16384];
+  off_t offset = 0;
+  int result = 0;
+  if(compressor_init(&compressor, encoding, level) != 0) {
+    log_error("failed to set up %s compression", encoding_name(encoding));
+    return -1;
+  }
+  for(;;) {
+    ssize_t count = pread(fd, block, sizeof(block), offset);
+    if(count < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      log_error("pread() failed: %s", strerror(errno));
+      result = -1;
+      break;
+    }
+    offset += count;
+    // (the file may have been truncated in the meantime)
+    int finish = count == 0 || offset >= size;
+    if(compressor_write(&compressor, block, count, out,
+                        finish ? RS_COMPRESS_FINISH : RS_COMPRESS_NO_FLUSH) != 0) {
+      log_error("%s compression failed", encoding_name(encoding));
+      result = -1;
+      break;
+    }
+    if(finish) {
+      break;
+    }
+  }
+  compressor_free(&compressor);
+  return result;
+}
+
+/*
+ * Document cache
+ * --------------
+ *
+ * Small documents (up to RS_DOCUMENT_CACHE_MAX_DOCUMENT bytes) are kept in
+ * memory along with their metadata once they have been read or written,
+ * keyed by storage root and path. GET and HEAD requests for them are
+ * answered without touching the file system. Compressed variants are cached
+ * under the same key, prefixed with their content-coding (like listings).
+ *
+ * Like the etags kept in meta attributes, cached documents rely on documents
+ * only being changed through rs-serve: PUT and DELETE drop them (see
+ * forget_document()).
+ */
+
+struct rs_document {
+  char etag[SHA_DIGEST_LENGTH * 2 + 1];
+  char *content_type;
+  time_t last_modified;
+  struct evbuffer *body;
+};
+
+static struct rs_cache *document_cache = NULL;
+
+static void free_document(void *value) {
+  struct rs_document *document = value;
+  evbuffer_free(document->body);
+  free(document->content_type);
+  free(document);
+}
+
+void document_cache_get_stats(struct rs_cache_stats *stats) {
+  if(document_cache == NULL) {
+    memset(stats, 0, sizeof(struct rs_cache_stats));
+  } else {
+    cache_get_stats(document_cache, stats);
+  }
+}
+
+static char *document_key(struct rs_request *ctx, enum rs_encoding encoding) {
+  char *key = arena_alloc(&ctx->arena, 1 + ctx->user->storage_root_len + ctx->path.len + 1);
+  if(key != NULL) {
+    sprintf(key, "%c%s%s", '0' + encoding, ctx->user->storage_root, ctx->path.path);
+  }
+  return key;
+}
+
+static void forget_document(struct rs_request *ctx) {
+  if(document_cache == NULL) {
+    return;
+  }
+  char *key = document_key(ctx, RS_ENCODING_IDENTITY);
+  if(key) {
+    enum rs_encoding encoding;
+    for(encoding = RS_ENCODING_IDENTITY; encoding <= RS_ENCODING_BROTLI; encoding++) {
+      key[0] = '0' + encoding;
+      cache_remove(document_cache, key);
+    }
+  }
+}
+
+// takes ownership of `body'. Returns the cached document, or NULL if it
+// couldn't be cached (`body' is freed in that case).
+static struct rs_document *remember_document(const char *key, const char *etag,
+                                             const char *content_type,
+                                             time_t last_modified, struct evbuffer *body) {
+  if(key == NULL) {
+    evbuffer_free(body);
+    return NULL;
+  }
+  if(document_cache == NULL) {
+    document_cache = new_cache(RS_DOCUMENT_CACHE_SIZE, RS_DOCUMENT_CACHE_BYTES, free_document);
+    if(document_cache == NULL) {
+      log_error("Failed to allocate document cache");
+      evbuffer_free(body);
+      return NULL;
+    }
+  }
+  struct rs_document *document = malloc(sizeof(struct rs_document));
+  if(document == NULL) {
+    log_error("malloc() failed: %s", strerror(errno));
+    evbuffer_free(body);
+    return NULL;
+  }
+  snprintf(document->etag, sizeof(document->etag), "%s", etag);
+  document->content_type = content_type ? strdup(content_type) : NULL;
+  document->last_modified = last_modified;
+  document->body = body;
+  size_t size = evbuffer_get_length(body) + sizeof(struct rs_document);
+  if(cache_set(document_cache, key, document, size, 0) != 0) {
+    return NULL;
+  }
+  return document;
+}
+
+// adds a (cached) body to the response. The chains are shared with the
+// cache, nothing is copied.
+static evhtp_res add_body_reference(evhtp_request_t *request, struct evbuffer *body) {
+  if(evbuffer_add_buffer_reference(request->buffer_out, body) != 0) {
+    log_error("evbuffer_add_buffer_reference() failed");
     return EVHTP_RES_SERVERR;
   }
+  return EVHTP_RES_OK;
+}
 
-  // check if file exists (needed for preconditions and response code)
-  struct stat stat_buf;
-  memset(&stat_buf, 0, sizeof(struct stat));
-  int exists = stat(disk_path, &stat_buf) == 0;
+// returns a copy of `buf' (not sharing it's chains, so the copy can be added
+// to responses by reference itself), or NULL if that fails.
+static struct evbuffer *copy_body(struct evbuffer *buf) {
+  size_t len = evbuffer_get_length(buf);
+  struct evbuffer_iovec vec;
+  struct evbuffer *copy = evbuffer_new();
+  if(copy == NULL || len == 0) {
+    return copy;
+  }
+  if(evbuffer_reserve_space(copy, len, &vec, 1) < 1 ||
+     evbuffer_copyout(buf, vec.iov_base, len) != len) {
+    evbuffer_free(copy);
+    return NULL;
+  }
+  vec.iov_len = len;
+  evbuffer_commit_space(copy, &vec, 1);
+  return copy;
+}
 
-  // check preconditions
-  do {
+// sends the body of a cached document, compressed if the client accepts it
+// (the compressed variant is cached as well).
+static evhtp_res send_document(evhtp_request_t *request, struct rs_request *ctx,
+                               struct rs_document *document) {
+  struct evbuffer *body = document->body;
+  size_t size = evbuffer_get_length(body);
+  enum rs_encoding encoding;
+  if(size >= RS_COMPRESS_MIN_SIZE && may_compress(document->content_type, size) &&
+     (encoding = accepted_encoding(request)) != RS_ENCODING_IDENTITY) {
+    char *key = document_key(ctx, encoding);
+    struct rs_document *variant = key ? cache_get(document_cache, key) : NULL;
+    if(variant == NULL || strcmp(variant->etag, document->etag) != 0) {
+      struct evbuffer *encoded = compress_body(body, encoding);
+      variant = encoded ? remember_document(key, document->etag, NULL, 0, encoded) : NULL;
+    }
+    if(variant != NULL) {
+      body = variant->body;
+      set_content_encoding(request, encoding);
+    }
+  }
+  char *length_string = arena_alloc(&ctx->arena, 24);
+  if(length_string == NULL) {
+    return EVHTP_RES_SERVERR;
+  }
+  snprintf(length_string, 24, "%zu", evbuffer_get_length(body));
+  replace_resp_header(request, "Content-Length", length_string);
+  return add_body_reference(request, body);
+}
 
-    // PUT and DELETE requests MAY have an 'If-Match' request header [HTTP], and
-    // MUST fail with a 412 response code if that doesn't match the document's
-    // current version.
+// answers a GET or HEAD request for a cached document (with the same headers
+// as serve_file_head() would). Returns zero if the document isn't cached.
+static evhtp_res serve_cached_document(evhtp_request_t *request, struct rs_request *ctx,
+                                       int include_body) {
+  if(document_cache == NULL ||
+     // (ranges are served from the file)
+     (include_body && evhtp_header_find(request->headers_in, "Range") != NULL)) {
+    return 0;
+  }
+  char *key = document_key(ctx, RS_ENCODING_IDENTITY);
+  struct rs_document *document = key ? cache_get(document_cache, key) : NULL;
+  if(document == NULL) {
+    return 0;
+  }
+  size_t size = evbuffer_get_length(document->body);
+  char *date_string = arena_alloc(&ctx->arena, RS_HTTP_DATE_LEN);
+  char *length_string = arena_alloc(&ctx->arena, 24);
+  if(date_string == NULL || length_string == NULL) {
+    return 0;
+  }
+  format_http_date(document->last_modified, date_string);
+  snprintf(length_string, 24, "%zu", size);
+
+  // (copied, the document may be evicted before the response is sent)
+  ADD_RESP_HEADER_CP(request, "ETag", document->etag);
+  ADD_RESP_HEADER(request, "Last-Modified", date_string);
+  ADD_RESP_HEADER(request, "Accept-Ranges", "bytes");
+  evhtp_res status = check_preconditions(request, document->etag, document->last_modified);
+  if(status != 0) {
+    return status;
+  }
+  ADD_RESP_HEADER_CP(request, "Content-Type", document->content_type);
+  ADD_RESP_HEADER(request, "Content-Length", length_string);
+  if(may_compress(document->content_type, RS_PRECOMPRESS ? -1 : size)) {
+    add_vary(request, ctx, "Accept-Encoding");
+  }
+  if(! include_body || size == 0) {
+    return EVHTP_RES_OK;
+  }
+  return send_document(request, ctx, document);
+}
 
-    evhtp_header_t *if_match = evhtp_headers_find_header(request->headers_in, "If-Match");
-    if(if_match && ((!exists) || strcmp(get_etag(disk_path), if_match->val) != 0)) {
-      return 412;
+// reads the (small) file given by `fd' into the document cache, using the
+// metadata that serve_file_head() has set on the response.
+static struct rs_document *read_document(evhtp_request_t *request, struct rs_request *ctx,
+                                         int fd, struct stat *stat_buf) {
+  const char *etag = evhtp_header_find(request->headers_out, "ETag");
+  const char *content_type = evhtp_header_find(request->headers_out, "Content-Type");
+  char *key = document_key(ctx, RS_ENCODING_IDENTITY);
+  struct evbuffer *body = evbuffer_new();
+  struct evbuffer_iovec vec;
+  off_t offset = 0;
+  if(body == NULL || etag == NULL || content_type == NULL || key == NULL ||
+     evbuffer_reserve_space(body, stat_buf->st_size, &vec, 1) < 1) {
+    if(body) {
+      evbuffer_free(body);
+    }
+    return NULL;
+  }
+  while(offset < stat_buf->st_size) {
+    ssize_t count = pread(fd, (char*)vec.iov_base + offset, stat_buf->st_size - offset, offset);
+    if(count < 0 && errno == EINTR) {
+      continue;
+    }
+    if(count <= 0) {
+      // (error, or truncated in the meantime)
+      evbuffer_free(body);
+      return NULL;
     }
+    offset += count;
+  }
+  vec.iov_len = offset;
+  evbuffer_commit_space(body, &vec, 1);
+  return remember_document(key, etag, content_type, stat_buf->st_mtime, body);
+}
 
-    // A PUT request MAY have an 'If-None-Match:*' header [HTTP], in which
-    // case it MUST fail with a 412 response code if the document already
-    // exists.
+/*
+ * Private directories
+ * -------------------
+ *
+ * rs-serve keeps some data of it's own below each storage root (see
+ * RS_UPLOAD_DIR and RS_PRECOMPRESS_DIR). Those directories are left out of
+ * listings and can't be accessed by clients. Files in there are named after
+ * the SHA1 sum of the document's path they belong to.
+ */
 
-    evhtp_header_t *if_none_match = evhtp_headers_find_header(request->headers_in, "If-None-Match");
-    if(if_none_match && strcmp(if_none_match->val, "*") == 0 && exists) {
-      return 412;
+int storage_private_name(const char *name, size_t len) {
+  return ((len == strlen(RS_UPLOAD_DIR) && strncmp(name, RS_UPLOAD_DIR, len) == 0) ||
+          (len == strlen(RS_PRECOMPRESS_DIR) && strncmp(name, RS_PRECOMPRESS_DIR, len) == 0));
+}
+
+// opens the private directory with the given name, creating it if `create'
+// is set. Returns -1 (with errno set) if that fails.
+static int open_private_dir(struct rs_request *ctx, int root_fd, const char *name, int create) {
+  if(create) {
+    if(mkdirat(root_fd, name, S_IRWXU) == 0) {
+      if(fchownat(root_fd, name, ctx->user->uid, ctx->user->gid,
+                  AT_SYMLINK_NOFOLLOW) != 0) {
+        log_warn("failed to chown() %s: %s", name, strerror(errno));
+      }
+    } else if(errno != EEXIST) {
+      log_error("mkdirat() failed for %s: %s", name, strerror(errno));
+      return -1;
     }
+  }
+  return open_beneath(root_fd, name, O_RDONLY | O_DIRECTORY, 0);
+}
 
-  } while(0);
+// writes the name of the requested document's files in private directories
+// (hex encoded SHA1 sum of it's path) to `name'.
+static void private_file_name(struct rs_request *ctx, char name[SHA_DIGEST_LENGTH * 2 + 1]) {
+  unsigned char digest[SHA_DIGEST_LENGTH];
+  int i;
+  SHA1((unsigned char*)ctx->path.path, ctx->path.len, digest);
+  for(i = 0; i < SHA_DIGEST_LENGTH; i++) {
+    sprintf(name + i * 2, "%02x", digest[i]);
+  }
+}
 
-  // look up uid and gid of current user, so we can chown() correctly.
-  uid_t uid;
-  gid_t gid;
-  do {
-    char *bufptr = NULL;
-    struct passwd *user_entry = user_get_entry(REQUEST_GET_USER(request), &bufptr);
-    if(user_entry > 0) {
-      uid = user_entry->pw_uid;
-      gid = user_entry->pw_gid;
-      free(user_entry);
-      free(bufptr);
+/*
+ * Precompression
+ * --------------
+ *
+ * With RS_PRECOMPRESS, compressible documents are compressed when they are
+ * written (at RS_PRECOMPRESS_LEVEL, once for each available content-coding).
+ * The compressed variants ("sidecars") are stored in RS_PRECOMPRESS_DIR, as
+ * <name>.gz (and <name>.br). The document's "compressed" meta attribute holds
+ * the etag they were made from, so they are only used while that is current.
+ * They are sent without copying, like uncompressed documents.
+ *
+ * Overwriting or deleting a document removes it's sidecars.
+ */
+
+static const enum rs_encoding sidecar_encodings[] = {
+  RS_ENCODING_GZIP,
+#ifdef RS_BROTLI
+  RS_ENCODING_BROTLI,
+#endif
+};
+#define SIDECAR_ENCODING_COUNT (sizeof(sidecar_encodings) / sizeof(enum rs_encoding))
+
+static void sidecar_name(struct rs_request *ctx, enum rs_encoding encoding,
+                         char name[SHA_DIGEST_LENGTH * 2 + 4]) {
+  private_file_name(ctx, name);
+  strcat(name, encoding == RS_ENCODING_BROTLI ? ".br" : ".gz");
+}
+
+// removes the sidecars of the requested document, which is about to be
+// overwritten or deleted. `fd' is the document, if it is overwritten in place.
+static void forget_sidecars(struct rs_request *ctx, int root_fd, int fd) {
+  char name[SHA_DIGEST_LENGTH * 2 + 4];
+  int i;
+  if(fd != -1) {
+    remove_meta(fd, "compressed");
+  }
+  if(! RS_PRECOMPRESS) {
+    return;
+  }
+  int dir_fd = open_private_dir(ctx, root_fd, RS_PRECOMPRESS_DIR, 0);
+  if(dir_fd == -1) {
+    return;
+  }
+  for(i = 0; i < SIDECAR_ENCODING_COUNT; i++) {
+    sidecar_name(ctx, sidecar_encodings[i], name);
+    if(unlinkat(dir_fd, name, 0) != 0 && errno != ENOENT) {
+      log_warn("failed to remove sidecar %s: %s", name, strerror(errno));
+    }
+  }
+  close(dir_fd);
+}
+
+// writes the sidecars of the document that was just written (given by `fd',
+// with the given etag). Variants that don't turn out smaller are left out.
+static void precompress(struct rs_request *ctx, int root_fd, int fd,
+                        const char *content_type, const char *etag) {
+  char name[SHA_DIGEST_LENGTH * 2 + 4];
+  struct stat stat_buf;
+  int i, written = 0;
+  if(! RS_PRECOMPRESS || ! compressible_type(content_type) ||
+     fstat(fd, &stat_buf) != 0 || stat_buf.st_size < RS_COMPRESS_MIN_SIZE ||
+     stat_buf.st_size > RS_PRECOMPRESS_MAX_SIZE) {
+    return;
+  }
+  int dir_fd = open_private_dir(ctx, root_fd, RS_PRECOMPRESS_DIR, 1);
+  struct evbuffer *buf = dir_fd == -1 ? NULL : evbuffer_new();
+  if(buf == NULL) {
+    if(dir_fd != -1) {
+      close(dir_fd);
+    }
+    return;
+  }
+  request_phase_begin(ctx, RS_PHASE_BODY);
+  for(i = 0; i < SIDECAR_ENCODING_COUNT; i++) {
+    enum rs_encoding encoding = sidecar_encodings[i];
+    sidecar_name(ctx, encoding, name);
+    evbuffer_drain(buf, evbuffer_get_length(buf));
+    if(compress_file(fd, stat_buf.st_size, buf, encoding, RS_PRECOMPRESS_LEVEL) != 0 ||
+       evbuffer_get_length(buf) >= stat_buf.st_size) {
+      unlinkat(dir_fd, name, 0);
+      continue;
+    }
+    int sidecar_fd = openat(dir_fd, name, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+                            RS_FILE_CREATE_MODE);
+    if(sidecar_fd == -1) {
+      log_error("failed to open sidecar %s: %s", name, strerror(errno));
+      continue;
+    }
+    if(fchown(sidecar_fd, ctx->user->uid, ctx->user->gid) != 0) {
+      log_warn("Failed to chown() sidecar: %s", strerror(errno));
+    }
+    int result = 0;
+    while(result >= 0 && evbuffer_get_length(buf) > 0) {
+      result = evbuffer_write(buf, sidecar_fd);
+    }
+    close(sidecar_fd);
+    if(result < 0) {
+      log_error("failed to write sidecar %s: %s", name, strerror(errno));
+      unlinkat(dir_fd, name, 0);
     } else {
-      return EVHTP_RES_SERVERR;
+      written++;
     }
-  } while(0);
+  }
+  request_phase_end(ctx, RS_PHASE_BODY);
+  evbuffer_free(buf);
+  close(dir_fd);
+  if(written > 0) {
+    set_meta(fd, "compressed", etag, strlen(etag));
+  }
+}
 
-  // create parent directories
-  do {
+/*
+ * Resumable uploads
+ * -----------------
+ *
+ * A PUT with a "Content-Range: bytes <first>-<last>/<total>" header uploads
+ * a part of a document. Parts are written to a staging file in RS_UPLOAD_DIR
+ * (a private directory, see above), which is moved into
+ * place once all <total> bytes have arrived. Until then, requests are
+ * answered with 308 and a "Range: bytes=0-<n>" header telling how much has
+ * been received so far. That's also the answer to a request with an empty
+ * body and "*" in place of the range (only giving the total), so clients
+ * can ask where to resume.
+ *
+ * A part must start within the data received so far, a part starting at
+ * zero restarts the upload.
+ */
 
-    char *path_copy = strdup(REQUEST_GET_PATH(request));
-    if(path_copy == NULL) {
-      log_error("strdup() failed: %s", strerror(errno));
-      free(disk_path);
-      free(storage_root);
-      return EVHTP_RES_SERVERR;
+// removes uploads that haven't been touched for RS_UPLOAD_TTL seconds
+static void expire_uploads(int upload_dir_fd) {
+  int dir_fd = openat(upload_dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  DIR *dir = dir_fd == -1 ? NULL : fdopendir(dir_fd);
+  if(dir == NULL) {
+    if(dir_fd != -1) {
+      close(dir_fd);
     }
-    char *dir_path = dirname(path_copy);
-    if(strcmp(dir_path, ".") == 0) { // PUT to file below root directory
+    return;
+  }
+  time_t now = time(NULL);
+  struct dirent *entryp;
+  struct stat stat_buf;
+  while((entryp = readdir(dir)) != NULL) {
+    if(entryp->d_type == DT_DIR) {
       continue;
     }
-    char *saveptr = NULL;
-    char *dir_name;
-    int dirfd = open(storage_root, O_RDONLY), prevfd;
-    if(dirfd == -1) {
-      log_error("failed to open() storage path (\"%s\"): %s", storage_root, strerror(errno));
-      free(disk_path);
-      free(path_copy);
-      free(storage_root);
+    if(fstatat(dir_fd, entryp->d_name, &stat_buf, AT_SYMLINK_NOFOLLOW) == 0 &&
+       S_ISREG(stat_buf.st_mode) && now - stat_buf.st_mtime > RS_UPLOAD_TTL) {
+      log_debug("discarding stale upload %s", entryp->d_name);
+      unlinkat(dir_fd, entryp->d_name, 0);
+    }
+  }
+  closedir(dir);
+}
+
+static evhtp_res upload_progress(evhtp_request_t *request, struct rs_request *ctx,
+                                 off_t received) {
+  if(received > 0) {
+    char *range = arena_alloc(&ctx->arena, 32);
+    if(range == NULL) {
       return EVHTP_RES_SERVERR;
     }
-    struct stat dir_stat;
-    log_debug("strtok_r(\"%s\", ...), (dir_path: %p, saveptr: %p)", dir_path, dir_path, saveptr);
-    for(dir_name = strtok_r(dir_path, "/", &saveptr);
-        dir_name != NULL;
-        dir_name = strtok_r(NULL, "/", &saveptr)) {
-      if(fstatat(dirfd, dir_name, &dir_stat, 0) == 0) {
-        if(! S_ISDIR(dir_stat.st_mode)) {
-          // exists, but not a directory
-          log_error("Can't PUT to %s, found a non-directory parent.", request->uri->path->full);
-          close(dirfd);
-          free(disk_path);
-          free(path_copy);
-          free(storage_root);
-          return 400;
-        } else {
-          // directory exists
-        }
-      } else {
-        if(mkdirat(dirfd, dir_name, S_IRWXU | S_IRWXG) != 0) {
-          log_error("mkdirat() failed: %s", strerror(errno));
-          close(dirfd);
-          free(disk_path);
-          free(path_copy);
-          free(storage_root);
-          return EVHTP_RES_SERVERR;
-        }
+    snprintf(range, 32, "bytes=0-%lld", (long long)received - 1);
+    ADD_RESP_HEADER(request, "Range", range);
+  }
+  return 308;
+}
 
-        if(fchownat(dirfd, dir_name, uid, gid, AT_SYMLINK_NOFOLLOW) != 0) {
-          log_warn("failed to chown() newly created directory: %s", strerror(errno));
-        }
-      }
-      prevfd = dirfd;
-      dirfd = openat(prevfd, dir_name, O_RDONLY);
-      close(prevfd);
-      if(dirfd == -1) {
-        log_error("failed to openat() next directory (\"%s\"): %s",
-                  dir_name, strerror(errno));
-        free(disk_path);
-        free(path_copy);
-        free(storage_root);
-        return EVHTP_RES_SERVERR;
+static evhtp_res handle_partial_put(evhtp_request_t *request, struct rs_request *ctx,
+                                    int root_fd, const char *content_range, int exists) {
+  off_t first, last, total;
+  if(parse_content_range(content_range, &first, &last, &total) != 0 || total == -1) {
+    return 400;
+  }
+  size_t body_len = evbuffer_get_length(request->buffer_in);
+  if(first == -1 ? body_len != 0 : body_len != last - first + 1) {
+    return 400;
+  }
+
+  char name[SHA_DIGEST_LENGTH * 2 + 1];
+  private_file_name(ctx, name);
+
+  request_phase_begin(ctx, RS_PHASE_PATH);
+  int upload_dir_fd = open_private_dir(ctx, root_fd, RS_UPLOAD_DIR, 1);
+  if(upload_dir_fd == -1) {
+    log_error("failed to open upload directory: %s", strerror(errno));
+    request_phase_end(ctx, RS_PHASE_PATH);
+    return EVHTP_RES_SERVERR;
+  }
+  if(first == 0) {
+    expire_uploads(upload_dir_fd);
+  }
+  int fd = openat(upload_dir_fd, name, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC,
+                  RS_FILE_CREATE_MODE);
+  request_phase_end(ctx, RS_PHASE_PATH);
+  struct stat stat_buf;
+  if(fd == -1 || fstat(fd, &stat_buf) != 0) {
+    log_error("failed to open staged upload %s: %s", name, strerror(errno));
+    if(fd != -1) close(fd);
+    close(upload_dir_fd);
+    return EVHTP_RES_SERVERR;
+  }
+  if(fchown(fd, ctx->user->uid, ctx->user->gid) != 0) {
+    log_warn("Failed to chown() staged upload: %s", strerror(errno));
+  }
+
+  // an upload of a different size (or one restarted from zero) replaces
+  // what was staged before.
+  off_t received = stat_buf.st_size;
+  char total_string[24];
+  snprintf(total_string, sizeof(total_string), "%lld", (long long)total);
+  char *staged_total = get_meta(fd, "upload_total", sizeof(total_string), &ctx->arena);
+  if(first == 0 || staged_total == NULL || strcmp(staged_total, total_string) != 0) {
+    received = 0;
+  }
+
+  evhtp_res status = 0;
+  if(first == -1 || first > received) {
+    // (only asking for / behind on the progress)
+    status = upload_progress(request, ctx, received);
+  } else if(ftruncate(fd, first) != 0 || lseek(fd, first, SEEK_SET) != first) {
+    log_error("failed to truncate staged upload: %s", strerror(errno));
+    status = EVHTP_RES_SERVERR;
+  } else if(first == 0 && set_meta(fd, "upload_total", total_string, strlen(total_string) + 1) != 0) {
+    status = EVHTP_RES_SERVERR;
+  }
+  if(status != 0) {
+    close(fd);
+    close(upload_dir_fd);
+    return status;
+  }
+
+  request_phase_begin(ctx, RS_PHASE_BODY);
+  while(evbuffer_get_length(request->buffer_in) > 0) {
+    if(evbuffer_write(request->buffer_in, fd) < 0) {
+      log_error("write() failed: %s", strerror(errno));
+      request_phase_end(ctx, RS_PHASE_BODY);
+      close(fd);
+      close(upload_dir_fd);
+      return EVHTP_RES_SERVERR;
+    }
+  }
+  request_phase_end(ctx, RS_PHASE_BODY);
+  received = last + 1;
+
+  request_phase_begin(ctx, RS_PHASE_CONTENT_TYPE);
+  const char *content_type = evhtp_header_find(request->headers_in, "Content-Type");
+  if(content_type != NULL) {
+    content_type_to_xattr(fd, content_type, &ctx->arena);
+  }
+  request_phase_end(ctx, RS_PHASE_CONTENT_TYPE);
+
+  if(received < total) {
+    close(fd);
+    close(upload_dir_fd);
+    return upload_progress(request, ctx, received);
+  }
+
+  // complete: move it into place.
+  remove_meta(fd, "upload_total");
+  if(exists) {
+    forget_sidecars(ctx, root_fd, -1);
+    forget_document(ctx);
+  }
+  content_type = content_type_from_xattr(fd, &ctx->arena);
+  if(content_type == NULL) {
+    content_type = "application/octet-stream; charset=binary";
+    content_type_to_xattr(fd, content_type, &ctx->arena);
+  }
+
+  request_phase_begin(ctx, RS_PHASE_PATH);
+  int parent_index = ctx->path.segment_count - 2;
+  int dirfd = create_parents(request, ctx, root_fd, &status);
+  if(dirfd != -1) {
+    if(renameat(upload_dir_fd, name, dirfd, path_basename(&ctx->path)) != 0) {
+      log_error("renameat() failed for staged upload %s: %s", name, strerror(errno));
+      status = EVHTP_RES_SERVERR;
+    }
+    if(dirfd != root_fd) close(dirfd);
+  }
+  close(upload_dir_fd);
+  if(dirfd == -1 || status != 0) {
+    request_phase_end(ctx, RS_PHASE_PATH);
+    close(fd);
+    return status;
+  }
+  if(parent_index >= 0) {
+    char c = path_cut(&ctx->path, parent_index);
+    user_dir_remember(ctx->user, ctx->path.path);
+    path_uncut(&ctx->path, parent_index, c);
+  }
+  request_phase_end(ctx, RS_PHASE_PATH);
+
+  request_phase_begin(ctx, RS_PHASE_ETAG);
+  char *etag_string = get_etag(fd, &ctx->arena);
+  request_phase_end(ctx, RS_PHASE_ETAG);
+  if(etag_string == NULL) {
+    close(fd);
+    return EVHTP_RES_SERVERR;
+  }
+  precompress(ctx, root_fd, fd, content_type, etag_string);
+  close(fd);
+
+  stamp_parents(ctx, root_fd);
+
+  ADD_RESP_HEADER(request, "Content-Type", content_type);
+  ADD_RESP_HEADER(request, "ETag", etag_string);
+
+  return exists ? EVHTP_RES_OK : EVHTP_RES_CREATED;
+}
+
+evhtp_res storage_handle_put(evhtp_request_t *request, struct rs_request *ctx) {
+  log_debug("HANDLE PUT");
+
+  if(ctx->path.is_dir) {
+    // PUT to directories aren't allowed
+    return 400;
+  }
+
+  // (the document, and possibly it's parents, are about to exist)
+  user_paths_changed(ctx->user);
+
+  int root_fd = user_storage_root_fd(ctx->user);
+  if(root_fd == -1) {
+    return EVHTP_RES_SERVERR;
+  }
+
+  char *path = ctx->path.path;
+
+  // check if file exists (needed for preconditions and response code)
+  struct stat stat_buf;
+  memset(&stat_buf, 0, sizeof(struct stat));
+  request_phase_begin(ctx, RS_PHASE_PATH);
+  int fd = open_beneath(root_fd, path, O_RDONLY | O_NONBLOCK, 0);
+  request_phase_end(ctx, RS_PHASE_PATH);
+  int exists = fd != -1;
+  if(! exists && errno != ENOENT && errno != ENOTDIR) {
+    return open_error_status(path);
+  }
+
+  request_phase_begin(ctx, RS_PHASE_STAT);
+  int stat_result = exists ? fstat(fd, &stat_buf) : 0;
+  request_phase_end(ctx, RS_PHASE_STAT);
+  if(exists && (stat_result != 0 || S_ISDIR(stat_buf.st_mode))) {
+    // can't PUT to a directory
+    close(fd);
+    return 400;
+  }
+
+  // check preconditions
+
+  // PUT and DELETE requests MAY have an 'If-Match' request header [HTTP], and
+  // MUST fail with a 412 response code if that doesn't match the document's
+  // current version.
+  // A PUT request MAY have an 'If-None-Match:*' header [HTTP], in which
+  // case it MUST fail with a 412 response code if the document already
+  // exists.
+
+  if(has_preconditions(request)) {
+    request_phase_begin(ctx, RS_PHASE_ETAG);
+    char *etag_string = exists ? get_etag(fd, &ctx->arena) : NULL;
+    request_phase_end(ctx, RS_PHASE_ETAG);
+    evhtp_res status = (exists && etag_string == NULL) ? EVHTP_RES_SERVERR :
+      check_preconditions(request, etag_string, exists ? stat_buf.st_mtime : -1);
+    if(status != 0) {
+      if(exists) {
+        close(fd);
       }
+      return status;
+    }
+  }
+
+  if(exists) {
+    close(fd);
+  }
+
+  const char *content_range = evhtp_header_find(request->headers_in, "Content-Range");
+  if(content_range != NULL) {
+    return handle_partial_put(request, ctx, root_fd, content_range, exists);
+  }
+
+  // uid and gid of current user, so we can chown() correctly.
+  uid_t uid = ctx->user->uid;
+  gid_t gid = ctx->user->gid;
+
+  // open (and possibly create) file.
+  // If the parent directory is known to exist (because the file itself does,
+  // or because we've seen it before) the file is opened directly. Otherwise
+  // (or if the directory went away in the meantime) the parents are walked,
+  // creating the missing ones.
+  int flags = O_NONBLOCK | O_CREAT | O_RDWR | O_TRUNC;
+  int parent_index = ctx->path.segment_count - 2;
+  int parent_known = exists || parent_index < 0;
+  char c;
+  if(! parent_known) {
+    c = path_cut(&ctx->path, parent_index);
+    parent_known = user_dir_known(ctx->user, path);
+    path_uncut(&ctx->path, parent_index, c);
+  }
+  request_phase_begin(ctx, RS_PHASE_PATH);
+  fd = -1;
+  if(parent_known) {
+    fd = open_beneath(root_fd, path, flags, RS_FILE_CREATE_MODE);
+    if(fd == -1 && (errno == ENOENT || errno == ENOTDIR) && parent_index >= 0) {
+      log_debug("parent directory of %s disappeared", path);
+      c = path_cut(&ctx->path, parent_index);
+      user_dir_forget(ctx->user, path);
+      path_uncut(&ctx->path, parent_index, c);
+    } else if(fd == -1) {
+      log_error("failed to open file \"%s\": %s", path, strerror(errno));
+      request_phase_end(ctx, RS_PHASE_PATH);
+      return EVHTP_RES_SERVERR;
+    }
+  }
+  if(fd == -1) {
+    evhtp_res status;
+    int dirfd = create_parents(request, ctx, root_fd, &status);
+    if(dirfd == -1) {
+      request_phase_end(ctx, RS_PHASE_PATH);
+      return status;
     }
+    fd = open_beneath(dirfd, path_basename(&ctx->path), flags, RS_FILE_CREATE_MODE);
+    if(dirfd != root_fd) close(dirfd);
 
-    free(path_copy);
-    free(storage_root);
-    close(dirfd);
-
-  } while(0);
-
-  // open (and possibly create) file
-  int fd = open(disk_path, O_NONBLOCK | O_CREAT | O_WRONLY | O_TRUNC,
-                RS_FILE_CREATE_MODE);
+    if(fd == -1) {
+      log_error("failed to open file \"%s\": %s", path, strerror(errno));
+      request_phase_end(ctx, RS_PHASE_PATH);
+      return EVHTP_RES_SERVERR;
+    }
 
-  if(fd == -1) {
-    log_error("open() failed to open file \"%s\": %s", disk_path, strerror(errno));
-    free(disk_path);
-    return EVHTP_RES_SERVERR;
+    if(parent_index >= 0) {
+      c = path_cut(&ctx->path, parent_index);
+      user_dir_remember(ctx->user, path);
+      path_uncut(&ctx->path, parent_index, c);
+    }
   }
+  request_phase_end(ctx, RS_PHASE_PATH);
 
   if(! exists) {
     if(fchown(fd, uid, gid) != 0) {
@@ -193,9 +1136,29 @@ evhtp_res storage_handle_put(evhtp_request_t *request) {
     }
   }
 
+  // small documents go to the document cache as well (the request body is
+  // drained by writing it).
+  forget_document(ctx);
+  struct evbuffer *body = NULL;
+  if(evbuffer_get_length(request->buffer_in) <= RS_DOCUMENT_CACHE_MAX_DOCUMENT) {
+    body = copy_body(request->buffer_in);
+  }
+
   // write buffered data
   // TODO: open (and write) file earlier in the request, so it doesn't have to be buffered completely.
-  evbuffer_write(request->buffer_in, fd);
+  request_phase_begin(ctx, RS_PHASE_BODY);
+  while(evbuffer_get_length(request->buffer_in) > 0) {
+    if(evbuffer_write(request->buffer_in, fd) < 0) {
+      log_error("write() failed: %s", strerror(errno));
+      request_phase_end(ctx, RS_PHASE_BODY);
+      close(fd);
+      if(body) {
+        evbuffer_free(body);
+      }
+      return EVHTP_RES_SERVERR;
+    }
+  }
+  request_phase_end(ctx, RS_PHASE_BODY);
 
   char *content_type = "application/octet-stream; charset=binary";
   evhtp_kv_t *content_type_header = evhtp_headers_find_header(request->headers_in, "Content-Type");
@@ -203,201 +1166,536 @@ evhtp_res storage_handle_put(evhtp_request_t *request) {
   if(content_type_header != NULL) {
     content_type = content_type_header->val;
   }
-  
+
   // remember content type in extended attributes
-  if(content_type_to_xattr(disk_path, content_type) != 0) {
+  request_phase_begin(ctx, RS_PHASE_CONTENT_TYPE);
+  if(content_type_to_xattr(fd, content_type, &ctx->arena) != 0) {
     log_error("Setting xattr for content type failed. Ignoring.");
   }
+  // (report and cache the content type the way a later GET reads it back,
+  //  e.g. with the guessed charset added)
+  char *stored_content_type = content_type_from_xattr(fd, &ctx->arena);
+  if(stored_content_type != NULL) {
+    content_type = stored_content_type;
+  }
+  request_phase_end(ctx, RS_PHASE_CONTENT_TYPE);
+
+  // (the cached etag, and the sidecars, describe the old contents)
+  if(exists) {
+    forget_sidecars(ctx, root_fd, fd);
+  }
+  request_phase_begin(ctx, RS_PHASE_ETAG);
+  char *etag_string = NULL;
+  if(! exists || clear_etag(fd) == 0) {
+    etag_string = get_etag(fd, &ctx->arena);
+  }
+  request_phase_end(ctx, RS_PHASE_ETAG);
+
+  if(etag_string != NULL) {
+    precompress(ctx, root_fd, fd, content_type, etag_string);
+  }
+
+  if(body != NULL) {
+    if(etag_string != NULL && fstat(fd, &stat_buf) == 0) {
+      remember_document(document_key(ctx, RS_ENCODING_IDENTITY), etag_string,
+                        content_type, stat_buf.st_mtime, body);
+    } else {
+      evbuffer_free(body);
+    }
+  }
 
   close(fd);
 
-  // stat created file again to generate new etag
-  memset(&stat_buf, 0, sizeof(struct stat));
-  if(stat(disk_path, &stat_buf) != 0) {
-    log_error("failed to stat() file after writing: %s", strerror(errno));
-    free(disk_path);
+  if(etag_string == NULL) {
     return EVHTP_RES_SERVERR;
   }
 
-  char *etag_string = get_etag(disk_path);
+  stamp_parents(ctx, root_fd);
 
   ADD_RESP_HEADER_CP(request, "Content-Type", content_type);
-  ADD_RESP_HEADER_CP(request, "ETag", etag_string);
-
-  free(etag_string);
-  free(disk_path);
+  ADD_RESP_HEADER(request, "ETag", etag_string);
 
   return exists ? EVHTP_RES_OK : EVHTP_RES_CREATED;
 }
 
-evhtp_res storage_handle_delete(evhtp_request_t *request) {
+evhtp_res storage_handle_delete(evhtp_request_t *request, struct rs_request *ctx) {
 
-  if(request->uri->path->file == NULL) {
+  if(ctx->path.is_dir) {
     // DELETE to directories aren't allowed
     return 400;
   }
 
-  char *storage_root = NULL;
-  char *disk_path = make_disk_path(REQUEST_GET_USER(request),
-                                   REQUEST_GET_PATH(request),
-                                   &storage_root);
-  if(disk_path == NULL) {
-    return EVHTP_RES_SERVERR;
+  if(user_path_missing(ctx->user, ctx->path.path)) {
+    return EVHTP_RES_NOTFOUND;
   }
 
-  struct stat stat_buf;
-  if(stat(disk_path, &stat_buf) == 0) {
+  int root_fd = user_storage_root_fd(ctx->user);
+  if(root_fd == -1) {
+    return errno == ENOENT ? EVHTP_RES_NOTFOUND : EVHTP_RES_SERVERR;
+  }
 
-    if(S_ISDIR(stat_buf.st_mode)) {
-      return 400;
-    }
+  char *path = ctx->path.path;
 
-    char *etag_string = get_etag(disk_path);
+  request_phase_begin(ctx, RS_PHASE_PATH);
+  int fd = open_beneath(root_fd, path, O_RDONLY | O_NONBLOCK, 0);
+  request_phase_end(ctx, RS_PHASE_PATH);
+  if(fd == -1) {
+    // file doesn't exist, return 404.
+    return open_error_status(path);
+  }
 
-    evhtp_header_t *if_match = evhtp_headers_find_header(request->headers_in, "If-Match");
-    if(if_match && (strcmp(etag_string, if_match->val) != 0)) {
-      return 412;
-    }
+  struct stat stat_buf;
+  request_phase_begin(ctx, RS_PHASE_STAT);
+  int stat_result = fstat(fd, &stat_buf);
+  request_phase_end(ctx, RS_PHASE_STAT);
+  if(stat_result != 0 || S_ISDIR(stat_buf.st_mode)) {
+    close(fd);
+    return 400;
+  }
 
-    ADD_RESP_HEADER_CP(request, "ETag", etag_string);
+  request_phase_begin(ctx, RS_PHASE_ETAG);
+  char *etag_string = get_etag(fd, &ctx->arena);
+  request_phase_end(ctx, RS_PHASE_ETAG);
+  close(fd);
+  if(etag_string == NULL) {
+    return EVHTP_RES_SERVERR;
+  }
 
-    // file exists, delete it.
-    if(unlink(disk_path) == -1) {
-      log_error("unlink() failed: %s", strerror(errno));
-      return EVHTP_RES_SERVERR;
-    }
-    
-    /* 
-     * remove empty parents
-     */
-    char *path_copy = strdup(REQUEST_GET_PATH(request));
-    if(path_copy == NULL) {
-      log_error("strdup() failed to copy path: %s", strerror(errno));
-      free(disk_path);
-      return EVHTP_RES_SERVERR;
-    }
-    char *dir_path;
-    int rootdirfd = open(storage_root, O_RDONLY);
-    if(rootdirfd == -1) {
-      log_error("failed to open() storage root: %s", strerror(errno));
-      free(path_copy);
-      free(disk_path);
-      return EVHTP_RES_SERVERR;
+  evhtp_res precondition_status = check_preconditions(request, etag_string, stat_buf.st_mtime);
+  if(precondition_status != 0) {
+    return precondition_status;
+  }
+
+  ADD_RESP_HEADER(request, "ETag", etag_string);
+
+  // file exists, delete it.
+  request_phase_begin(ctx, RS_PHASE_BODY);
+  int unlink_result = unlink_beneath(root_fd, path, 0);
+  request_phase_end(ctx, RS_PHASE_BODY);
+  if(unlink_result == -1) {
+    log_error("unlink() failed: %s", strerror(errno));
+    return EVHTP_RES_SERVERR;
+  }
+  forget_sidecars(ctx, root_fd, -1);
+  forget_document(ctx);
+
+  /*
+   * remove empty parents
+   */
+  int i;
+  request_phase_begin(ctx, RS_PHASE_BODY);
+  for(i = ctx->path.segment_count - 2; i >= 0; i--) {
+    char c = path_cut(&ctx->path, i);
+    log_debug("unlinking %s (relative to %s)", path, ctx->user->storage_root);
+    int result = unlink_beneath(root_fd, path, AT_REMOVEDIR);
+    if(result == 0) {
+      user_dir_forget(ctx->user, path);
     }
-    int result;
-    // skip leading slash
-    char *relative_path = path_copy + 1;
-    for(dir_path = dirname(relative_path);
-        ! (dir_path[0] == '.' && dir_path[1] == 0); // reached root
-        dir_path = dirname(dir_path)) {
-      log_debug("unlinking %s (relative to %s)", dir_path, storage_root);
-      result = unlinkat(rootdirfd, dir_path, AT_REMOVEDIR);
-      if(result != 0) {
-        if(errno == ENOTEMPTY || errno == EEXIST) {
-          // non-empty directory reached
-          break;
-        } else {
-          // other error occured
-          log_error("(while trying to remove %s)\n", dir_path);
-          log_error("unlinkat() failed to remove parent directory: %s", strerror(errno));
-          free(path_copy);
-          free(disk_path);
-          return EVHTP_RES_SERVERR;
-        }
+    path_uncut(&ctx->path, i, c);
+    if(result != 0) {
+      if(errno == ENOTEMPTY || errno == EEXIST) {
+        // non-empty directory reached
+        break;
+      } else {
+        // other error occured
+        log_error("(while trying to remove parents of %s)\n", path);
+        log_error("unlinkat() failed to remove parent directory: %s", strerror(errno));
+        request_phase_end(ctx, RS_PHASE_BODY);
+        return EVHTP_RES_SERVERR;
       }
     }
-    close(rootdirfd);
-    free(path_copy);
-  } else {
-    // file doesn't exist, return 404.
-    return 404;
   }
+  request_phase_end(ctx, RS_PHASE_BODY);
 
-  free(storage_root);
+  stamp_parents(ctx, root_fd);
 
   return 200;
 }
 
-size_t json_buf_writer(char *buf, size_t count, void *arg) {
-  return evbuffer_add((struct evbuffer*)arg, buf, count);
+// returns the content type of the file given by `fd': either the one stored
+// in it's meta information, or one guessed by libmagic (which is then stored,
+// so the guess is only made once).
+static const char *get_content_type(struct rs_request *ctx, int fd) {
+  request_phase_begin(ctx, RS_PHASE_CONTENT_TYPE);
+  const char *content_type = content_type_from_xattr(fd, &ctx->arena);
+  if(content_type == NULL) {
+    log_debug("mime type not given, detecting...");
+    const char *magic_type = magic_descriptor(magic_cookie, fd);
+    if(magic_type != NULL) {
+      // (libmagic reuses it's buffer for the next call)
+      content_type = arena_strdup(&ctx->arena, magic_type);
+    } else {
+      log_error("magic failed: %s", magic_error(magic_cookie));
+    }
+    if(content_type == NULL) {
+      // ... or defaulted to "application/octet-stream"
+      content_type = "application/octet-stream; charset=binary";
+    } else {
+      content_type_to_xattr(fd, content_type, &ctx->arena);
+    }
+  }
+  request_phase_end(ctx, RS_PHASE_CONTENT_TYPE);
+  return content_type;
+}
+
+// Folder listings come in two formats:
+//
+// * JSON-LD folder descriptions (draft-dejong-remotestorage-02 and later),
+//   which include the metadata of each item, so clients don't need to send a
+//   HEAD request per item:
+//
+//     {"@context":"http://remotestorage.io/spec/folder-description",
+//      "items":{"abc":{"ETag":"...","Content-Type":"image/jpeg",
+//                      "Content-Length":82352},
+//               "def/":{"ETag":"..."}}}
+//
+// * a map of item names to ETags (earlier versions):
+//
+//     {"abc":"...","def/":"..."}
+//
+// Folder descriptions are served if RS_STORAGE_API is -02 or later, or if the
+// client explicitly accepts "application/ld+json".
+static int wants_folder_description(evhtp_request_t *request) {
+  if(RS_FOLDER_DESCRIPTIONS) {
+    return 1;
+  }
+  const char *accept = evhtp_header_find(request->headers_in, "Accept");
+  return accept != NULL && strstr(accept, "application/ld+json") != NULL;
 }
 
-// serve a directory response for the given request
-static evhtp_res serve_directory(evhtp_request_t *request, char *disk_path, struct stat *stat_buf) {
-  size_t disk_path_len = strlen(disk_path);
-  struct evbuffer *buf = request->buffer_out;
-  DIR *dir = opendir(disk_path);
-  if(dir == NULL) {
-    log_error("opendir() failed: %s", strerror(errno));
-    return EVHTP_RES_SERVERR;
+static const char *directory_content_type(int folder_description) {
+  return folder_description ? "application/ld+json" : "application/json; charset=UTF-8";
+}
+
+/*
+ * Listings are generated in batches of RS_LISTING_BATCH_SIZE entries. Small
+ * ones are buffered completely (and cached, see above). Once a listing grows
+ * beyond RS_LISTING_CACHE_MAX_LISTING, the buffered part is sent as the first
+ * chunk of a chunked reply, and every following batch is generated when the
+ * connection's output has drained (evhtp_hook_on_write). That way the memory
+ * used by a listing doesn't depend on the size of the folder.
+ */
+struct listing_stream {
+  evhtp_request_t *request;
+  struct rs_request *ctx;
+  DIR *dir;
+  int folder_description;
+  struct evbuffer *buf;
+  struct json json;
+  // (compressed chunks, unless the encoding is RS_ENCODING_IDENTITY)
+  struct rs_compressor compressor;
+  struct evbuffer *encoded;
+  // set while continue_listing_stream() is the connection's on_write hook
+  int hooked;
+};
+
+// (also the request's cleanup function, while the stream is open)
+static void close_listing_stream(void *arg) {
+  struct listing_stream *stream = arg;
+  if(stream->hooked) {
+    // (the hook must not outlive the stream, which is freed with the request)
+    evhtp_unset_hook(&stream->request->conn->hooks, evhtp_hook_on_write);
+    stream->hooked = 0;
   }
-  struct dirent *entryp = malloc(offsetof(struct dirent, d_name) +
-                                 pathconf(disk_path, _PC_NAME_MAX) + 1);
-  struct dirent *resultp = NULL;
-  if(entryp == NULL) {
-    log_error("malloc() failed while creating directory pointer: %s",
-              strerror(errno));
-    return EVHTP_RES_SERVERR;
+  if(stream->dir) {
+    closedir(stream->dir);
+    stream->dir = NULL;
   }
+  if(stream->buf) {
+    evbuffer_free(stream->buf);
+    stream->buf = NULL;
+  }
+  if(stream->encoded) {
+    evbuffer_free(stream->encoded);
+    stream->encoded = NULL;
+  }
+  compressor_free(&stream->compressor);
+  stream->ctx->cleanup = NULL;
+}
 
-  struct json *json = new_json(json_buf_writer, buf);
-
+// writes the next batch of entries to the stream's buffer. Returns non-zero
+// once the listing is complete. Otherwise, at least one entry was written
+// (only entries that made it into the listing count towards the batch size,
+// so a batch of failing entries can't leave the buffer empty, which would
+// stall the stream).
+static int write_listing_batch(struct listing_stream *stream) {
+  struct rs_request *ctx = stream->ctx;
+  struct json *json = &stream->json;
+  int dir_fd = dirfd(stream->dir);
+  struct dirent *entryp = NULL;
   struct stat file_stat_buf;
-  int entry_len;
+  int entry_len, is_dir, count = 0;
 
-  json_start_object(json);
+  request_phase_begin(ctx, RS_PHASE_BODY);
 
-  for(;;) {
-    readdir_r(dir, entryp, &resultp);
-    if(resultp == NULL) {
-      break;
-    }
+  // The entry type comes from readdir() (d_type), so only files need to be
+  // stat()ed (for their size, in folder descriptions). Directory etags are
+  // stamps (see get_etag()), reading them doesn't descend any further.
+  while(count < RS_LISTING_BATCH_SIZE && (entryp = readdir(stream->dir)) != NULL) {
     if(strcmp(entryp->d_name, ".") == 0 ||
        strcmp(entryp->d_name, "..") == 0) {
       // skip.
       continue;
     }
-    entry_len = strlen(entryp->d_name);
-    char full_path[disk_path_len + entry_len + 1];
-    sprintf(full_path, "%s%s", disk_path, entryp->d_name);
-    stat(full_path, &file_stat_buf);
+    if(entryp->d_type == DT_UNKNOWN) {
+      // (not all file systems fill in d_type)
+      if(fstatat(dir_fd, entryp->d_name, &file_stat_buf, AT_SYMLINK_NOFOLLOW) != 0) {
+        log_error("fstatat() failed for %s: %s", entryp->d_name, strerror(errno));
+        continue;
+      }
+      entryp->d_type = IFTODT(file_stat_buf.st_mode);
+    }
+    if(entryp->d_type != DT_REG && entryp->d_type != DT_DIR) {
+      // skip (symlinks, sockets, ...).
+      continue;
+    }
+    if(ctx->path.segment_count == 0 &&
+       storage_private_name(entryp->d_name, strlen(entryp->d_name))) {
+      // skip (staged uploads and such, see "Private directories" above).
+      continue;
+    }
+    is_dir = entryp->d_type == DT_DIR;
+    int entry_fd = openat(dir_fd, entryp->d_name,
+                          O_RDONLY | O_NONBLOCK | O_NOFOLLOW | O_CLOEXEC |
+                          (is_dir ? O_DIRECTORY : 0));
+    if(entry_fd == -1) {
+      log_error("openat() failed for %s: %s", entryp->d_name, strerror(errno));
+      continue;
+    }
 
+    entry_len = strlen(entryp->d_name);
     char key_string[entry_len + 2];
-    sprintf(key_string, "%s%s", entryp->d_name,
-            S_ISDIR(file_stat_buf.st_mode) ? "/": "");
-    char *val_string = get_etag(full_path);
+    sprintf(key_string, "%s%s", entryp->d_name, is_dir ? "/": "");
+    struct rs_arena_mark mark = arena_mark(&ctx->arena);
+    request_phase_begin(ctx, RS_PHASE_ETAG);
+    char *val_string = get_etag(entry_fd, &ctx->arena);
+    request_phase_end(ctx, RS_PHASE_ETAG);
+
+    if(val_string == NULL) {
+      // skip.
+    } else if(stream->folder_description) {
+      count++;
+      json_write_key(json, key_string);
+      json_start_object(json);
+      json_write_key_val(json, "ETag", val_string);
+      if(! is_dir) {
+        request_phase_begin(ctx, RS_PHASE_STAT);
+        if(fstat(entry_fd, &file_stat_buf) != 0) {
+          log_error("fstat() failed for %s: %s", entryp->d_name, strerror(errno));
+          file_stat_buf.st_size = 0;
+        }
+        request_phase_end(ctx, RS_PHASE_STAT);
+        json_write_key_val(json, "Content-Type", get_content_type(ctx, entry_fd));
+        json_write_key_int(json, "Content-Length", file_stat_buf.st_size);
+      }
+      json_end_object(json);
+    } else {
+      count++;
+      json_write_key_val(json, key_string, val_string);
+    }
+    close(entry_fd);
+    arena_reset(&ctx->arena, mark);
+  }
 
-    json_write_key_val(json, key_string, val_string);
+  // (readdir() returned NULL, unless the batch is full)
+  int done = entryp == NULL;
+  if(done) {
+    if(stream->folder_description) {
+      json_end_object(json); // items
+    }
+    json_end_object(json);
+  }
+
+  request_phase_end(ctx, RS_PHASE_BODY);
+  return done;
+}
+
+// sends the buffered part of the listing. Compressed streams are flushed at
+// the end of each chunk, so clients can decode them as they arrive.
+static void send_listing_chunk(struct listing_stream *stream, int done) {
+  struct evbuffer *chunk = stream->buf;
+  if(stream->encoded != NULL) {
+    if(compressor_write_buffer(&stream->compressor, stream->buf, stream->encoded,
+                               done ? RS_COMPRESS_FINISH : RS_COMPRESS_SYNC) != 0) {
+      // (nothing sensible to send anymore, the client will notice)
+      log_error("failed to compress listing chunk");
+    }
+    evbuffer_drain(stream->buf, evbuffer_get_length(stream->buf));
+    chunk = stream->encoded;
+  }
+  if(evbuffer_get_length(chunk) > 0) {
+    // (an empty chunk would end the response)
+    stream->ctx->bytes_out += evbuffer_get_length(chunk);
+    evhtp_send_reply_chunk(stream->request, chunk);
+  }
+}
 
-    free(val_string);
+// (evhtp_hook_on_write: the previous chunk has been written out)
+static evhtp_res continue_listing_stream(evhtp_connection_t *conn, void *arg) {
+  struct listing_stream *stream = arg;
+  evhtp_request_t *request = stream->request;
+  int done = write_listing_batch(stream);
+  send_listing_chunk(stream, done);
+  if(done) {
+    close_listing_stream(stream);
+    // (this may finish the request, and free the stream, right away)
+    evhtp_send_reply_chunk_end(request);
   }
+  return EVHTP_RES_OK;
+}
 
-  json_end_object(json);
+// sends a complete (uncompressed) listing, compressed with `encoding' unless
+// that's RS_ENCODING_IDENTITY or the listing is too small to bother. If
+// `owned' is set, `body' was just generated and is cached (under `key')
+// along with the compressed variant (under `encoded_key').
+static evhtp_res send_listing(evhtp_request_t *request, struct rs_request *ctx,
+                              struct evbuffer *body, int owned, const char *key,
+                              const char *encoded_key, const char *etag,
+                              enum rs_encoding encoding) {
+  evhtp_res status;
+  struct evbuffer *encoded = NULL;
+  if(encoding != RS_ENCODING_IDENTITY &&
+     evbuffer_get_length(body) >= RS_COMPRESS_MIN_SIZE) {
+    request_phase_begin(ctx, RS_PHASE_BODY);
+    encoded = compress_body(body, encoding);
+    request_phase_end(ctx, RS_PHASE_BODY);
+  }
+  if(encoded != NULL) {
+    set_content_encoding(request, encoding);
+    status = add_body_reference(request, encoded);
+    remember_listing(encoded_key, etag, encoded);
+  } else {
+    status = add_body_reference(request, body);
+  }
+  if(owned) {
+    remember_listing(key, etag, body);
+  }
+  return status;
+}
 
-  free_json(json);
+// serve a directory response for the given request
+static evhtp_res serve_directory(evhtp_request_t *request, struct rs_request *ctx,
+                                 int fd, struct stat *stat_buf) {
+  int folder_description = wants_folder_description(request);
 
-  char *etag = get_etag(disk_path);
+  request_phase_begin(ctx, RS_PHASE_ETAG);
+  char *etag = get_etag(fd, &ctx->arena);
+  request_phase_end(ctx, RS_PHASE_ETAG);
   if(etag == NULL) {
     log_error("get_etag() failed");
-    free(entryp);
-    closedir(dir);
     return EVHTP_RES_SERVERR;
   }
 
-  ADD_RESP_HEADER(request, "Content-Type", "application/json; charset=UTF-8");
-  ADD_RESP_HEADER_CP(request, "ETag", etag);
+  const char *content_type = directory_content_type(folder_description);
+  ADD_RESP_HEADER(request, "Content-Type", content_type);
+  ADD_RESP_HEADER(request, "ETag", etag);
+  if(! RS_FOLDER_DESCRIPTIONS) {
+    // (format depends on the Accept header)
+    add_vary(request, ctx, "Accept");
+  }
+  enum rs_encoding encoding = RS_ENCODING_IDENTITY;
+  if(may_compress(content_type, -1)) {
+    add_vary(request, ctx, "Accept-Encoding");
+    encoding = accepted_encoding(request);
+  }
 
-  free(etag);
-  free(entryp);
-  closedir(dir);
-  return EVHTP_RES_OK;
+  // (directories have no meaningful modification time)
+  evhtp_res precondition_status = check_preconditions(request, etag, -1);
+  if(precondition_status != 0) {
+    return precondition_status;
+  }
+
+  char format = folder_description ? 'J' : 'L';
+  char *key = listing_key(ctx, format, RS_ENCODING_IDENTITY, ctx->path.path);
+  char *encoded_key = NULL;
+  struct rs_listing *listing;
+  if(encoding != RS_ENCODING_IDENTITY) {
+    encoded_key = listing_key(ctx, format, encoding, ctx->path.path);
+    if((listing = find_listing(encoded_key, etag)) != NULL) {
+      set_content_encoding(request, encoding);
+      return add_body_reference(request, listing->body);
+    }
+  }
+  if((listing = find_listing(key, etag)) != NULL) {
+    return send_listing(request, ctx, listing->body, 0, key, encoded_key, etag, encoding);
+  }
+
+  // (lives as long as the request)
+  struct listing_stream *stream = arena_alloc(&ctx->arena, sizeof(struct listing_stream));
+  if(stream == NULL) {
+    log_error("arena_alloc() failed: %s", strerror(errno));
+    return EVHTP_RES_SERVERR;
+  }
+  memset(stream, 0, sizeof(struct listing_stream));
+  stream->request = request;
+  stream->ctx = ctx;
+  stream->folder_description = folder_description;
+  ctx->cleanup = close_listing_stream;
+  ctx->cleanup_arg = stream;
+
+  stream->buf = evbuffer_new();
+  if(stream->buf == NULL) {
+    log_error("evbuffer_new() failed");
+    close_listing_stream(stream);
+    return EVHTP_RES_SERVERR;
+  }
+  int dir_fd = openat(fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  stream->dir = dir_fd == -1 ? NULL : fdopendir(dir_fd);
+  if(stream->dir == NULL) {
+    log_error("opendir() failed: %s", strerror(errno));
+    if(dir_fd != -1) {
+      close(dir_fd);
+    }
+    close_listing_stream(stream);
+    return EVHTP_RES_SERVERR;
+  }
+
+  struct json *json = &stream->json;
+  json_init(json, stream->buf);
+  json_start_object(json);
+  if(folder_description) {
+    json_write_key_val(json, "@context", RS_FOLDER_DESCRIPTION_CONTEXT);
+    json_write_key(json, "items");
+    json_start_object(json);
+  }
+
+  int done;
+  while(! (done = write_listing_batch(stream)) &&
+        evbuffer_get_length(stream->buf) <= RS_LISTING_CACHE_MAX_LISTING);
+
+  if(! done) {
+    // too large to buffer, stream the rest.
+    log_debug("streaming listing of %s", ctx->path.path);
+    if(encoding != RS_ENCODING_IDENTITY) {
+      if(compressor_init(&stream->compressor, encoding, RS_COMPRESS_LEVEL) == 0 &&
+         (stream->encoded = evbuffer_new()) != NULL) {
+        set_content_encoding(request, encoding);
+      } else {
+        log_error("failed to set up compression, streaming uncompressed listing");
+        compressor_free(&stream->compressor);
+      }
+    }
+    ctx->reply_started = 1;
+    evhtp_send_reply_chunk_start(request, EVHTP_RES_OK);
+    send_listing_chunk(stream, 0);
+    evhtp_set_hook(&request->conn->hooks, evhtp_hook_on_write,
+                   continue_listing_stream, stream);
+    stream->hooked = 1;
+    return EVHTP_RES_OK;
+  }
+
+  struct evbuffer *buf = stream->buf;
+  stream->buf = NULL;
+  close_listing_stream(stream);
+
+  return send_listing(request, ctx, buf, 1, key, encoded_key, etag, encoding);
 }
 
-static evhtp_res serve_file_head(evhtp_request_t *request, char *disk_path, struct stat *stat_buf, const char *mime_type) {
+static evhtp_res serve_file_head(evhtp_request_t *request, struct rs_request *ctx, int fd, struct stat *stat_buf, const char *mime_type) {
 
   log_debug("serve file head");
 
-  if(request->uri->path->file == NULL) {
+  if(ctx->path.is_dir) {
     log_debug("HEAD dir requested");
     // directory was requested
     if(! S_ISDIR(stat_buf->st_mode)) {
@@ -416,157 +1714,480 @@ static evhtp_res serve_file_head(evhtp_request_t *request, char *disk_path, stru
     }
     log_debug("HEAD file found");
   }
-    
-  char *etag_string = get_etag(disk_path);
+
+  request_phase_begin(ctx, RS_PHASE_ETAG);
+  char *etag_string = get_etag(fd, &ctx->arena);
+  request_phase_end(ctx, RS_PHASE_ETAG);
   if(etag_string == NULL) {
     log_error("get_etag() failed");
     return EVHTP_RES_SERVERR;
   }
 
-  evhtp_header_t *if_none_match_header = evhtp_headers_find_header(request->headers_in, "If-None-Match");
-  if(if_none_match_header) {
-    // FIXME: support multiple comma-separated ETags in If-None-Match header
-    if(strcmp(if_none_match_header->val, etag_string) == 0) {
-      free(etag_string);
-      return EVHTP_RES_NOTMOD;
+  // (validators are sent along with 304 / 412 responses as well)
+  ADD_RESP_HEADER(request, "ETag", etag_string);
+  time_t last_modified = -1;
+  if(! S_ISDIR(stat_buf->st_mode)) {
+    char *date_string = arena_alloc(&ctx->arena, RS_HTTP_DATE_LEN);
+    if(date_string != NULL) {
+      last_modified = stat_buf->st_mtime;
+      format_http_date(last_modified, date_string);
+      ADD_RESP_HEADER(request, "Last-Modified", date_string);
     }
+    ADD_RESP_HEADER(request, "Accept-Ranges", "bytes");
+  }
+
+  evhtp_res precondition_status = check_preconditions(request, etag_string, last_modified);
+  if(precondition_status != 0) {
+    return precondition_status;
   }
 
-  char *length_string = malloc(24);
+  char *length_string = arena_alloc(&ctx->arena, 24);
   if(length_string == NULL) {
-    log_error("malloc() failed: %s", strerror(errno));
-    free(etag_string);
+    log_error("arena_alloc() failed: %s", strerror(errno));
     return EVHTP_RES_SERVERR;
   }
   snprintf(length_string, 24, "%ld", stat_buf->st_size);
 
-  int free_mime_type = 0;
-  // mime type is either passed in ... (such as for directory listings)
+  // mime type is either passed in (such as for directory listings) or
+  // detected.
   if(mime_type == NULL) {
-    // ... or detected based on xattr
-    mime_type = content_type_from_xattr(disk_path);
-    if(mime_type == NULL) {
-      // ... or guessed by libmagic
-      log_debug("mime type not given, detecting...");
-      mime_type = magic_file(magic_cookie, disk_path);
-      if(mime_type == NULL) {
-        // ... or defaulted to "application/octet-stream"
-        log_error("magic failed: %s", magic_error(magic_cookie));
-        mime_type = "application/octet-stream; charset=binary";
-      }
+    mime_type = get_content_type(ctx, fd);
+  }
+
+  // (all values live until the request is finished)
+  log_debug("setting Content-Type of %s: %s", request->uri->path->full, mime_type);
+  ADD_RESP_HEADER(request, "Content-Type", mime_type);
+  ADD_RESP_HEADER(request, "Content-Length", length_string);
+  if(may_compress(mime_type, (S_ISDIR(stat_buf->st_mode) || RS_PRECOMPRESS) ?
+                   -1 : stat_buf->st_size)) {
+    add_vary(request, ctx, "Accept-Encoding");
+  }
+  return 0;
+}
+
+// returns non-zero if the "If-Range" header (if any) allows a partial
+// response, i.e. matches the current etag (strongly) or modification time.
+static int if_range_matches(evhtp_request_t *request, struct stat *stat_buf) {
+  const char *if_range = evhtp_header_find(request->headers_in, "If-Range");
+  if(if_range == NULL) {
+    return 1;
+  }
+  time_t date = parse_http_date(if_range);
+  if(date != -1) {
+    return date == stat_buf->st_mtime;
+  }
+  const char *etag = evhtp_header_find(request->headers_out, "ETag");
+  return etag != NULL && etag_list_matches(if_range, etag, 0);
+}
+
+static char *range_string(struct rs_request *ctx, off_t first, off_t last, off_t size) {
+  char *string = arena_alloc(&ctx->arena, 64);
+  if(string != NULL) {
+    if(first > last) {
+      snprintf(string, 64, "bytes */%lld", (long long)size);
     } else {
-      // xattr detected mime type and allocated memory for it
-      free_mime_type = 1;
+      snprintf(string, 64, "bytes %lld-%lld/%lld", (long long)first,
+               (long long)last, (long long)size);
     }
   }
+  return string;
+}
 
-  log_info("setting Content-Type of %s: %s", request->uri->path->full, mime_type);
-  ADD_RESP_HEADER_CP(request, "Content-Type", mime_type);
-  ADD_RESP_HEADER_CP(request, "Content-Length", length_string);
-  ADD_RESP_HEADER_CP(request, "ETag", etag_string);
+/*
+ * Compressed file bodies are streamed: RS_COMPRESS_CHUNK_SIZE bytes of the
+ * file are read and compressed whenever the connection has drained (like
+ * streamed listings, see below), so neither the whole document nor it's
+ * compressed form is held in memory, and the event loop isn't blocked for
+ * long.
+ */
 
-  free(etag_string);
-  free(length_string);
-  if(free_mime_type) {
-    free((char*)mime_type);
+struct file_stream {
+  evhtp_request_t *request;
+  struct rs_request *ctx;
+  int fd;
+  off_t offset;
+  off_t size;
+  struct rs_compressor compressor;
+  struct evbuffer *encoded;
+  // set while continue_file_stream() is the connection's on_write hook
+  int hooked;
+};
+
+// (also the request's cleanup function, while the stream is open)
+static void close_file_stream(void *arg) {
+  struct file_stream *stream = arg;
+  if(stream->hooked) {
+    // (the hook must not outlive the stream, which is freed with the request)
+    evhtp_unset_hook(&stream->request->conn->hooks, evhtp_hook_on_write);
+    stream->hooked = 0;
   }
-  return 0;
+  if(stream->fd != -1) {
+    close(stream->fd);
+    stream->fd = -1;
+  }
+  if(stream->encoded) {
+    evbuffer_free(stream->encoded);
+    stream->encoded = NULL;
+  }
+  compressor_free(&stream->compressor);
+  stream->ctx->cleanup = NULL;
 }
 
-// serve a file body for the given request
-static evhtp_res serve_file(evhtp_request_t *request, const char *disk_path, struct stat *stat_buf) {
-  int fd = open(disk_path, O_RDONLY | O_NONBLOCK);
-  if(fd < 0) {
-    log_error("open() failed: %s", strerror(errno));
-    return EVHTP_RES_SERVERR;
+// compresses and sends the next chunk of the file. The compressor is flushed
+// at the end of each chunk, so every chunk is non-empty (an empty one would
+// end the response). Returns non-zero once the file is complete.
+static int send_file_chunk(struct file_stream *stream) {
+  char block[16384];
+  off_t end = stream->offset + RS_COMPRESS_CHUNK_SIZE;
+  int done = 0, failed = 0;
+  request_phase_begin(stream->ctx, RS_PHASE_BODY);
+  while(! done) {
+    size_t want = sizeof(block);
+    if(end - stream->offset < want) {
+      want = end - stream->offset;
+    }
+    ssize_t count = pread(stream->fd, block, want, stream->offset);
+    if(count < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      log_error("pread() failed: %s", strerror(errno));
+      failed = 1;
+      count = 0;
+    }
+    stream->offset += count;
+    // (the file may have been truncated in the meantime)
+    done = count == 0 || stream->offset >= stream->size;
+    int last = done || stream->offset >= end;
+    if(compressor_write(&stream->compressor, block, count, stream->encoded,
+                        done ? RS_COMPRESS_FINISH :
+                        (last ? RS_COMPRESS_SYNC : RS_COMPRESS_NO_FLUSH)) != 0) {
+      log_error("%s compression failed", encoding_name(stream->compressor.encoding));
+      failed = 1;
+    }
+    if(failed) {
+      // (nothing sensible to send anymore, the client will notice)
+      evbuffer_drain(stream->encoded, evbuffer_get_length(stream->encoded));
+      done = 1;
+    }
+    if(last) {
+      break;
+    }
+  }
+  request_phase_end(stream->ctx, RS_PHASE_BODY);
+  if(evbuffer_get_length(stream->encoded) > 0) {
+    stream->ctx->bytes_out += evbuffer_get_length(stream->encoded);
+    evhtp_send_reply_chunk(stream->request, stream->encoded);
+  }
+  return done;
+}
+
+// (evhtp_hook_on_write: the previous chunk has been written out)
+static evhtp_res continue_file_stream(evhtp_connection_t *conn, void *arg) {
+  struct file_stream *stream = arg;
+  evhtp_request_t *request = stream->request;
+  if(send_file_chunk(stream)) {
+    close_file_stream(stream);
+    // (this may finish the request, and free the stream, right away)
+    evhtp_send_reply_chunk_end(request);
+  }
+  return EVHTP_RES_OK;
+}
+
+// serve a file body, compressed. The reply is started right away, the rest
+// is sent by continue_file_stream(). Returns zero if compression couldn't
+// be set up (the body is sent uncompressed then).
+static evhtp_res serve_compressed_file(evhtp_request_t *request, struct rs_request *ctx,
+                                       int fd, off_t size, enum rs_encoding encoding) {
+  // (lives as long as the request)
+  struct file_stream *stream = arena_alloc(&ctx->arena, sizeof(struct file_stream));
+  if(stream == NULL) {
+    log_error("arena_alloc() failed: %s", strerror(errno));
+    return 0;
+  }
+  memset(stream, 0, sizeof(struct file_stream));
+  stream->request = request;
+  stream->ctx = ctx;
+  stream->size = size;
+  // (`fd' is closed after this)
+  stream->fd = dup(fd);
+  if(stream->fd == -1) {
+    log_error("dup() failed: %s", strerror(errno));
+    return 0;
+  }
+  ctx->cleanup = close_file_stream;
+  ctx->cleanup_arg = stream;
+  if(compressor_init(&stream->compressor, encoding, RS_COMPRESS_LEVEL) != 0 ||
+     (stream->encoded = evbuffer_new()) == NULL) {
+    log_error("failed to set up %s compression", encoding_name(encoding));
+    close_file_stream(stream);
+    return 0;
+  }
+
+  // (the length isn't known in advance, the body is sent in chunks)
+  evhtp_header_t *length_header = evhtp_headers_find_header(request->headers_out, "Content-Length");
+  if(length_header != NULL) {
+    evhtp_header_rm_and_free(request->headers_out, length_header);
+  }
+  set_content_encoding(request, encoding);
+  ctx->reply_started = 1;
+  evhtp_send_reply_chunk_start(request, EVHTP_RES_OK);
+  if(send_file_chunk(stream)) {
+    close_file_stream(stream);
+    evhtp_send_reply_chunk_end(request);
+  } else {
+    evhtp_set_hook(&request->conn->hooks, evhtp_hook_on_write,
+                   continue_file_stream, stream);
+    stream->hooked = 1;
   }
-  while(evbuffer_read(request->buffer_out, fd, 4096) != 0);
-  close(fd);
   return EVHTP_RES_OK;
 }
 
-static char *make_disk_path(char *user, char *path, char **storage_root) {
+// serve a file body from it's sidecar (see "Precompression" above), if there
+// is a current one. Returns zero if there isn't.
+static evhtp_res serve_sidecar(evhtp_request_t *request, struct rs_request *ctx,
+                               int fd, enum rs_encoding encoding) {
+  char name[SHA_DIGEST_LENGTH * 2 + 4];
+  struct stat stat_buf;
+  const char *etag = evhtp_header_find(request->headers_out, "ETag");
+  char *compressed = get_meta(fd, "compressed", SHA_DIGEST_LENGTH * 2 + 1, &ctx->arena);
+  if(etag == NULL || compressed == NULL || strcmp(compressed, etag) != 0) {
+    return 0;
+  }
+  int root_fd = user_storage_root_fd(ctx->user);
+  int dir_fd = root_fd == -1 ? -1 : open_private_dir(ctx, root_fd, RS_PRECOMPRESS_DIR, 0);
+  if(dir_fd == -1) {
+    return 0;
+  }
+  sidecar_name(ctx, encoding, name);
+  int sidecar_fd = openat(dir_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  close(dir_fd);
+  if(sidecar_fd == -1 || fstat(sidecar_fd, &stat_buf) != 0 || stat_buf.st_size == 0) {
+    if(sidecar_fd != -1) {
+      close(sidecar_fd);
+    }
+    return 0;
+  }
+  struct evbuffer_file_segment *segment =
+    evbuffer_file_segment_new(sidecar_fd, 0, stat_buf.st_size, EVBUF_FS_CLOSE_ON_FREE |
+                              (RS_USE_SSL ? EVBUF_FS_DISABLE_SENDFILE : 0));
+  if(segment == NULL) {
+    log_error("evbuffer_file_segment_new() failed");
+    close(sidecar_fd);
+    return 0;
+  }
+  char *length_string = arena_alloc(&ctx->arena, 24);
+  int result = length_string == NULL ? -1 :
+    evbuffer_add_file_segment(request->buffer_out, segment, 0, stat_buf.st_size);
+  evbuffer_file_segment_free(segment);
+  if(result != 0) {
+    evbuffer_drain(request->buffer_out, evbuffer_get_length(request->buffer_out));
+    return 0;
+  }
+  snprintf(length_string, 24, "%lld", (long long)stat_buf.st_size);
+  replace_resp_header(request, "Content-Length", length_string);
+  set_content_encoding(request, encoding);
+  return EVHTP_RES_OK;
+}
 
-  // FIXME: use passwd->pwdir instead of /home/{user}/
+// serve a file body (or the requested ranges of it) for the given request.
+// The body isn't copied: it refers to the file, and is read (or sent using
+// sendfile()) while the response is written out.
+static evhtp_res serve_file(evhtp_request_t *request, struct rs_request *ctx,
+                            int fd, struct stat *stat_buf) {
+  struct evbuffer *buf = request->buffer_out;
+  off_t size = stat_buf->st_size;
+  struct rs_range ranges[RS_MAX_RANGES];
+  int range_count = -1, i;
+  const char *range_header = evhtp_header_find(request->headers_in, "Range");
+  if(range_header != NULL && if_range_matches(request, stat_buf)) {
+    range_count = parse_range(range_header, size, ranges, RS_MAX_RANGES);
+  }
 
-  // calculate maximum length of path
-  int pathlen = ( strlen(user) + strlen(path) +
-                  6 + // "/home/"
-                  1 + // another slash
-                  RS_HOME_SERVE_ROOT_LEN );
-  char *disk_path = malloc(pathlen + 1);
-  if(disk_path == NULL) {
-    log_error("malloc() failed: %s", strerror(errno));
-    return NULL;
+  if(range_count == 0) {
+    char *content_range = range_string(ctx, 1, 0, size);
+    if(content_range == NULL) {
+      return EVHTP_RES_SERVERR;
+    }
+    replace_resp_header(request, "Content-Length", "0");
+    ADD_RESP_HEADER(request, "Content-Range", content_range);
+    return EVHTP_RES_RANGENOTSC;
   }
-  if(storage_root) {
-    *storage_root = malloc( 7 + RS_HOME_SERVE_ROOT_LEN + strlen(user) + 1);
-    if(*storage_root == NULL) {
-      log_error("malloc() failed: %s", strerror(errno));
-      free(disk_path);
-      return NULL;
+
+  if(size == 0) {
+    return EVHTP_RES_OK;
+  }
+
+  if(range_count < 0 && size <= RS_DOCUMENT_CACHE_MAX_DOCUMENT) {
+    request_phase_begin(ctx, RS_PHASE_BODY);
+    struct rs_document *document = read_document(request, ctx, fd, stat_buf);
+    request_phase_end(ctx, RS_PHASE_BODY);
+    if(document != NULL) {
+      return send_document(request, ctx, document);
+    }
+  }
+
+  if(range_count < 0) {
+    const char *content_type = evhtp_header_find(request->headers_out, "Content-Type");
+    enum rs_encoding encoding;
+    if(may_compress(content_type, RS_PRECOMPRESS ? -1 : size) &&
+       (encoding = accepted_encoding(request)) != RS_ENCODING_IDENTITY) {
+      evhtp_res status = RS_PRECOMPRESS ? serve_sidecar(request, ctx, fd, encoding) : 0;
+      if(status == 0 && size >= RS_COMPRESS_MIN_SIZE) {
+        status = serve_compressed_file(request, ctx, fd, size, encoding);
+      }
+      if(status != 0) {
+        return status;
+      }
     }
-    sprintf(*storage_root, "/home/%s/%s", user, RS_HOME_SERVE_ROOT);
   }
-  // remove all /.. segments
-  // (we don't try to resolve them, but instead treat them as garbage)
-  char *pos = NULL;
-  while((pos = strstr(path, "/..")) != NULL) { // FIXME: this would also filter out valid paths like /foo/..bar
-    int restlen = strlen(pos + 3);
-    memmove(pos, pos + 3, restlen);
-    pos[restlen] = 0;
+
+  // (the segment keeps it's own descriptor, `fd' is closed after this)
+  int segment_fd = dup(fd);
+  if(segment_fd == -1) {
+    log_error("dup() failed: %s", strerror(errno));
+    return EVHTP_RES_SERVERR;
+  }
+  // (SSL bufferevents can't write sendfile() segments)
+  struct evbuffer_file_segment *segment =
+    evbuffer_file_segment_new(segment_fd, 0, size, EVBUF_FS_CLOSE_ON_FREE |
+                              (RS_USE_SSL ? EVBUF_FS_DISABLE_SENDFILE : 0));
+  if(segment == NULL) {
+    log_error("evbuffer_file_segment_new() failed");
+    close(segment_fd);
+    return EVHTP_RES_SERVERR;
+  }
+
+  evhtp_res status = EVHTP_RES_OK;
+  request_phase_begin(ctx, RS_PHASE_BODY);
+  if(range_count < 0) {
+    // whole document
+    if(evbuffer_add_file_segment(buf, segment, 0, size) != 0) {
+      status = EVHTP_RES_SERVERR;
+    }
+  } else if(range_count == 1) {
+    off_t length = ranges[0].last - ranges[0].first + 1;
+    char *content_range = range_string(ctx, ranges[0].first, ranges[0].last, size);
+    char *length_string = arena_alloc(&ctx->arena, 24);
+    if(content_range == NULL || length_string == NULL ||
+       evbuffer_add_file_segment(buf, segment, ranges[0].first, length) != 0) {
+      status = EVHTP_RES_SERVERR;
+    } else {
+      snprintf(length_string, 24, "%lld", (long long)length);
+      replace_resp_header(request, "Content-Length", length_string);
+      ADD_RESP_HEADER(request, "Content-Range", content_range);
+      status = EVHTP_RES_PARTIAL;
+    }
+  } else {
+    // multipart/byteranges (RFC 7233, appendix A). The boundary is the
+    // document's etag (the SHA1 sum of it's contents), which it won't
+    // contain in practice.
+    const char *content_type = evhtp_header_find(request->headers_out, "Content-Type");
+    const char *etag = evhtp_header_find(request->headers_out, "ETag");
+    char *multipart_type = arena_alloc(&ctx->arena, 64);
+    char *length_string = arena_alloc(&ctx->arena, 24);
+    if(multipart_type == NULL || length_string == NULL) {
+      status = EVHTP_RES_SERVERR;
+    } else {
+      snprintf(multipart_type, 64, "multipart/byteranges; boundary=%s", etag);
+      for(i = 0; i < range_count; i++) {
+        evbuffer_add_printf(buf, "\r\n--%s\r\nContent-Type: %s\r\n"
+                            "Content-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                            etag, content_type, (long long)ranges[i].first,
+                            (long long)ranges[i].last, (long long)size);
+        if(evbuffer_add_file_segment(buf, segment, ranges[i].first,
+                                     ranges[i].last - ranges[i].first + 1) != 0) {
+          status = EVHTP_RES_SERVERR;
+          break;
+        }
+      }
+      evbuffer_add_printf(buf, "\r\n--%s--\r\n", etag);
+      if(status == EVHTP_RES_OK) {
+        snprintf(length_string, 24, "%zu", evbuffer_get_length(buf));
+        replace_resp_header(request, "Content-Type", multipart_type);
+        replace_resp_header(request, "Content-Length", length_string);
+        status = EVHTP_RES_PARTIAL;
+      }
+    }
   }
-  // remove all duplicate slashes (nasty things may be done with them at times)
-  while((pos = strstr(path, "//")) != NULL) {
-    int restlen = strlen(pos + 2);
-    memmove(pos, pos + 2, restlen);
-    pos[restlen] = 0;
+  request_phase_end(ctx, RS_PHASE_BODY);
+
+  // (drops our reference, the buffer holds it's own)
+  evbuffer_file_segment_free(segment);
+
+  if(status == EVHTP_RES_SERVERR) {
+    log_error("failed to add file to response");
+    evbuffer_drain(buf, evbuffer_get_length(buf));
+    replace_resp_header(request, "Content-Length", "0");
   }
-  // build path
-  sprintf(disk_path, "/home/%s/%s%s", user, RS_HOME_SERVE_ROOT, path);
-  return disk_path;
+  return status;
 }
 
-static evhtp_res handle_get_or_head(evhtp_request_t *request, int include_body) {
+static evhtp_res handle_get_or_head(evhtp_request_t *request, struct rs_request *ctx,
+                                    int include_body) {
 
   log_debug("HANDLE GET / HEAD (body: %s)", include_body ? "true" : "false");
 
-  char *disk_path = make_disk_path(REQUEST_GET_USER(request),
-                                   REQUEST_GET_PATH(request),
-                                   NULL);
-  if(disk_path == NULL) {
+  if(! ctx->path.is_dir) {
+    evhtp_res cached_status = serve_cached_document(request, ctx, include_body);
+    if(cached_status != 0) {
+      return cached_status;
+    }
+  }
+
+  char *path = ctx->path.path;
+  if(user_path_missing(ctx->user, path)) {
+    return EVHTP_RES_NOTFOUND;
+  }
+
+  int root_fd = user_storage_root_fd(ctx->user);
+  if(root_fd == -1) {
+    if(errno == ENOENT) {
+      user_path_remember_missing(ctx->user, path);
+      return EVHTP_RES_NOTFOUND;
+    }
     return EVHTP_RES_SERVERR;
   }
 
+  request_phase_begin(ctx, RS_PHASE_PATH);
+  int fd = open_beneath(root_fd, path, O_RDONLY | O_NONBLOCK, 0);
+  request_phase_end(ctx, RS_PHASE_PATH);
+  if(fd == -1) {
+    evhtp_res status = open_error_status(path);
+    if(status == EVHTP_RES_NOTFOUND) {
+      user_path_remember_missing(ctx->user, path);
+    }
+    return status;
+  }
+
   // stat
   struct stat stat_buf;
-  if(stat(disk_path, &stat_buf) != 0) {
-    if(errno != ENOENT && errno != ENOTDIR) {
-      log_error("stat() failed for path \"%s\": %s", disk_path, strerror(errno));
-      return EVHTP_RES_SERVERR;
-    } else {
-      return EVHTP_RES_NOTFOUND;
-    }
+  request_phase_begin(ctx, RS_PHASE_STAT);
+  int stat_result = fstat(fd, &stat_buf);
+  request_phase_end(ctx, RS_PHASE_STAT);
+  if(stat_result != 0) {
+    log_error("fstat() failed for path \"%s\": %s", path, strerror(errno));
+    close(fd);
+    return EVHTP_RES_SERVERR;
   }
+  evhtp_res status;
   // check for directory
-  if(request->uri->path->file == NULL) {
+  if(ctx->path.is_dir) {
     // directory requested
     if(include_body) {
-      return serve_directory(request, disk_path, &stat_buf);
+      status = serve_directory(request, ctx, fd, &stat_buf);
     } else {
-      evhtp_res head_status = serve_file_head(request, disk_path, &stat_buf, "application/json");
-      return head_status != 0 ? head_status : EVHTP_RES_OK;
+      const char *content_type = directory_content_type(wants_folder_description(request));
+      evhtp_res head_status = serve_file_head(request, ctx, fd, &stat_buf, content_type);
+      status = head_status != 0 ? head_status : EVHTP_RES_OK;
     }
   } else {
     // file requested
-    evhtp_res head_result = serve_file_head(request, disk_path, &stat_buf, NULL);
-    if(head_result != 0) {
-      return head_result;
-    }
-    if(include_body) {
-      return serve_file(request, disk_path, &stat_buf);
-    } else {
-      return EVHTP_RES_OK;
+    status = serve_file_head(request, ctx, fd, &stat_buf, NULL);
+    if(status == 0) {
+      status = include_body ? serve_file(request, ctx, fd, &stat_buf) : EVHTP_RES_OK;
     }
   }
+  close(fd);
+  return status;
 }
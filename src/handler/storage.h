@@ -13,9 +13,17 @@
 #ifndef RS_HANDLER_STORAGE_H
 #define RS_HANDLER_STORAGE_H
 
-evhtp_res storage_handle_head(evhtp_request_t *request);
-evhtp_res storage_handle_get(evhtp_request_t *request);
-evhtp_res storage_handle_put(evhtp_request_t *request);
-evhtp_res storage_handle_delete(evhtp_request_t *request);
+evhtp_res storage_handle_head(evhtp_request_t *request, struct rs_request *ctx);
+evhtp_res storage_handle_get(evhtp_request_t *request, struct rs_request *ctx);
+evhtp_res storage_handle_put(evhtp_request_t *request, struct rs_request *ctx);
+evhtp_res storage_handle_delete(evhtp_request_t *request, struct rs_request *ctx);
+
+// returns non-zero if the given entry of a storage root is one of the
+// directories rs-serve keeps it's own data in (RS_UPLOAD_DIR,
+// RS_PRECOMPRESS_DIR). Those aren't accessible to clients.
+int storage_private_name(const char *name, size_t len);
+
+void listing_cache_get_stats(struct rs_cache_stats *stats);
+void document_cache_get_stats(struct rs_cache_stats *stats);
 
 #endif /* !RS_HANDLER_STORAGE_H */
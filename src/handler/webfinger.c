@@ -34,10 +34,6 @@ void init_webfinger() {
   sprintf(storage_uri_format, "%s://%s/storage/%%s", RS_SCHEME, RS_HOSTNAME);
 }
 
-static size_t json_writer(char *buf, size_t count, void *arg) {
-  return evbuffer_add((struct evbuffer*)arg, buf, count);
-}
-
 static int process_resource(const char *resource, char **storage_uri, char **auth_uri) {
 
   size_t resource_len = strlen(resource);
@@ -72,11 +68,15 @@ static int process_resource(const char *resource, char **storage_uri, char **aut
       log_debug("hostname: %s", hostname);
       // check hostname
       if(strcmp(hostname, RS_HOSTNAME) == 0) {
-        uid_t uid = user_get_uid(local_part);
-        log_debug("got uid: %d (RS_MIN_UID: %d, allowed: %d)", uid,
-                  RS_MIN_UID, UID_ALLOWED(uid));
+        struct rs_user *user = user_lookup(local_part);
+        int allowed = user && user->exists && UID_ALLOWED(user->uid);
+        log_debug("got user: %p (RS_MIN_UID: %d, allowed: %d)", user,
+                  RS_MIN_UID, allowed);
+        if(user) {
+          user_release(user);
+        }
         // check if user is valid
-        if(UID_ALLOWED(uid)) {
+        if(allowed) {
           *storage_uri = malloc(storage_uri_format_len + strlen(local_part) + 1);
           sprintf(*storage_uri, storage_uri_format, local_part);
           *auth_uri = malloc(RS_AUTH_URI_LEN + strlen(local_part) + 1);
@@ -98,13 +98,13 @@ void reject_webfinger(evhtp_request_t *req, void *arg) {
 }
 
 void handle_webfinger(evhtp_request_t *req, void *arg) {
-  struct json *json;
+  struct json json_buf, *json = &json_buf;
   switch(evhtp_request_get_method(req)) {
   case htp_method_GET:
     ADD_CORS_HEADERS(req);
     ADD_RESP_HEADER(req, "Content-Type", "application/json");
     
-    json = new_json(json_writer, req->buffer_out);
+    json_init(json, req->buffer_out);
     json_start_object(json);
 
     const char *resource;
@@ -147,7 +147,6 @@ void handle_webfinger(evhtp_request_t *req, void *arg) {
     }
 
     json_end_object(json);
-    free_json(json);
 
     break;
   case htp_method_OPTIONS:
@@ -86,13 +86,38 @@ void log_event_base_message(int severity, const char *msg) {
 static evhtp_res finish_request(evhtp_request_t *req, void *arg) {
   request_count--;
   log_info("[rc=%d] %s %s -> %d (fini: %d)", request_count, method_strmap[req->method], req->uri->path->full, req->status, req->finished);
+  struct rs_request *ctx = arg;
+  metrics_record_request(req->method, req->status, request_elapsed_ns(ctx),
+                         ctx->bytes_in, ctx->bytes_out);
+  write_access_log(req, ctx, method_strmap[req->method]);
+  free_request_context(ctx);
   return 0;
 }
 
 static void handle_storage(evhtp_request_t *req, void *arg) {
   request_count++;
-  log_info("[rc=%d] (start) %s %s", request_count, method_strmap[req->method], req->uri->path->full, req->status, req->finished);
-  dispatch_storage(req, arg);
+  log_debug("[rc=%d] (start) %s %s", request_count, method_strmap[req->method], req->uri->path->full, req->status, req->finished);
+  struct rs_request *ctx = new_request_context();
+  if(ctx == NULL) {
+    request_count--;
+    evhtp_send_reply(req, EVHTP_RES_SERVERR);
+    return;
+  }
+  // (the request has it's own copy of the callback's hooks)
+  evhtp_set_hook(&req->hooks, evhtp_hook_on_request_fini, finish_request, ctx);
+  memprofile_begin(ctx);
+  dispatch_storage(req, ctx);
+  memprofile_end(ctx);
+}
+
+static void check_authorization_snapshot(evutil_socket_t fd, short events, void *arg) {
+  if(reload_authorization_snapshot() == 1) {
+    log_info("Reloaded authorization snapshot.");
+  }
+}
+
+static void flush_access_log_cb(evutil_socket_t fd, short events, void *arg) {
+  flush_access_log();
 }
 
 static int dummy_ssl_verify_callback(int ok, X509_STORE_CTX * x509_store) {
@@ -110,8 +135,22 @@ int main(int argc, char **argv) {
 
   init_config(argc, argv);
 
+#ifdef RS_MEMPROFILE
+  atexit(memprofile_report);
+#endif
+
   open_authorizations("r");
 
+  if(open_authorization_snapshot() != 0) {
+    log_info("No authorization snapshot found, publishing one.");
+    if(publish_authorization_snapshot() != 0 ||
+       open_authorization_snapshot() != 0) {
+      log_warn("Failed to open authorization snapshot, using database instead.");
+    }
+  }
+
+  init_user_cache();
+
   init_webfinger();
 
   /** OPEN MAGIC DATABASE **/
@@ -186,11 +225,21 @@ int main(int argc, char **argv) {
   evhtp_set_cb(server, "/.well-known/host-meta", webfinger_cb, NULL);
   evhtp_set_cb(server, "/.well-known/host-meta.json", webfinger_cb, NULL);
 
-  /* REMOTESTORAGE */
+  /* METRICS */
 
-  evhtp_callback_t *storage_cb = evhtp_set_regex_cb(server, "^/storage/([^/]+)/.*$", handle_storage, NULL);
+  if(RS_METRICS_ENABLED) {
+    evhtp_set_cb(server, RS_METRICS_PATH, handle_metrics, NULL);
+  }
+
+  /* STALL DETECTOR (also measures event loop lag for metrics) */
+
+  if(RS_METRICS_ENABLED || RS_STALL_THRESHOLD > 0) {
+    start_stall_detector(rs_event_base);
+  }
+
+  /* REMOTESTORAGE */
 
-  evhtp_set_hook(&storage_cb->hooks, evhtp_hook_on_request_fini, finish_request, NULL);
+  evhtp_set_regex_cb(server, "^/storage/([^/]+)/.*$", handle_storage, NULL);
 
   if(evhtp_bind_sockaddr(server, (struct sockaddr*)&sin, sizeof(sin), 1024) != 0) {
     log_error("evhtp_bind_sockaddr() failed: %s", strerror(errno));
@@ -212,6 +261,22 @@ int main(int argc, char **argv) {
                                          handle_signal, NULL);
   event_add(signal_event, NULL);
 
+  /** WATCH AUTHORIZATION SNAPSHOT **/
+
+  struct timeval snapshot_interval = { RS_AUTH_SNAPSHOT_CHECK_INTERVAL, 0 };
+  struct event *snapshot_event = event_new(rs_event_base, -1, EV_PERSIST,
+                                           check_authorization_snapshot, NULL);
+  event_add(snapshot_event, &snapshot_interval);
+
+  /** FLUSH ACCESS LOG **/
+
+  if(RS_ACCESS_LOG) {
+    struct timeval flush_interval = { 1, 0 };
+    struct event *flush_event = event_new(rs_event_base, -1, EV_PERSIST,
+                                          flush_access_log_cb, NULL);
+    event_add(flush_event, &flush_interval);
+  }
+
   /** RUN EVENT LOOP **/
 
   if(RS_DETACH) {
@@ -225,6 +290,8 @@ int main(int argc, char **argv) {
         freopen("/dev/null", "r", stderr);
       }
 
+      start_log_writer();
+
       return event_base_dispatch(rs_event_base);
     } else {
       printf("rs-serve detached with pid %d\n", pid);
@@ -239,6 +306,7 @@ int main(int argc, char **argv) {
       fprintf(RS_PID_FILE, "%d", getpid());
       fflush(RS_PID_FILE);
     }
+    start_log_writer();
     return event_base_dispatch(rs_event_base);
   }
 }
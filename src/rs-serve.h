@@ -66,7 +66,18 @@
 #include "config.h"
 
 #include "common/log.h"
+#include "common/arena.h"
+#include "common/cache.h"
+#include "common/compress.h"
+#include "common/path.h"
+#include "common/precondition.h"
+#include "common/range.h"
 #include "common/user.h"
+#include "common/memprofile.h"
+#include "common/request.h"
+#include "common/access_log.h"
+#include "common/metrics.h"
+#include "common/stall.h"
 #include "common/auth.h"
 #include "common/json.h"
 #include "common/attributes.h"
@@ -75,9 +86,13 @@
 #include "handler/dispatch.h"
 #include "handler/storage.h"
 #include "handler/webfinger.h"
+#include "handler/metrics.h"
 
 extern magic_t magic_cookie;
 
+// number of storage requests currently being processed (see process/main.c)
+extern unsigned int request_count;
+
 // users with UIDs that don't pass this test don't exist for rs-serve.
 #define UID_ALLOWED(uid) ( (uid) >= RS_MIN_UID )
 
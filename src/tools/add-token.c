@@ -55,6 +55,9 @@ int main(int argc, char **argv) {
     auth.scopes.ptr[i-3] = scope;
   }
   add_authorization(&auth);
+  if(publish_authorization_snapshot() != 0) {
+    fprintf(stderr, "Failed to publish authorization snapshot!\n");
+  }
   print_authorization(&auth);
   printf("\n");
   close_authorizations();
@@ -37,6 +37,9 @@ int main(int argc, char **argv) {
   auth.username = argv[1];
   auth.token = argv[2];
   int success = remove_authorization(&auth);
+  if(success == 0 && publish_authorization_snapshot() != 0) {
+    fprintf(stderr, "Failed to publish authorization snapshot!\n");
+  }
   close_authorizations();
   fprintf(stderr, (success == DB_NOTFOUND) ? "Token not found!\n" : (success == 0 ? "Token removed.\n" : "Error removing token!\n"));
   return success;
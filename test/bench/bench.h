@@ -0,0 +1,81 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RS_BENCH_H
+#define RS_BENCH_H
+
+/**
+ * File: bench.h
+ *
+ * Minimal helpers for microbenchmarks. Each BENCH() prints a single line:
+ *
+ *   bench <name> <iterations> <ns per iteration>
+ *
+ * Results should be assigned to `bench_sink', so the compiler can't
+ * optimize the measured code away.
+ *
+ * Iteration counts are fixed per benchmark (so results of different runs are
+ * comparable). Benchmarks that need files create them in a temporary
+ * directory below the current one (see bench_tmpdir()), since the file
+ * system must support extended attributes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <ftw.h>
+#include <limits.h>
+
+static volatile long bench_sink;
+
+static long long bench_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int bench_remove_entry(const char *path, const struct stat *stat_buf,
+                              int type, struct FTW *ftw) {
+  return remove(path);
+}
+
+// creates a temporary directory and returns it's absolute path. The
+// directory and everything in it is removed again at exit.
+static char bench_tmpdir_path[PATH_MAX];
+
+static void bench_remove_tmpdir() {
+  nftw(bench_tmpdir_path, bench_remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static inline const char *bench_tmpdir() {
+  char template[] = "bench-XXXXXX";
+  if(mkdtemp(template) == NULL ||
+     realpath(template, bench_tmpdir_path) == NULL) {
+    perror("Failed to create temporary directory");
+    exit(EXIT_FAILURE);
+  }
+  atexit(bench_remove_tmpdir);
+  return bench_tmpdir_path;
+}
+
+#define BENCH(name, iterations, body) {                                 \
+    long bench_i, bench_n = (iterations);                               \
+    long long bench_start = bench_now_ns();                             \
+    for(bench_i = 0; bench_i < bench_n; bench_i++) {                    \
+      body;                                                             \
+    }                                                                   \
+    long long bench_elapsed = bench_now_ns() - bench_start;             \
+    printf("bench %s %ld %.1f\n", name, bench_n,                        \
+           (double)bench_elapsed / bench_n);                            \
+  }
+
+#endif /* !RS_BENCH_H */
@@ -0,0 +1,142 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmarks get_etag() on files and directories of various sizes, both
+ * "cold" (etag attribute removed before each call, so it is recalculated)
+ * and "cached" (read back from the attribute), as well as
+ * content_type_from_xattr().
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <attr/xattr.h>
+
+#include "common/arena.h"
+#include "common/attributes.h"
+#include "bench.h"
+
+static struct rs_arena arena;
+
+static int create_file(int dir_fd, const char *name, size_t size) {
+  char buf[4096];
+  memset(buf, 'x', sizeof(buf));
+  int fd = openat(dir_fd, name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if(fd == -1) {
+    perror("openat() failed");
+    exit(EXIT_FAILURE);
+  }
+  while(size > 0) {
+    size_t count = size < sizeof(buf) ? size : sizeof(buf);
+    if(write(fd, buf, count) != count) {
+      perror("write() failed");
+      exit(EXIT_FAILURE);
+    }
+    size -= count;
+  }
+  return fd;
+}
+
+static void bench_etag(const char *name, int fd, long iterations) {
+  char bench_name[64];
+  sprintf(bench_name, "get_etag/%s/cold", name);
+  BENCH(bench_name, iterations, {
+      fremovexattr(fd, "user.etag");
+      char *etag = get_etag(fd, &arena);
+      bench_sink += etag[0];
+      arena_release(&arena);
+    });
+  sprintf(bench_name, "get_etag/%s/cached", name);
+  BENCH(bench_name, iterations, {
+      char *etag = get_etag(fd, &arena);
+      bench_sink += etag[0];
+      arena_release(&arena);
+    });
+}
+
+int main(int argc, char **argv) {
+  int root_fd = open(bench_tmpdir(), O_RDONLY | O_DIRECTORY);
+  struct {
+    const char *name;
+    size_t size;
+    long iterations;
+  } files[] = {
+    { "file-0", 0, 100000 },
+    { "file-1k", 1024, 100000 },
+    { "file-64k", 64 * 1024, 10000 },
+    { "file-1m", 1024 * 1024, 500 },
+  };
+  struct {
+    const char *name;
+    int entries;
+    long iterations;
+  } dirs[] = {
+    { "dir-10", 10, 10000 },
+    { "dir-100", 100, 1000 },
+    { "dir-1000", 1000, 100 },
+  };
+  char name[64];
+  int i, j, fd;
+
+  arena_init(&arena);
+
+  for(i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+    fd = create_file(root_fd, files[i].name, files[i].size);
+    char *etag = get_etag(fd, &arena);
+    if(etag == NULL) {
+      fprintf(stderr, "get_etag() failed. Does the file system support extended attributes?\n");
+      exit(EXIT_FAILURE);
+    }
+    arena_release(&arena);
+    if(i == 0 && fgetxattr(fd, "user.etag", NULL, 0) < 0) {
+      fprintf(stderr, "warning: extended attributes not supported here, \"cached\" results are meaningless.\n");
+    }
+    bench_etag(files[i].name, fd, files[i].iterations);
+    close(fd);
+  }
+
+  // directories: "cold" renews the directory's stamp, which must not depend
+  // on the number of entries.
+  for(i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+    if(mkdirat(root_fd, dirs[i].name, 0700) != 0) {
+      perror("mkdirat() failed");
+      exit(EXIT_FAILURE);
+    }
+    int dir_fd = openat(root_fd, dirs[i].name, O_RDONLY | O_DIRECTORY);
+    for(j = 0; j < dirs[i].entries; j++) {
+      sprintf(name, "%d.json", j);
+      fd = create_file(dir_fd, name, 1024);
+      get_etag(fd, &arena);
+      arena_release(&arena);
+      close(fd);
+    }
+    bench_etag(dirs[i].name, dir_fd, dirs[i].iterations);
+    close(dir_fd);
+  }
+
+  fd = create_file(root_fd, "typed", 0);
+  content_type_to_xattr(fd, "application/json; charset=UTF-8", &arena);
+  BENCH("content_type_from_xattr", 100000, {
+      char *content_type = content_type_from_xattr(fd, &arena);
+      bench_sink += content_type[0];
+      arena_release(&arena);
+    });
+  close(fd);
+
+  close(root_fd);
+  return 0;
+}
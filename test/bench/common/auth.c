@@ -0,0 +1,112 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmarks token lookups (through the database and through the snapshot),
+ * unpack_authorization() and scope_matches().
+ */
+
+#define _GNU_SOURCE
+
+#include <db.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "common/auth.h"
+#include "bench.h"
+
+// privates.
+void pack_authorization(DBT *dest, struct rs_authorization *src);
+int unpack_authorization(struct rs_authorization *dest, DBT *src);
+
+#define AUTH_COUNT 1000
+
+static struct rs_scope contacts = { .name = "contacts", .write = 1 };
+static struct rs_scope documents = { .name = "documents", .write = 0 };
+static struct rs_scope root = { .name = "", .write = 0 };
+static struct rs_scope *scope_ptr[] = { &contacts, &documents, &root };
+
+static void bench_lookup(const char *name, long iterations) {
+  char username[32], token[32];
+  long i = 0;
+  BENCH(name, iterations, {
+      sprintf(username, "user%ld", i % AUTH_COUNT);
+      sprintf(token, "token%ld", i % AUTH_COUNT);
+      i++;
+      struct rs_authorization *auth = lookup_authorization(username, token);
+      bench_sink += auth->scopes.count;
+      free_authorization(auth);
+      free(auth);
+    });
+}
+
+int main(int argc, char **argv) {
+  struct rs_authorization auth = {
+    .scopes = { .count = 3, .ptr = scope_ptr }
+  };
+  char username[32], token[32];
+  int i;
+
+  if(chdir(bench_tmpdir()) != 0 ||
+     mkdir("var", 0700) != 0 ||
+     mkdir(RS_AUTH_DB_PATH, 0700) != 0) {
+    perror("Failed to create database directory");
+    exit(EXIT_FAILURE);
+  }
+  open_authorizations("w");
+  for(i = 0; i < AUTH_COUNT; i++) {
+    sprintf(username, "user%d", i);
+    sprintf(token, "token%d", i);
+    auth.username = username;
+    auth.token = token;
+    add_authorization(&auth);
+  }
+
+  bench_lookup("lookup_authorization/db", 100000);
+
+  if(publish_authorization_snapshot() != 0 ||
+     open_authorization_snapshot() != 0) {
+    fprintf(stderr, "Failed to publish authorization snapshot\n");
+    exit(EXIT_FAILURE);
+  }
+  bench_lookup("lookup_authorization/snapshot", 1000000);
+  close_authorization_snapshot();
+  close_authorizations();
+
+  DBT dbt;
+  memset(&dbt, 0, sizeof(DBT));
+  auth.username = "user";
+  auth.token = "token";
+  pack_authorization(&dbt, &auth);
+  BENCH("unpack_authorization", 1000000, {
+      struct rs_authorization unpacked;
+      unpack_authorization(&unpacked, &dbt);
+      bench_sink += unpacked.scopes.count;
+      free_authorization(&unpacked);
+    });
+  free(dbt.data);
+
+  BENCH("scope_matches/root", 10000000, {
+      bench_sink += scope_matches(&root, "/contacts/cards/1234.vcf", 0);
+    });
+  BENCH("scope_matches/hit", 10000000, {
+      bench_sink += scope_matches(&contacts, "/contacts/cards/1234.vcf", 1);
+    });
+  BENCH("scope_matches/miss", 10000000, {
+      bench_sink += scope_matches(&documents, "/contacts/cards/1234.vcf", 0);
+    });
+  return 0;
+}
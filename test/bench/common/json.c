@@ -0,0 +1,71 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmarks json_write_key_val() and the serialization of directory
+ * listings (as done by serve_directory()) into an evbuffer.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdlib.h>
+#include <event2/buffer.h>
+
+#include "common/json.h"
+#include "bench.h"
+
+static const char *etag = "f572d396fae9206628714fb2ce00f72e94f2258f";
+
+static void bench_listing(const char *name, int entries, long iterations) {
+  struct evbuffer *buf = evbuffer_new();
+  char key[32];
+  int i;
+  BENCH(name, iterations, {
+      struct json json;
+      json_init(&json, buf);
+      json_start_object(&json);
+      for(i = 0; i < entries; i++) {
+        sprintf(key, "%d.json", i);
+        json_write_key_val(&json, key, etag);
+      }
+      json_end_object(&json);
+      bench_sink += evbuffer_get_length(buf);
+      evbuffer_drain(buf, evbuffer_get_length(buf));
+    });
+  evbuffer_free(buf);
+}
+
+int main(int argc, char **argv) {
+  struct evbuffer *buf = evbuffer_new();
+  struct json json;
+  json_init(&json, buf);
+  json_start_object(&json);
+  BENCH("json_write_key_val/plain", 1000000, {
+      json_write_key_val(&json, "1234567890.vcf", etag);
+      evbuffer_drain(buf, evbuffer_get_length(buf));
+    });
+  BENCH("json_write_key_val/long", 1000000, {
+      json_write_key_val(&json, "a-somewhat-longer-document-name-without-any-special-characters.json", etag);
+      evbuffer_drain(buf, evbuffer_get_length(buf));
+    });
+  BENCH("json_write_key_val/escaped", 1000000, {
+      json_write_key_val(&json, "\"quoted\" \\ name\twith\ncontrol\001characters", etag);
+      evbuffer_drain(buf, evbuffer_get_length(buf));
+    });
+  evbuffer_free(buf);
+
+  bench_listing("directory/10", 10, 100000);
+  bench_listing("directory/100", 100, 10000);
+  bench_listing("directory/1000", 1000, 1000);
+  return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compares path_normalize() with the strstr() / memmove() loops that
+ * make_disk_path() used before, on short, deep and slash-heavy paths.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "common/path.h"
+#include "bench.h"
+
+static void legacy_normalize(char *path) {
+  char *pos = NULL;
+  while((pos = strstr(path, "/..")) != NULL) {
+    int restlen = strlen(pos + 3);
+    memmove(pos, pos + 3, restlen);
+    pos[restlen] = 0;
+  }
+  while((pos = strstr(path, "//")) != NULL) {
+    int restlen = strlen(pos + 2);
+    memmove(pos, pos + 2, restlen);
+    pos[restlen] = 0;
+  }
+}
+
+static char *repeat(const char *segment, int count) {
+  size_t len = strlen(segment);
+  char *result = malloc(len * count + 1);
+  int i;
+  for(i = 0; i < count; i++) {
+    memcpy(result + i * len, segment, len);
+  }
+  result[len * count] = 0;
+  return result;
+}
+
+int main(int argc, char **argv) {
+  long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+  struct rs_path path;
+  struct {
+    const char *name;
+    char *input;
+  } inputs[] = {
+    { "short", strdup("/contacts/cards/1234567890.vcf") },
+    { "deep", repeat("/segment", 100) },
+    { "slashes", repeat("//x", 100) },
+  };
+  size_t max_len = strlen(inputs[2].input) + strlen(inputs[1].input);
+  char *buf = malloc(max_len + 1);
+  char name[64];
+  int i;
+  for(i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+    size_t len = strlen(inputs[i].input) + 1;
+    sprintf(name, "path_normalize/%s", inputs[i].name);
+    BENCH(name, iterations, {
+        memcpy(buf, inputs[i].input, len);
+        bench_sink += path_normalize(buf, &path);
+      });
+    sprintf(name, "legacy_normalize/%s", inputs[i].name);
+    BENCH(name, iterations / 10, {
+        memcpy(buf, inputs[i].input, len);
+        legacy_normalize(buf);
+        bench_sink += buf[0];
+      });
+    free(inputs[i].input);
+  }
+  free(buf);
+  return 0;
+}
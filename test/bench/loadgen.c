@@ -0,0 +1,373 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Load generator
+ * --------------
+ *
+ * Keeps --concurrency keep-alive connections busy with a mix of GET, PUT,
+ * DELETE and directory listing requests against a running rs-serve, then
+ * reports throughput and latency percentiles. Used by scripts/bench.sh.
+ *
+ * Files are named /bench/<n>/<m> (with --files files in total, spread over
+ * directories of 100), and are created before the measurement starts.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <event2/event.h>
+#include <event2/http.h>
+#include <event2/buffer.h>
+#include <event2/keyvalq_struct.h>
+
+enum request_type { REQ_GET, REQ_PUT, REQ_DELETE, REQ_DIR, REQ_TYPE_COUNT };
+static const char *type_names[REQ_TYPE_COUNT] = { "get", "put", "delete", "dir" };
+
+static struct {
+  const char *host;
+  int port;
+  const char *user;
+  const char *token;
+  int concurrency;
+  int duration;
+  int files;
+  int size;
+  int mix[REQ_TYPE_COUNT];
+} options = {
+  "127.0.0.1", 8181, NULL, NULL, 16, 10, 1000, 1024, { 70, 20, 5, 5 }
+};
+
+struct connection {
+  struct evhttp_connection *conn;
+  struct timespec start;
+  enum request_type type;
+  int setup_index; // next file to create during setup, or -1
+};
+
+static struct event_base *base;
+static struct connection *connections;
+static char *payload;
+static int mix_total;
+static int running = 0;
+static int setup_next = 0;
+static int setup_pending = 0;
+static int stopping = 0;
+static int active = 0;
+
+static long long *latencies[REQ_TYPE_COUNT];
+static size_t latency_count[REQ_TYPE_COUNT];
+static size_t latency_capacity[REQ_TYPE_COUNT];
+static unsigned long errors[REQ_TYPE_COUNT];
+static struct timespec run_start;
+
+static void issue(struct connection *c);
+
+static long long now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void record(enum request_type type, long long ns) {
+  if(latency_count[type] == latency_capacity[type]) {
+    latency_capacity[type] = latency_capacity[type] ? latency_capacity[type] * 2 : 4096;
+    latencies[type] = realloc(latencies[type], latency_capacity[type] * sizeof(long long));
+    if(latencies[type] == NULL) {
+      perror("realloc() failed");
+      exit(EXIT_FAILURE);
+    }
+  }
+  latencies[type][latency_count[type]++] = ns;
+}
+
+static void file_path(char *buf, size_t len, int index) {
+  snprintf(buf, len, "/storage/%s/bench/%d/%d", options.user, index / 100, index % 100);
+}
+
+static void request_done(struct evhttp_request *req, void *arg) {
+  struct connection *c = arg;
+  int status = req ? evhttp_request_get_response_code(req) : 0;
+  if(c->setup_index >= 0) {
+    if(status != 200 && status != 201) {
+      fprintf(stderr, "Setup PUT failed (status %d)\n", status);
+      exit(EXIT_FAILURE);
+    }
+    setup_pending--;
+  } else if(running) {
+    long long ns = (long long)(now_ns() - ((long long)c->start.tv_sec * 1000000000LL + c->start.tv_nsec));
+    // DELETEs of files that were already deleted are fine (404).
+    if(status >= 200 && status < 300) {
+      record(c->type, ns);
+    } else if(c->type == REQ_DELETE && status == 404) {
+      record(c->type, ns);
+    } else if(c->type == REQ_GET && status == 404) {
+      record(c->type, ns); // (deleted by the mix)
+    } else {
+      errors[c->type]++;
+    }
+  }
+  issue(c);
+}
+
+static void send_request(struct connection *c, enum evhttp_cmd_type cmd, const char *path, int with_body) {
+  struct evhttp_request *req = evhttp_request_new(request_done, c);
+  struct evkeyvalq *headers = evhttp_request_get_output_headers(req);
+  char auth[256];
+  snprintf(auth, sizeof(auth), "Bearer %s", options.token);
+  evhttp_add_header(headers, "Host", options.host);
+  evhttp_add_header(headers, "Authorization", auth);
+  if(with_body) {
+    evhttp_add_header(headers, "Content-Type", "application/octet-stream");
+    evbuffer_add(evhttp_request_get_output_buffer(req), payload, options.size);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &c->start);
+  if(evhttp_make_request(c->conn, req, cmd, path) != 0) {
+    fprintf(stderr, "evhttp_make_request() failed\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static enum request_type pick_type() {
+  int r = rand() % mix_total, i;
+  for(i = 0; i < REQ_TYPE_COUNT; i++) {
+    if(r < options.mix[i]) {
+      return i;
+    }
+    r -= options.mix[i];
+  }
+  return REQ_GET;
+}
+
+static void issue(struct connection *c) {
+  char path[256];
+  if(! running) {
+    // setup: create all files first
+    if(setup_next < options.files) {
+      c->setup_index = setup_next++;
+      setup_pending++;
+      file_path(path, sizeof(path), c->setup_index);
+      send_request(c, EVHTTP_REQ_PUT, path, 1);
+    } else {
+      c->setup_index = -1;
+      if(setup_pending == 0 && ! running) {
+        running = 1;
+        clock_gettime(CLOCK_MONOTONIC, &run_start);
+        int i;
+        for(i = 0; i < options.concurrency; i++) {
+          issue(&connections[i]);
+        }
+      }
+    }
+    return;
+  }
+  c->setup_index = -1;
+  if(stopping) {
+    if(--active == 0) {
+      event_base_loopexit(base, NULL);
+    }
+    return;
+  }
+  c->type = pick_type();
+  int index = rand() % options.files;
+  switch(c->type) {
+  case REQ_GET:
+    file_path(path, sizeof(path), index);
+    send_request(c, EVHTTP_REQ_GET, path, 0);
+    break;
+  case REQ_PUT:
+    file_path(path, sizeof(path), index);
+    send_request(c, EVHTTP_REQ_PUT, path, 1);
+    break;
+  case REQ_DELETE:
+    file_path(path, sizeof(path), index);
+    send_request(c, EVHTTP_REQ_DELETE, path, 0);
+    break;
+  case REQ_DIR:
+    snprintf(path, sizeof(path), "/storage/%s/bench/%d/", options.user, index / 100);
+    send_request(c, EVHTTP_REQ_GET, path, 0);
+    break;
+  default:
+    break;
+  }
+}
+
+static void stop_run(evutil_socket_t fd, short events, void *arg) {
+  stopping = 1;
+}
+
+static int compare_ll(const void *a, const void *b) {
+  long long x = *(const long long*)a, y = *(const long long*)b;
+  return x < y ? -1 : x > y;
+}
+
+static double percentile(long long *sorted, size_t count, double p) {
+  if(count == 0) {
+    return 0;
+  }
+  size_t index = (size_t)(p * (count - 1) + 0.5);
+  return sorted[index] / 1e6;
+}
+
+static void report_line(const char *name, long long *values, size_t count,
+                        unsigned long error_count, double elapsed) {
+  qsort(values, count, sizeof(long long), compare_ll);
+  printf("%-8s %10zu %8lu %12.1f %9.3f %9.3f %9.3f %9.3f\n", name, count, error_count,
+         count / elapsed, percentile(values, count, 0.5), percentile(values, count, 0.99),
+         percentile(values, count, 0.999), count ? values[count - 1] / 1e6 : 0);
+}
+
+static void parse_mix(char *mix) {
+  char *saveptr = NULL, *item;
+  memset(options.mix, 0, sizeof(options.mix));
+  for(item = strtok_r(mix, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+    char *eq = strchr(item, '=');
+    int i;
+    if(eq == NULL) {
+      fprintf(stderr, "Invalid mix item: %s\n", item);
+      exit(127);
+    }
+    *eq = 0;
+    for(i = 0; i < REQ_TYPE_COUNT; i++) {
+      if(strcmp(item, type_names[i]) == 0) {
+        options.mix[i] = atoi(eq + 1);
+        break;
+      }
+    }
+    if(i == REQ_TYPE_COUNT) {
+      fprintf(stderr, "Unknown request type in mix: %s\n", item);
+      exit(127);
+    }
+  }
+}
+
+static void print_usage(const char *progname) {
+  fprintf(stderr,
+          "Usage: %s --user=<user> --token=<token> [options]\n"
+          "\n"
+          "Options:\n"
+          "  --host=<host>         (default: 127.0.0.1)\n"
+          "  --port=<port>         (default: 8181)\n"
+          "  --concurrency=<n>     Number of keep-alive connections (default: 16)\n"
+          "  --duration=<seconds>  (default: 10)\n"
+          "  --files=<n>           Number of files to work on (default: 1000)\n"
+          "  --size=<bytes>        Size of PUT bodies (default: 1024)\n"
+          "  --mix=<type>=<weight>,...  Request mix, types: get, put, delete, dir\n"
+          "                        (default: get=70,put=20,delete=5,dir=5)\n",
+          progname);
+}
+
+int main(int argc, char **argv) {
+  static struct option long_options[] = {
+    { "host", required_argument, 0, 'H' },
+    { "port", required_argument, 0, 'p' },
+    { "user", required_argument, 0, 'u' },
+    { "token", required_argument, 0, 't' },
+    { "concurrency", required_argument, 0, 'c' },
+    { "duration", required_argument, 0, 'd' },
+    { "files", required_argument, 0, 'f' },
+    { "size", required_argument, 0, 's' },
+    { "mix", required_argument, 0, 'm' },
+    { "help", no_argument, 0, 'h' },
+    { 0, 0, 0, 0 }
+  };
+  int opt;
+  while((opt = getopt_long(argc, argv, "H:p:u:t:c:d:f:s:m:h", long_options, NULL)) != -1) {
+    switch(opt) {
+    case 'H': options.host = optarg; break;
+    case 'p': options.port = atoi(optarg); break;
+    case 'u': options.user = optarg; break;
+    case 't': options.token = optarg; break;
+    case 'c': options.concurrency = atoi(optarg); break;
+    case 'd': options.duration = atoi(optarg); break;
+    case 'f': options.files = atoi(optarg); break;
+    case 's': options.size = atoi(optarg); break;
+    case 'm': parse_mix(optarg); break;
+    default:
+      print_usage(argv[0]);
+      exit(127);
+    }
+  }
+  int i;
+  for(i = 0, mix_total = 0; i < REQ_TYPE_COUNT; i++) {
+    mix_total += options.mix[i];
+  }
+  if(options.user == NULL || options.token == NULL || options.concurrency < 1 ||
+     options.files < 1 || mix_total < 1) {
+    print_usage(argv[0]);
+    exit(127);
+  }
+
+  payload = malloc(options.size);
+  memset(payload, 'x', options.size);
+  srand(getpid());
+
+  base = event_base_new();
+  connections = calloc(options.concurrency, sizeof(struct connection));
+  for(i = 0; i < options.concurrency; i++) {
+    connections[i].conn = evhttp_connection_base_new(base, NULL, options.host, options.port);
+    if(connections[i].conn == NULL) {
+      fprintf(stderr, "Failed to create connection\n");
+      exit(EXIT_FAILURE);
+    }
+    connections[i].setup_index = -1;
+  }
+  active = options.concurrency;
+
+  struct timeval duration = { options.duration, 0 };
+  for(i = 0; i < options.concurrency; i++) {
+    issue(&connections[i]);
+  }
+  // (the timer is started once setup is complete)
+  while(! running) {
+    event_base_loop(base, EVLOOP_ONCE);
+  }
+  struct event *stop_event = evtimer_new(base, stop_run, NULL);
+  evtimer_add(stop_event, &duration);
+  event_base_dispatch(base);
+
+  double elapsed = (now_ns() - ((long long)run_start.tv_sec * 1000000000LL + run_start.tv_nsec)) / 1e9;
+
+  printf("concurrency: %d, duration: %.1fs, files: %d, size: %d bytes\n",
+         options.concurrency, elapsed, options.files, options.size);
+  printf("%-8s %10s %8s %12s %9s %9s %9s %9s\n", "type", "requests", "errors",
+         "req/s", "p50(ms)", "p99(ms)", "p99.9(ms)", "max(ms)");
+  size_t total_count = 0;
+  unsigned long total_errors = 0;
+  for(i = 0; i < REQ_TYPE_COUNT; i++) {
+    total_count += latency_count[i];
+    total_errors += errors[i];
+  }
+  long long *all = malloc((total_count + 1) * sizeof(long long));
+  size_t offset = 0;
+  for(i = 0; i < REQ_TYPE_COUNT; i++) {
+    if(latency_count[i] == 0 && errors[i] == 0) {
+      continue;
+    }
+    memcpy(all + offset, latencies[i], latency_count[i] * sizeof(long long));
+    offset += latency_count[i];
+    report_line(type_names[i], latencies[i], latency_count[i], errors[i], elapsed);
+  }
+  report_line("total", all, total_count, total_errors, elapsed);
+
+  for(i = 0; i < options.concurrency; i++) {
+    evhttp_connection_free(connections[i].conn);
+  }
+  event_base_free(base);
+  return total_errors > 0 ? 1 : 0;
+}
@@ -0,0 +1,24 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Stand-ins for the server's logging and configuration, so modules using
+ * them can be benchmarked in isolation (and without measuring log output).
+ */
+
+int rs_use_xattr = 1;
+
+void log_info(char *format, ...) {}
+void log_warn(char *format, ...) {}
+void log_error(char *format, ...) {}
+void dont_log_debug(const char *file, int line, char *format, ...) {}
+void (*current_log_debug)(const char *file, int line, char *format, ...) = dont_log_debug;
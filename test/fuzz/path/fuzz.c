@@ -0,0 +1,88 @@
+/*
+ * rs-serve - (c) 2013 Niklas E. Cathor
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Fuzz target for path_normalize().
+ *
+ * Build with clang -fsanitize=fuzzer,address -DLIBFUZZER (see "make fuzz-path"),
+ * or without -DLIBFUZZER to get a program that replays the files given on
+ * the command line (such as the ones in test/fuzz/path/corpus/).
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "common/path.h"
+
+#define CHECK(cond) if(! (cond)) { fprintf(stderr, "check failed: %s\n", #cond); abort(); }
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  char *input = malloc(size + 1);
+  memcpy(input, data, size);
+  input[size] = 0;
+  char *copy = strdup(input);
+  struct rs_path path;
+  if(path_normalize(input, &path) == 0) {
+    CHECK(path.path[0] == '/');
+    CHECK(path.len == strlen(path.path));
+    CHECK(strstr(path.path, "//") == NULL);
+    CHECK(! path_has_dot_segments(path.path));
+    CHECK(path.is_dir == (path.path[path.len - 1] == '/'));
+    int i;
+    for(i = 0; i < path.segment_count; i++) {
+      CHECK(path.segments[i].len > 0);
+      CHECK(path.path[path.segments[i].offset - 1] == '/');
+      CHECK(memchr(path.path + path.segments[i].offset, '/', path.segments[i].len) == NULL);
+      char c = path_cut(&path, i);
+      CHECK(strlen(path.path) == path.segments[i].offset + path.segments[i].len);
+      path_uncut(&path, i, c);
+    }
+    // normalizing again must not change anything
+    struct rs_path again;
+    char *normalized = strdup(path.path);
+    CHECK(path_normalize(normalized, &again) == 0);
+    CHECK(strcmp(normalized, path.path) == 0);
+    CHECK(again.segment_count == path.segment_count);
+    free(normalized);
+  } else {
+    // only invalid paths may be rejected
+    CHECK(copy[0] != '/' || path_has_dot_segments(copy) ||
+          (size_t)RS_PATH_MAX_SEGMENTS < size / 2);
+  }
+  free(copy);
+  free(input);
+  return 0;
+}
+
+#ifndef LIBFUZZER
+int main(int argc, char **argv) {
+  int i;
+  for(i = 1; i < argc; i++) {
+    FILE *fp = fopen(argv[i], "r");
+    if(fp == NULL) {
+      perror(argv[i]);
+      return 1;
+    }
+    char buf[65536];
+    size_t size = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    LLVMFuzzerTestOneInput((uint8_t*)buf, size);
+  }
+  printf("replayed %d inputs\n", argc - 1);
+  return 0;
+}
+#endif
@@ -2,7 +2,7 @@
 
 mkdir -p tmp/
 
-./rs-serve --hostname test.host --port 8123 > tmp/test-server.log 2>&1 &
+./rs-serve --hostname test.host --port 8123 --precompress > tmp/test-server.log 2>&1 &
 sleep 1
 
 GET() {
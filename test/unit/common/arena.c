@@ -0,0 +1,75 @@
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "common/arena.h"
+
+#define SUITE(desc) {                           \
+    printf("\nSuite: %s\n", desc);              \
+  }
+#define TEST(desc, run) {                       \
+    printf("  Test: %s ", desc);                \
+    run();                                      \
+    printf(" OK.\n\n");                         \
+  }
+#define FAIL_ASSERTION(a, b) {                      \
+    printf("\nAssertion failed: %s != %s (%s:%d)\n", a, b, __FILE__, __LINE__);  \
+    abort();                                        \
+  }
+#define ASSERT_S(a, b)                          \
+  if(strcmp((a), (b)) == 0) {                   \
+    printf(".");                                \
+  } else {                                      \
+    FAIL_ASSERTION(__STRING(a), __STRING(b));   \
+  }
+#define ASSERT_N(a, b)                          \
+  if((a) == (b)) {                              \
+    printf(".");                                \
+  } else {                                      \
+    FAIL_ASSERTION(__STRING(a), __STRING(b));   \
+  }
+
+static struct rs_arena arena;
+
+void test_alloc() {
+  arena_init(&arena);
+  char *foo = arena_strdup(&arena, "foo");
+  char *bar = arena_strdup(&arena, "bar");
+  ASSERT_S(foo, "foo");
+  ASSERT_S(bar, "bar");
+  ASSERT_N((uintptr_t)bar % 16, 0);
+  // larger than the inline block, and larger than a regular block
+  char *big = arena_alloc(&arena, RS_ARENA_INLINE_SIZE);
+  memset(big, 'x', RS_ARENA_INLINE_SIZE);
+  char *huge = arena_alloc(&arena, RS_ARENA_BLOCK_SIZE * 2);
+  memset(huge, 'y', RS_ARENA_BLOCK_SIZE * 2);
+  ASSERT_N(big[RS_ARENA_INLINE_SIZE - 1], 'x');
+  ASSERT_S(foo, "foo");
+  arena_release(&arena);
+  ASSERT_N(arena.blocks, NULL);
+}
+
+void test_mark_reset() {
+  arena_init(&arena);
+  arena_strdup(&arena, "before");
+  struct rs_arena_mark mark = arena_mark(&arena);
+  char *first = arena_strdup(&arena, "first");
+  int i;
+  for(i = 0; i < 100; i++) {
+    arena_alloc(&arena, 512);
+  }
+  arena_reset(&arena, mark);
+  ASSERT_N(arena.blocks, NULL);
+  ASSERT_N(arena_strdup(&arena, "again"), first);
+  arena_release(&arena);
+}
+
+int main(int argc, char **argv) {
+  SUITE("Arena");
+  TEST("allocation", test_alloc);
+  TEST("mark / reset", test_mark_reset);
+  return 0;
+}
@@ -0,0 +1,94 @@
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "common/arena.h"
+#include "common/attributes.h"
+
+#define SUITE(desc) {                           \
+    printf("\nSuite: %s\n", desc);              \
+  }
+#define TEST(desc, run) {                       \
+    printf("  Test: %s ", desc);                \
+    run();                                      \
+    printf(" OK.\n\n");                         \
+  }
+#define FAIL_ASSERTION(a, b) {                      \
+    printf("\nAssertion failed: %s != %s (%s:%d)\n", a, b, __FILE__, __LINE__);  \
+    abort();                                        \
+  }
+#define ASSERT_S(a, b)                          \
+  if(strcmp((a), (b)) == 0) {                   \
+    printf(".");                                \
+  } else {                                      \
+    FAIL_ASSERTION(__STRING(a), __STRING(b));   \
+  }
+#define ASSERT_N(a, b)                          \
+  if((a) == (b)) {                              \
+    printf(".");                                \
+  } else {                                      \
+    FAIL_ASSERTION(__STRING(a), __STRING(b));   \
+  }
+
+// (the file system of the current directory must support user xattrs)
+static char tmpdir[] = "attributes-XXXXXX";
+static char path[64];
+static struct rs_arena arena;
+
+// stores `content_type' like a PUT does, and returns what a GET reads back.
+static char *round_trip(const char *content_type) {
+  int fd = open(path, O_RDWR | O_CREAT, 0600);
+  ASSERT_N(fd != -1, 1);
+  ASSERT_N(content_type_to_xattr(fd, content_type, &arena), 0);
+  char *result = content_type_from_xattr(fd, &arena);
+  close(fd);
+  ASSERT_N(result != NULL, 1);
+  return result;
+}
+
+void test_with_charset() {
+  ASSERT_S(round_trip("text/plain; charset=ISO-8859-1"), "text/plain; charset=ISO-8859-1");
+  ASSERT_S(round_trip("application/octet-stream; charset=binary"),
+           "application/octet-stream; charset=binary");
+}
+
+void test_without_charset() {
+  ASSERT_S(round_trip("application/json"), "application/json; charset=UTF-8");
+  ASSERT_S(round_trip("image/png; foo=bar"), "image/png; charset=UTF-8");
+}
+
+// the content type of a cached document (taken from the PUT) must be the
+// same as that of one served from disk.
+void test_stable() {
+  const char *content_types[] = {
+    "application/json", "text/plain;charset=ISO-8859-1", "text/html; charset=utf-8"
+  };
+  int i;
+  for(i = 0; i < sizeof(content_types) / sizeof(char*); i++) {
+    char *stored = round_trip(content_types[i]);
+    ASSERT_S(round_trip(stored), stored);
+  }
+}
+
+int main(int argc, char **argv) {
+  if(mkdtemp(tmpdir) == NULL) {
+    perror("Failed to create temporary directory");
+    abort();
+  }
+  sprintf(path, "%s/document", tmpdir);
+  arena_init(&arena);
+
+  SUITE("Content type attributes");
+  TEST("with charset", test_with_charset);
+  TEST("without charset", test_without_charset);
+  TEST("round trip is stable", test_stable);
+
+  arena_release(&arena);
+  unlink(path);
+  rmdir(tmpdir);
+}
@@ -5,7 +5,10 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
+#include "config.h"
 #include "common/auth.h"
 
 #define SUITE(desc) {                           \
@@ -66,9 +69,145 @@ void test_pack_unpack() {
 void test_store_lookup() {
 }
 
+#define MANY_COUNT 1000
+
+static struct rs_scope snapshot_contacts = { .name = "contacts", .write = 1 };
+static struct rs_scope snapshot_root = { .name = "", .write = 0 };
+static struct rs_scope *snapshot_scope_ptr[2] = { &snapshot_contacts, &snapshot_root };
+
+static void store_authorization(const char *username, const char *token) {
+  struct rs_authorization auth = {
+    .username = (char*)username,
+    .token = (char*)token,
+    .scopes = {
+      .count = 2,
+      .ptr = snapshot_scope_ptr
+    }
+  };
+  ASSERT_N(add_authorization(&auth), 0);
+}
+
+static void delete_authorization(const char *username, const char *token) {
+  struct rs_authorization auth = {
+    .username = (char*)username,
+    .token = (char*)token
+  };
+  ASSERT_N(remove_authorization(&auth), 0);
+}
+
+// returns 1 if the snapshot has an authorization for username / token.
+static int snapshot_has(const char *username, const char *token) {
+  struct rs_authorization *auth = NULL;
+  ASSERT_N(lookup_snapshot_authorization(username, token, &auth), 0);
+  if(auth == NULL) {
+    return 0;
+  }
+  ASSERT_S(auth->username, username);
+  ASSERT_S(auth->token, token);
+  free_authorization(auth);
+  free(auth);
+  return 1;
+}
+
+static void publish_and_reload() {
+  ASSERT_N(publish_authorization_snapshot(), 0);
+  ASSERT_N(reload_authorization_snapshot() >= 0, 1);
+}
+
+void test_snapshot_empty() {
+  publish_and_reload();
+  ASSERT_N(snapshot_has("alice", "token"), 0);
+  ASSERT_N(snapshot_has("", ""), 0);
+}
+
+void test_snapshot_single() {
+  store_authorization("alice", "token");
+  publish_and_reload();
+  struct rs_authorization *auth = NULL;
+  ASSERT_N(lookup_snapshot_authorization("alice", "token", &auth), 0);
+  ASSERT_N(auth != NULL, 1);
+  ASSERT_S(auth->username, "alice");
+  ASSERT_S(auth->token, "token");
+  ASSERT_N(auth->scopes.count, 2);
+  ASSERT_S(auth->scopes.ptr[0]->name, "contacts");
+  ASSERT_N(auth->scopes.ptr[0]->write, 1);
+  ASSERT_S(auth->scopes.ptr[1]->name, "");
+  ASSERT_N(auth->scopes.ptr[1]->write, 0);
+  free_authorization(auth);
+  free(auth);
+}
+
+void test_snapshot_miss() {
+  ASSERT_N(snapshot_has("alice", "tokem"), 0);
+  ASSERT_N(snapshot_has("alice", "toke"), 0);
+  ASSERT_N(snapshot_has("alice", "token2"), 0);
+  ASSERT_N(snapshot_has("bob", "token"), 0);
+  // username is a prefix of the key "alice|token"
+  ASSERT_N(snapshot_has("alic", "e|token"), 0);
+  ASSERT_N(snapshot_has("alice|token", ""), 0);
+  ASSERT_N(snapshot_has("alice", "|token"), 0);
+}
+
+void test_snapshot_many() {
+  char username[32], token[32];
+  int i;
+  // a single slot per key, so most buckets need a displacement > 1.
+  for(i = 0; i < MANY_COUNT; i++) {
+    sprintf(username, "user%d", i);
+    sprintf(token, "token%d", i);
+    store_authorization(username, token);
+  }
+  publish_and_reload();
+  for(i = 0; i < MANY_COUNT; i++) {
+    sprintf(username, "user%d", i);
+    sprintf(token, "token%d", i);
+    if(! snapshot_has(username, token)) {
+      FAIL_ASSERTION(username, token);
+    }
+    sprintf(token, "token%d", (i + 1) % MANY_COUNT);
+    if(snapshot_has(username, token)) {
+      FAIL_ASSERTION(username, token);
+    }
+  }
+  ASSERT_N(snapshot_has("alice", "token"), 1);
+}
+
+void test_snapshot_republish() {
+  delete_authorization("alice", "token");
+  store_authorization("bob", "token");
+  // the lookups above still see the mapped snapshot.
+  ASSERT_N(snapshot_has("alice", "token"), 1);
+  ASSERT_N(snapshot_has("bob", "token"), 0);
+  ASSERT_N(publish_authorization_snapshot(), 0);
+  ASSERT_N(reload_authorization_snapshot(), 1);
+  ASSERT_N(snapshot_has("alice", "token"), 0);
+  ASSERT_N(snapshot_has("bob", "token"), 1);
+  ASSERT_N(snapshot_has("user1", "token1"), 1);
+}
+
 int main(int argc, char **argv) {
   SUITE("Authorization model");
   TEST("packing / unpacking", test_pack_unpack);
   TEST("store / lookup", test_store_lookup);
+
+  char tmpdir[] = "/tmp/rs-serve-auth-XXXXXX";
+  if(mkdtemp(tmpdir) == NULL ||
+     chdir(tmpdir) != 0 ||
+     mkdir("var", 0700) != 0 ||
+     mkdir(RS_AUTH_DB_PATH, 0700) != 0) {
+    perror("Failed to create database directory");
+    abort();
+  }
+  open_authorizations("w");
+
+  SUITE("Authorization snapshot");
+  TEST("empty snapshot", test_snapshot_empty);
+  TEST("single authorization", test_snapshot_single);
+  TEST("wrong token / username", test_snapshot_miss);
+  TEST("many authorizations", test_snapshot_many);
+  TEST("republish", test_snapshot_republish);
+
+  close_authorization_snapshot();
+  close_authorizations();
 }
 
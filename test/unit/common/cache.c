@@ -0,0 +1,104 @@
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "common/cache.h"
+
+#define SUITE(desc) {                           \
+    printf("\nSuite: %s\n", desc);              \
+  }
+#define TEST(desc, run) {                       \
+    printf("  Test: %s ", desc);                \
+    run();                                      \
+    printf(" OK.\n\n");                         \
+  }
+#define FAIL_ASSERTION(a, b) {                      \
+    printf("\nAssertion failed: %s != %s (%s:%d)\n", a, b, __FILE__, __LINE__);  \
+    abort();                                        \
+  }
+#define ASSERT_S(a, b)                          \
+  if(strcmp((a), (b)) == 0) {                   \
+    printf(".");                                \
+  } else {                                      \
+    FAIL_ASSERTION(__STRING(a), __STRING(b));   \
+  }
+#define ASSERT_N(a, b)                          \
+  if((a) == (b)) {                              \
+    printf(".");                                \
+  } else {                                      \
+    FAIL_ASSERTION(__STRING(a), __STRING(b));   \
+  }
+
+static int freed = 0;
+
+static void count_free(void *value) {
+  freed++;
+}
+
+void test_get_set() {
+  struct rs_cache *cache = new_cache(16, 0, count_free);
+  freed = 0;
+  ASSERT_N(cache_get(cache, "foo"), NULL);
+  cache_set(cache, "foo", "bar", 3, 0);
+  cache_set(cache, "baz", "qux", 3, 0);
+  ASSERT_S(cache_get(cache, "foo"), "bar");
+  ASSERT_S(cache_get(cache, "baz"), "qux");
+  cache_set(cache, "foo", "BAR", 3, 0);
+  ASSERT_N(freed, 1);
+  ASSERT_S(cache_get(cache, "foo"), "BAR");
+  cache_remove(cache, "foo");
+  ASSERT_N(freed, 2);
+  ASSERT_N(cache_get(cache, "foo"), NULL);
+  free_cache(cache);
+  ASSERT_N(freed, 3);
+}
+
+void test_lru_eviction() {
+  struct rs_cache *cache = new_cache(2, 0, count_free);
+  freed = 0;
+  cache_set(cache, "a", "1", 1, 0);
+  cache_set(cache, "b", "2", 1, 0);
+  cache_get(cache, "a"); // "b" is now least recently used
+  cache_set(cache, "c", "3", 1, 0);
+  ASSERT_N(freed, 1);
+  ASSERT_N(cache_get(cache, "b"), NULL);
+  ASSERT_S(cache_get(cache, "a"), "1");
+  ASSERT_S(cache_get(cache, "c"), "3");
+  free_cache(cache);
+}
+
+void test_byte_limit() {
+  struct rs_cache *cache = new_cache(0, 4096, NULL);
+  cache_set(cache, "a", "1", 2000, 0);
+  cache_set(cache, "b", "2", 2000, 0);
+  cache_set(cache, "c", "3", 2000, 0);
+  struct rs_cache_stats stats;
+  cache_get_stats(cache, &stats);
+  ASSERT_N(stats.entries, 1);
+  ASSERT_N(stats.evictions, 2);
+  ASSERT_S(cache_get(cache, "c"), "3");
+  free_cache(cache);
+}
+
+void test_expiry() {
+  struct rs_cache *cache = new_cache(16, 0, count_free);
+  freed = 0;
+  cache_set(cache, "old", "1", 1, time(NULL) - 1);
+  cache_set(cache, "new", "2", 1, time(NULL) + 60);
+  ASSERT_N(cache_get(cache, "old"), NULL);
+  ASSERT_N(freed, 1);
+  ASSERT_S(cache_get(cache, "new"), "2");
+  free_cache(cache);
+}
+
+int main(int argc, char **argv) {
+  SUITE("Cache");
+  TEST("get / set / remove", test_get_set);
+  TEST("LRU eviction", test_lru_eviction);
+  TEST("byte limit", test_byte_limit);
+  TEST("expiry", test_expiry);
+}
@@ -0,0 +1,114 @@
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <zlib.h>
+
+#include <event2/buffer.h>
+
+#include "common/compress.h"
+
+#define SUITE(desc) {                           \
+    printf("\nSuite: %s\n", desc);              \
+  }
+#define TEST(desc, run) {                       \
+    printf("  Test: %s ", desc);                \
+    run();                                      \
+    printf(" OK.\n\n");                         \
+  }
+#define FAIL_ASSERTION(a, b) {                      \
+    printf("\nAssertion failed: %s != %s (%s:%d)\n", a, b, __FILE__, __LINE__);  \
+    abort();                                        \
+  }
+#define ASSERT_S(a, b)                          \
+  if(strcmp((a), (b)) == 0) {                   \
+    printf(".");                                \
+  } else {                                      \
+    FAIL_ASSERTION(__STRING(a), __STRING(b));   \
+  }
+#define ASSERT_N(a, b)                          \
+  if((a) == (b)) {                              \
+    printf(".");                                \
+  } else {                                      \
+    FAIL_ASSERTION(__STRING(a), __STRING(b));   \
+  }
+
+void test_negotiate() {
+  ASSERT_N(negotiate_encoding(NULL), RS_ENCODING_IDENTITY);
+  ASSERT_N(negotiate_encoding(""), RS_ENCODING_IDENTITY);
+  ASSERT_N(negotiate_encoding("gzip"), RS_ENCODING_GZIP);
+  ASSERT_N(negotiate_encoding("deflate, GZIP;q=0.5"), RS_ENCODING_GZIP);
+  ASSERT_N(negotiate_encoding("x-gzip"), RS_ENCODING_GZIP);
+  ASSERT_N(negotiate_encoding("*") != RS_ENCODING_IDENTITY, 1);
+  ASSERT_N(negotiate_encoding("gzip;q=0"), RS_ENCODING_IDENTITY);
+  ASSERT_N(negotiate_encoding("*;q=0, gzip ; q=0.000"), RS_ENCODING_IDENTITY);
+  ASSERT_N(negotiate_encoding("*;q=0, identity"), RS_ENCODING_IDENTITY);
+  ASSERT_N(negotiate_encoding("deflate, identity"), RS_ENCODING_IDENTITY);
+#ifdef RS_BROTLI
+  ASSERT_N(negotiate_encoding("gzip, deflate, br"), RS_ENCODING_BROTLI);
+  ASSERT_N(negotiate_encoding("gzip, br;q=0.9"), RS_ENCODING_GZIP);
+#else
+  ASSERT_N(negotiate_encoding("br"), RS_ENCODING_IDENTITY);
+  ASSERT_N(negotiate_encoding("gzip, deflate, br"), RS_ENCODING_GZIP);
+#endif
+}
+
+void test_compressible() {
+  ASSERT_N(compressible_type("text/plain; charset=UTF-8"), 1);
+  ASSERT_N(compressible_type("application/json"), 1);
+  ASSERT_N(compressible_type("application/ld+json"), 1);
+  ASSERT_N(compressible_type("application/activity+json; charset=utf-8"), 1);
+  ASSERT_N(compressible_type("application/atom+xml"), 1);
+  ASSERT_N(compressible_type("image/png"), 0);
+  ASSERT_N(compressible_type("application/octet-stream"), 0);
+  ASSERT_N(compressible_type("application/zip"), 0);
+  ASSERT_N(compressible_type(NULL), 0);
+}
+
+// inflates `in' (gzip) into a string
+static char *gunzip(struct evbuffer *in) {
+  static char out[65536];
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  inflateInit2(&zs, 15 + 16);
+  zs.avail_in = evbuffer_get_length(in);
+  zs.next_in = evbuffer_pullup(in, -1);
+  zs.avail_out = sizeof(out) - 1;
+  zs.next_out = (Bytef*)out;
+  ASSERT_N(inflate(&zs, Z_FINISH), Z_STREAM_END);
+  out[zs.total_out] = 0;
+  inflateEnd(&zs);
+  return out;
+}
+
+void test_stream() {
+  struct rs_compressor compressor;
+  struct evbuffer *in = evbuffer_new();
+  struct evbuffer *out = evbuffer_new();
+  ASSERT_N(compressor_init(&compressor, RS_ENCODING_GZIP, 6), 0);
+  evbuffer_add_printf(in, "{\"items\":{");
+  ASSERT_N(compressor_write_buffer(&compressor, in, out, RS_COMPRESS_SYNC), 0);
+  // (input is left alone)
+  ASSERT_N(evbuffer_get_length(in), 10);
+  evbuffer_drain(in, 10);
+  size_t flushed = evbuffer_get_length(out);
+  ASSERT_N(flushed > 0, 1);
+  evbuffer_add_printf(in, "\"a\":1,");
+  evbuffer_add_printf(in, "\"b\":2}}");
+  ASSERT_N(compressor_write_buffer(&compressor, in, out, RS_COMPRESS_FINISH), 0);
+  ASSERT_N(evbuffer_get_length(out) > flushed, 1);
+  ASSERT_S(gunzip(out), "{\"items\":{\"a\":1,\"b\":2}}");
+  compressor_free(&compressor);
+  evbuffer_free(in);
+  evbuffer_free(out);
+}
+
+int main(int argc, char **argv) {
+  SUITE("Compress");
+  TEST("negotiate encoding", test_negotiate);
+  TEST("compressible types", test_compressible);
+  TEST("streaming gzip", test_stream);
+}
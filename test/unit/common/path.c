@@ -0,0 +1,100 @@
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
+
+#include "common/path.h"
+
+#define SUITE(desc) {                           \
+    printf("\nSuite: %s\n", desc);              \
+  }
+#define TEST(desc, run) {                       \
+    printf("  Test: %s ", desc);                \
+    run();                                      \
+    printf(" OK.\n\n");                         \
+  }
+#define FAIL_ASSERTION(a, b) {                      \
+    printf("\nAssertion failed: %s != %s (%s:%d)\n", a, b, __FILE__, __LINE__);  \
+    abort();                                        \
+  }
+#define ASSERT_S(a, b)                          \
+  if(strcmp((a), (b)) == 0) {                   \
+    printf(".");                                \
+  } else {                                      \
+    FAIL_ASSERTION(__STRING(a), __STRING(b));   \
+  }
+#define ASSERT_N(a, b)                          \
+  if((a) == (b)) {                              \
+    printf(".");                                \
+  } else {                                      \
+    FAIL_ASSERTION(__STRING(a), __STRING(b));   \
+  }
+
+static struct rs_path path;
+
+static int normalize(const char *input, char *buf) {
+  strcpy(buf, input);
+  return path_normalize(buf, &path);
+}
+
+void test_normalize() {
+  char buf[64];
+  ASSERT_N(normalize("/foo/bar", buf), 0);
+  ASSERT_S(path.path, "/foo/bar");
+  ASSERT_N(path.is_dir, 0);
+  ASSERT_N(path.segment_count, 2);
+  ASSERT_N(normalize("//foo///bar//", buf), 0);
+  ASSERT_S(path.path, "/foo/bar/");
+  ASSERT_N(path.len, 9);
+  ASSERT_N(path.is_dir, 1);
+  ASSERT_N(path.segment_count, 2);
+  ASSERT_N(path.segments[1].offset, 5);
+  ASSERT_N(path.segments[1].len, 3);
+  ASSERT_N(normalize("/..bar/.baz/...", buf), 0);
+  ASSERT_S(path.path, "/..bar/.baz/...");
+  ASSERT_N(normalize("", buf), 0);
+  ASSERT_S(path.path, "/");
+  ASSERT_N(path.is_dir, 1);
+  ASSERT_N(path.segment_count, 0);
+}
+
+void test_reject() {
+  char buf[64];
+  ASSERT_N(normalize("/foo/../bar", buf), -1);
+  ASSERT_N(errno, EINVAL);
+  ASSERT_N(normalize("/foo/./bar", buf), -1);
+  ASSERT_N(normalize("/foo/..", buf), -1);
+  ASSERT_N(normalize("/.//", buf), -1);
+  ASSERT_N(normalize("foo", buf), -1);
+  char *deep = malloc(RS_PATH_MAX_SEGMENTS * 2 + 3);
+  int i;
+  for(i = 0; i <= RS_PATH_MAX_SEGMENTS; i++) {
+    deep[i * 2] = '/';
+    deep[i * 2 + 1] = 'a';
+  }
+  deep[i * 2] = 0;
+  ASSERT_N(path_normalize(deep, &path), -1);
+  ASSERT_N(errno, ENAMETOOLONG);
+  free(deep);
+}
+
+void test_cut() {
+  char buf[64];
+  normalize("/foo/bar/baz", buf);
+  char c = path_cut(&path, 1);
+  ASSERT_S(path.path, "/foo/bar");
+  path_uncut(&path, 1, c);
+  ASSERT_S(path.path, "/foo/bar/baz");
+  ASSERT_S(path_basename(&path), "baz");
+}
+
+int main(int argc, char **argv) {
+  SUITE("Path");
+  TEST("normalize", test_normalize);
+  TEST("reject invalid paths", test_reject);
+  TEST("cut / basename", test_cut);
+}
@@ -0,0 +1,139 @@
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "common/precondition.h"
+
+#define SUITE(desc) {                           \
+    printf("\nSuite: %s\n", desc);              \
+  }
+#define TEST(desc, run) {                       \
+    printf("  Test: %s ", desc);                \
+    run();                                      \
+    printf(" OK.\n\n");                         \
+  }
+#define FAIL_ASSERTION(a, b) {                      \
+    printf("\nAssertion failed: %s != %s (%s:%d)\n", a, b, __FILE__, __LINE__);  \
+    abort();                                        \
+  }
+#define ASSERT_S(a, b)                          \
+  if(strcmp((a), (b)) == 0) {                   \
+    printf(".");                                \
+  } else {                                      \
+    FAIL_ASSERTION(__STRING(a), __STRING(b));   \
+  }
+#define ASSERT_N(a, b)                          \
+  if((a) == (b)) {                              \
+    printf(".");                                \
+  } else {                                      \
+    FAIL_ASSERTION(__STRING(a), __STRING(b));   \
+  }
+
+// Sun, 06 Nov 1994 08:49:37 GMT
+#define DATE 784111777
+
+void test_etag_list() {
+  ASSERT_N(etag_list_matches("abc", "abc", 0), 1);
+  ASSERT_N(etag_list_matches("\"abc\"", "abc", 0), 1);
+  ASSERT_N(etag_list_matches("\"x\", \"abc\"", "abc", 0), 1);
+  ASSERT_N(etag_list_matches("x,abc", "abc", 0), 1);
+  ASSERT_N(etag_list_matches("\"abcd\", \"ab\"", "abc", 0), 0);
+  ASSERT_N(etag_list_matches("W/\"abc\"", "abc", 0), 0);
+  ASSERT_N(etag_list_matches("W/\"abc\"", "abc", 1), 1);
+  ASSERT_N(etag_list_matches("*", "abc", 0), 1);
+  ASSERT_N(etag_list_matches("\"abc", "abc", 0), 0);
+  ASSERT_N(etag_list_matches("", "abc", 0), 0);
+  ASSERT_N(etag_list_matches("\"abc-gzip\"", "abc", 0), 0);
+}
+
+void test_dates() {
+  char buf[RS_HTTP_DATE_LEN];
+  ASSERT_N(parse_http_date("Sun, 06 Nov 1994 08:49:37 GMT"), DATE);
+  ASSERT_N(parse_http_date("Sunday, 06-Nov-94 08:49:37 GMT"), DATE);
+  ASSERT_N(parse_http_date("Sun Nov  6 08:49:37 1994"), DATE);
+  ASSERT_N(parse_http_date("yesterday"), -1);
+  ASSERT_N(parse_http_date("Sun, 06 Nov 1994 08:49:37 GMT trailing"), -1);
+  format_http_date(DATE, buf);
+  ASSERT_S(buf, "Sun, 06 Nov 1994 08:49:37 GMT");
+}
+
+void test_evaluate() {
+  struct rs_preconditions p;
+
+  memset(&p, 0, sizeof(p));
+  ASSERT_N(evaluate_preconditions(&p, 1, "abc", DATE), 0);
+
+  p.if_match = "\"abc\"";
+  ASSERT_N(evaluate_preconditions(&p, 0, "abc", DATE), 0);
+  ASSERT_N(evaluate_preconditions(&p, 0, "def", DATE), 412);
+  ASSERT_N(evaluate_preconditions(&p, 0, NULL, -1), 412);
+  p.if_match = "*";
+  ASSERT_N(evaluate_preconditions(&p, 0, "abc", DATE), 0);
+  ASSERT_N(evaluate_preconditions(&p, 0, NULL, -1), 412);
+
+  memset(&p, 0, sizeof(p));
+  p.if_none_match = "\"def\", \"abc\"";
+  ASSERT_N(evaluate_preconditions(&p, 1, "abc", DATE), 304);
+  ASSERT_N(evaluate_preconditions(&p, 0, "abc", DATE), 412);
+  ASSERT_N(evaluate_preconditions(&p, 1, "xyz", DATE), 0);
+  p.if_none_match = "*";
+  ASSERT_N(evaluate_preconditions(&p, 0, NULL, -1), 0);
+  ASSERT_N(evaluate_preconditions(&p, 0, "abc", DATE), 412);
+
+  // If-Modified-Since is ignored if If-None-Match is given
+  memset(&p, 0, sizeof(p));
+  p.if_modified_since = "Sun, 06 Nov 1994 08:49:37 GMT";
+  ASSERT_N(evaluate_preconditions(&p, 1, "abc", DATE), 304);
+  ASSERT_N(evaluate_preconditions(&p, 1, "abc", DATE + 1), 0);
+  ASSERT_N(evaluate_preconditions(&p, 1, "abc", -1), 0);
+  ASSERT_N(evaluate_preconditions(&p, 0, "abc", DATE), 0);
+  p.if_none_match = "\"xyz\"";
+  ASSERT_N(evaluate_preconditions(&p, 1, "abc", DATE), 0);
+  p.if_modified_since = "garbage";
+  p.if_none_match = NULL;
+  ASSERT_N(evaluate_preconditions(&p, 1, "abc", DATE), 0);
+
+  memset(&p, 0, sizeof(p));
+  p.if_unmodified_since = "Sun, 06 Nov 1994 08:49:37 GMT";
+  ASSERT_N(evaluate_preconditions(&p, 0, "abc", DATE), 0);
+  ASSERT_N(evaluate_preconditions(&p, 0, "abc", DATE + 1), 412);
+  p.if_match = "abc";
+  ASSERT_N(evaluate_preconditions(&p, 0, "abc", DATE + 1), 0);
+}
+
+void test_evaluate_coded() {
+  struct rs_preconditions p;
+
+  memset(&p, 0, sizeof(p));
+  p.if_match = "\"abc-gzip\"";
+  ASSERT_N(evaluate_preconditions(&p, 0, "abc", DATE), 0);
+  p.if_match = "\"abc-br\"";
+  ASSERT_N(evaluate_preconditions(&p, 0, "abc", DATE), 0);
+  p.if_match = "\"abc-deflate\"";
+  ASSERT_N(evaluate_preconditions(&p, 0, "abc", DATE), 412);
+  p.if_match = "\"ab-gzip\"";
+  ASSERT_N(evaluate_preconditions(&p, 0, "abc", DATE), 412);
+  p.if_match = "\"abc-\"";
+  ASSERT_N(evaluate_preconditions(&p, 0, "abc", DATE), 412);
+  p.if_match = "W/\"abc-gzip\"";
+  ASSERT_N(evaluate_preconditions(&p, 0, "abc", DATE), 412);
+
+  memset(&p, 0, sizeof(p));
+  p.if_none_match = "\"abc-gzip\"";
+  ASSERT_N(evaluate_preconditions(&p, 1, "abc", DATE), 304);
+  ASSERT_N(evaluate_preconditions(&p, 1, "abd", DATE), 0);
+  p.if_none_match = "W/\"abc-br\"";
+  ASSERT_N(evaluate_preconditions(&p, 1, "abc", DATE), 304);
+}
+
+int main(int argc, char **argv) {
+  SUITE("Preconditions");
+  TEST("entity tag lists", test_etag_list);
+  TEST("HTTP dates", test_dates);
+  TEST("evaluation order", test_evaluate);
+  TEST("content-coded entity tags", test_evaluate_coded);
+}
@@ -0,0 +1,105 @@
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "common/range.h"
+
+#define SUITE(desc) {                           \
+    printf("\nSuite: %s\n", desc);              \
+  }
+#define TEST(desc, run) {                       \
+    printf("  Test: %s ", desc);                \
+    run();                                      \
+    printf(" OK.\n\n");                         \
+  }
+#define FAIL_ASSERTION(a, b) {                      \
+    printf("\nAssertion failed: %s != %s (%s:%d)\n", a, b, __FILE__, __LINE__);  \
+    abort();                                        \
+  }
+#define ASSERT_S(a, b)                          \
+  if(strcmp((a), (b)) == 0) {                   \
+    printf(".");                                \
+  } else {                                      \
+    FAIL_ASSERTION(__STRING(a), __STRING(b));   \
+  }
+#define ASSERT_N(a, b)                          \
+  if((a) == (b)) {                              \
+    printf(".");                                \
+  } else {                                      \
+    FAIL_ASSERTION(__STRING(a), __STRING(b));   \
+  }
+
+static struct rs_range ranges[4];
+
+void test_single() {
+  ASSERT_N(parse_range("bytes=0-99", 1000, ranges, 4), 1);
+  ASSERT_N(ranges[0].first, 0);
+  ASSERT_N(ranges[0].last, 99);
+  ASSERT_N(parse_range("bytes=900-", 1000, ranges, 4), 1);
+  ASSERT_N(ranges[0].first, 900);
+  ASSERT_N(ranges[0].last, 999);
+  ASSERT_N(parse_range("bytes=-100", 1000, ranges, 4), 1);
+  ASSERT_N(ranges[0].first, 900);
+  ASSERT_N(ranges[0].last, 999);
+  // clamped to the document
+  ASSERT_N(parse_range("bytes=500-5000", 1000, ranges, 4), 1);
+  ASSERT_N(ranges[0].last, 999);
+  ASSERT_N(parse_range("bytes=-5000", 1000, ranges, 4), 1);
+  ASSERT_N(ranges[0].first, 0);
+  ASSERT_N(parse_range(" Bytes = 1-1 ", 1000, ranges, 4), 1);
+  ASSERT_N(ranges[0].first, 1);
+}
+
+void test_multiple() {
+  ASSERT_N(parse_range("bytes=0-0, -1", 1000, ranges, 4), 2);
+  ASSERT_N(ranges[1].first, 999);
+  ASSERT_N(parse_range("bytes=0-1,,2000-3000 , 5-", 1000, ranges, 4), 2);
+  ASSERT_N(ranges[1].first, 5);
+  ASSERT_N(parse_range("bytes=0-1,2-3,4-5,6-7,8-9", 1000, ranges, 4), -1);
+}
+
+void test_unsatisfiable() {
+  ASSERT_N(parse_range("bytes=1000-", 1000, ranges, 4), 0);
+  ASSERT_N(parse_range("bytes=-0", 1000, ranges, 4), 0);
+  ASSERT_N(parse_range("bytes=0-", 0, ranges, 4), 0);
+  ASSERT_N(parse_range("bytes=-10", 0, ranges, 4), 0);
+}
+
+void test_invalid() {
+  ASSERT_N(parse_range("items=0-1", 1000, ranges, 4), -1);
+  ASSERT_N(parse_range("bytes=", 1000, ranges, 4), -1);
+  ASSERT_N(parse_range("bytes=5-1", 1000, ranges, 4), -1);
+  ASSERT_N(parse_range("bytes=a-b", 1000, ranges, 4), -1);
+  ASSERT_N(parse_range("bytes=1-2-3", 1000, ranges, 4), -1);
+  ASSERT_N(parse_range("bytes=99999999999999999999-", 1000, ranges, 4), -1);
+}
+
+void test_content_range() {
+  off_t first, last, total;
+  ASSERT_N(parse_content_range("bytes 0-99/1000", &first, &last, &total), 0);
+  ASSERT_N(first, 0);
+  ASSERT_N(last, 99);
+  ASSERT_N(total, 1000);
+  ASSERT_N(parse_content_range("bytes */1000", &first, &last, &total), 0);
+  ASSERT_N(first, -1);
+  ASSERT_N(total, 1000);
+  ASSERT_N(parse_content_range("bytes 0-99/*", &first, &last, &total), 0);
+  ASSERT_N(total, -1);
+  ASSERT_N(parse_content_range("bytes 0-1000/1000", &first, &last, &total), -1);
+  ASSERT_N(parse_content_range("bytes 9-1/1000", &first, &last, &total), -1);
+  ASSERT_N(parse_content_range("bytes=0-1/1000", &first, &last, &total), -1);
+  ASSERT_N(parse_content_range("bytes 0-1", &first, &last, &total), -1);
+}
+
+int main(int argc, char **argv) {
+  SUITE("Range");
+  TEST("single range", test_single);
+  TEST("multiple ranges", test_multiple);
+  TEST("unsatisfiable ranges", test_unsatisfiable);
+  TEST("invalid headers", test_invalid);
+  TEST("content range", test_content_range);
+}